@@ -0,0 +1,56 @@
+#version 440 core
+
+#define DYNAMIC_INSTANCE_BIT 0x80000000u
+
+#pragma shader_stage(vertex)
+
+// vertex shader for pipelines built with the renderer's PositionProfile (depth prepass, shadows, occlusion), only the position stream is fetched.
+
+// packed position (PackedPosition in VertexPacking.hpp)
+layout(location = 0) in vec4 Position; // relative to the mesh's bounding box, in [-1, 1]
+
+layout(set = 0, binding = 0) uniform Cam_t
+{
+    mat4 World;
+    mat4 View;
+    mat4 Proj;
+    mat4 ProjView;
+} Camera;
+
+layout(std430, set = 0, binding = 1) buffer readonly StaticBuff
+{
+    mat4 Transforms[];
+} StatSceneBuffer;
+
+layout(std430, set = 0, binding = 2) buffer readonly DynamicBuff
+{
+    mat4 Transforms[];
+} DynSceneBuffer;
+
+struct Bounds
+{
+    vec4 Sphere;
+    vec4 Extent;
+};
+
+layout(std430, set = 0, binding = 4) buffer readonly MeshBoundsBuff
+{
+    Bounds Meshes[];
+} MeshBounds;
+
+// the visible instances (scene index, mesh index), written by draw generation.
+layout(std430, set = 1, binding = 2) buffer readonly Visible_t
+{
+    uvec2 Instances[];
+} Visible;
+
+void main()
+{
+    uint TransformIdx = Visible.Instances[gl_InstanceIndex].x;
+    Bounds Mesh = MeshBounds.Meshes[Visible.Instances[gl_InstanceIndex].y];
+
+    vec3 ModelPos = Mesh.Sphere.xyz + Position.xyz * Mesh.Extent.xyz;
+
+    mat4 Transform = ((TransformIdx & DYNAMIC_INSTANCE_BIT) != 0) ? DynSceneBuffer.Transforms[TransformIdx & ~DYNAMIC_INSTANCE_BIT] : StatSceneBuffer.Transforms[TransformIdx];
+    gl_Position = Camera.ProjView * Transform * vec4(ModelPos, 1.0f);
+}
@@ -1,26 +1,18 @@
 #version 440 core
 
-#define MAX_RENDERABLE_INSTANCES 600
+#define DYNAMIC_INSTANCE_BIT 0x80000000u
 
 #pragma shader_stage(vertex)
 
-layout(location = 0) in vec3 Position;
-layout(location = 1) in vec3 Normal;
+// packed vertex (PackedVertex in VertexPacking.hpp)
+layout(location = 0) in vec4 Position; // relative to the mesh's bounding box, in [-1, 1]
+layout(location = 1) in vec2 Normal; // octahedral encoded
 layout(location = 2) in vec2 UV;
 
 layout(location = 0) out vec3 oPos;
 layout(location = 1) out vec3 oNorm;
 layout(location = 2) out vec2 oUV;
 
-struct VkDrawCommand
-{
-    uint IndexCount;
-    uint InstanceCount;
-    uint FirstIndex;
-    int VertexOffset;
-    uint FirstInstance;
-};
-
 layout(set = 0, binding = 0) uniform Cam_t
 {
     mat4 World;
@@ -28,21 +20,44 @@ layout(set = 0, binding = 0) uniform Cam_t
     mat4 Proj;
 } Camera;
 
+layout(std430, set = 0, binding = 1) buffer readonly StaticBuff
+{
+    mat4 Transforms[];
+} StatSceneBuffer;
+
 layout(set = 0, binding = 2) buffer readonly DynamicBuff
 {
     mat4 Transforms[];
 } DynSceneBuffer;
 
-layout(std430, set = 1, binding = 0) buffer readonly Draw_t
+struct Bounds
+{
+    vec4 Sphere;
+    vec4 Extent;
+};
+
+layout(std430, set = 0, binding = 4) buffer readonly MeshBoundsBuff
+{
+    Bounds Meshes[];
+} MeshBounds;
+
+// the visible instances (scene index, mesh index), written by draw generation. Each draw's firstInstance points at its mesh's range, so gl_InstanceIndex indexes it directly.
+layout(std430, set = 1, binding = 2) buffer readonly Visible_t
+{
+    uvec2 Instances[];
+} Visible;
+
+vec3 OctDecode(vec2 Oct)
 {
-    VkDrawCommand Cmd;
+    vec3 N = vec3(Oct, 1.0f - abs(Oct.x) - abs(Oct.y));
 
-    uint MeshBounds;
-    uint InstanceCount;
+    // fold the lower half of the octahedron back down
+    float Fold = max(-N.z, 0.0f);
+    N.x += (N.x >= 0.0f) ? -Fold : Fold;
+    N.y += (N.y >= 0.0f) ? -Fold : Fold;
 
-    uint InstanceSceneIndices[MAX_RENDERABLE_INSTANCES]; // in // maps VisibleInstances[gl_InstanceIndex] to the scene object/instance to be rendered. (in other words use InstanceSceneIndex[VisibleInstances[gl_InstanceIndex]] to get the index of the mesh transform in scene buffer.)
-    uint VisibleInstances[]; // manually map the instances to the global instance structure. (some meshes may have instances at indices like 1, 4, 12, 48, 49, 61, 76, etc. This lists the instances in the global instance buffer that represents this mesh's instances.)
-} Mesh;
+    return normalize(N);
+}
 
 //layout(location = 1) in vec2 inUV;
 
@@ -50,14 +65,17 @@ layout(std430, set = 1, binding = 0) buffer readonly Draw_t
 
 void main()
 {
-    // Issue here. the MeshInstanceIndices is supposed to be mapped to scene buffer indices. But we're skipping that step, pass the instanced::Instances, then use it to map MeshInstanceIndices into scene buffer indices.
-    // uint TransformIdx = Mesh.InstanceSceneIndices[gl_InstanceIndex];
-    uint TransformIdx = Mesh.VisibleInstances[gl_InstanceIndex];
-    gl_Position = Camera.Proj * Camera.View * DynSceneBuffer.Transforms[TransformIdx]* vec4(Position, 1.0f);
+    uint TransformIdx = Visible.Instances[gl_InstanceIndex].x;
+    Bounds Mesh = MeshBounds.Meshes[Visible.Instances[gl_InstanceIndex].y];
+
+    vec3 ModelPos = Mesh.Sphere.xyz + Position.xyz * Mesh.Extent.xyz;
+
+    mat4 Transform = ((TransformIdx & DYNAMIC_INSTANCE_BIT) != 0) ? DynSceneBuffer.Transforms[TransformIdx & ~DYNAMIC_INSTANCE_BIT] : StatSceneBuffer.Transforms[TransformIdx];
+    gl_Position = Camera.Proj * Camera.View * Transform * vec4(ModelPos, 1.0f);
 
-    oPos = Position;
+    oPos = ModelPos;
     // oNorm = normalize(transpose(inverse(mat3(DynSceneBuffer.Transforms[TransformIdx]*Camera.View)))*Normal);
-    oNorm = Normal;
+    oNorm = OctDecode(Normal);
     oUV = UV;
     //outUV = inUV;
 }
@@ -0,0 +1,325 @@
+#include "CopyList.hpp"
+#include "Test.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/* Stands in for a Resources::Buffer, the copy list only ever stores and compares buffer pointers. */
+struct FakeBuffer
+{
+    std::vector<uint8_t> Data;
+};
+
+static Resources::Buffer* AsBuffer(FakeBuffer* pFake) { return reinterpret_cast<Resources::Buffer*>(pFake); }
+static FakeBuffer* AsFake(Resources::Buffer* pBuffer) { return reinterpret_cast<FakeBuffer*>(pBuffer); }
+
+/* Queues writes the way TransferAgent::Transfer() does (in place when a write lands in the last copy to its buffer, otherwise staged in chunks), and keeps a reference copy of every buffer written in submission order. */
+struct FakeTransfer
+{
+    FakeTransfer(VkDeviceSize ChunkSize) : ChunkSize(ChunkSize) {}
+
+    void Write(FakeBuffer* pDst, std::vector<FakeBuffer>& Reference, const std::vector<uint8_t>& Src, VkDeviceSize DstOffset)
+    {
+        std::memcpy(Reference[pDst - pFirst].Data.data()+DstOffset, Src.data(), Src.size());
+
+        VkDeviceSize InPlace;
+
+        if(Copies.FindInLast(AsBuffer(pDst), DstOffset, Src.size(), InPlace))
+        {
+            std::memcpy(Transit.data()+InPlace, Src.data(), Src.size());
+            InPlaceWrites++;
+            return;
+        }
+
+        for(VkDeviceSize Done = 0; Done < Src.size(); Done += ChunkSize)
+        {
+            VkDeviceSize Size = std::min<VkDeviceSize>(Src.size() - Done, ChunkSize);
+
+            // transit ranges are 4 byte aligned, the padding keeps consecutive writes from being contiguous in the transit buffer.
+            VkDeviceSize TransitOffset = (Transit.size() + 3) & ~3ull;
+            Transit.resize(TransitOffset + Size);
+            std::memcpy(Transit.data()+TransitOffset, Src.data()+Done, Size);
+
+            Copies.Add(AsBuffer(pDst), TransitOffset, DstOffset + Done, Size);
+        }
+    }
+
+    /* What RecordBufferCopies() records, one vkCmdCopyBuffer per group. Checks the regions are valid for a single vkCmdCopyBuffer before copying them. */
+    void Flush()
+    {
+        Copies.Resolve();
+
+        const std::vector<VkBufferCopy>& Regions = Copies.GetRegions();
+        std::vector<Resources::Buffer*> Seen;
+
+        for(const BufferCopyList::Group& Group : Copies.GetGroups())
+        {
+            CHECK(std::find(Seen.begin(), Seen.end(), Group.pDst) == Seen.end()); // one copy command per destination
+            Seen.push_back(Group.pDst);
+
+            CHECK(Group.RegionCount != 0);
+
+            FakeBuffer* pDst = AsFake(Group.pDst);
+
+            for(uint32_t i = Group.FirstRegion; i < Group.FirstRegion + Group.RegionCount; i++)
+            {
+                const VkBufferCopy& Region = Regions[i];
+
+                CHECK(Region.size != 0);
+                CHECK(Region.srcOffset + Region.size <= Transit.size());
+                CHECK(Region.dstOffset + Region.size <= pDst->Data.size());
+
+                // sorted, non-overlapping, and anything contiguous in both buffers merged.
+                if(i != Group.FirstRegion)
+                {
+                    const VkBufferCopy& Prev = Regions[i-1];
+
+                    CHECK(Prev.dstOffset + Prev.size <= Region.dstOffset);
+                    CHECK(!(Prev.dstOffset + Prev.size == Region.dstOffset && Prev.srcOffset + Prev.size == Region.srcOffset));
+                }
+
+                std::memcpy(pDst->Data.data()+Region.dstOffset, Transit.data()+Region.srcOffset, Region.size);
+            }
+        }
+
+        RegionCount = (uint32_t)Regions.size();
+
+        Copies.Clear();
+        Transit.clear();
+    }
+
+    FakeBuffer* pFirst = nullptr; // the buffers written to, indices into the reference
+    VkDeviceSize ChunkSize;
+
+    BufferCopyList Copies;
+    std::vector<uint8_t> Transit;
+    uint32_t InPlaceWrites = 0;
+    uint32_t RegionCount = 0;
+};
+
+static std::vector<uint8_t> Bytes(size_t Size, uint8_t Value)
+{
+    return std::vector<uint8_t>(Size, Value);
+}
+
+/* A newer copy starting inside an older one clips it, the older copy resumes after it. */
+static void TestOverlap()
+{
+    std::vector<FakeBuffer> Buffers(1, { Bytes(400, 0) });
+    std::vector<FakeBuffer> Reference = Buffers;
+
+    FakeTransfer Agent(1024);
+    Agent.pFirst = Buffers.data();
+
+    Agent.Write(&Buffers[0], Reference, Bytes(100, 1), 0);
+    Agent.Write(&Buffers[0], Reference, Bytes(100, 2), 200);
+    Agent.Write(&Buffers[0], Reference, Bytes(20, 3), 20); // inside the first copy, but that's no longer the last one
+    Agent.Write(&Buffers[0], Reference, Bytes(40, 4), 80); // straddles the end of the first copy
+    Agent.Write(&Buffers[0], Reference, Bytes(60, 5), 0); // older copies that start before it lose those bytes to it
+
+    CHECK(Agent.InPlaceWrites == 0);
+    CHECK(Agent.Copies.GetCopyCount() == 5);
+
+    Agent.Flush();
+
+    CHECK(Buffers[0].Data == Reference[0].Data);
+    CHECK(Buffers[0].Data[10] == 5 && Buffers[0].Data[65] == 1 && Buffers[0].Data[90] == 4 && Buffers[0].Data[130] == 0 && Buffers[0].Data[250] == 2);
+}
+
+/* An older copy that starts inside a newer one only shows up where the newer one ends. */
+static void TestOlderInsideNewer()
+{
+    std::vector<FakeBuffer> Buffers(1, { Bytes(256, 0) });
+    std::vector<FakeBuffer> Reference = Buffers;
+
+    FakeTransfer Agent(1024);
+    Agent.pFirst = Buffers.data();
+
+    Agent.Write(&Buffers[0], Reference, Bytes(32, 1), 40);
+    Agent.Write(&Buffers[0], Reference, Bytes(64, 2), 16);
+    Agent.Write(&Buffers[0], Reference, Bytes(64, 3), 60);
+
+    Agent.Flush();
+
+    CHECK(Buffers[0].Data == Reference[0].Data);
+    CHECK(Agent.RegionCount == 2);
+}
+
+/* Adjacent writes staged back to back are merged into one region, writes inside the last copy overwrite its staged bytes. */
+static void TestAdjacentAndInPlace()
+{
+    std::vector<FakeBuffer> Buffers(1, { Bytes(256, 0) });
+    std::vector<FakeBuffer> Reference = Buffers;
+
+    FakeTransfer Agent(1024);
+    Agent.pFirst = Buffers.data();
+
+    Agent.Write(&Buffers[0], Reference, Bytes(16, 1), 0);
+    Agent.Write(&Buffers[0], Reference, Bytes(16, 2), 16);
+    Agent.Write(&Buffers[0], Reference, Bytes(32, 3), 32);
+
+    // overwrites of the last copy (and only the last copy) are staged in place.
+    Agent.Write(&Buffers[0], Reference, Bytes(8, 4), 40);
+    Agent.Write(&Buffers[0], Reference, Bytes(32, 5), 32);
+    Agent.Write(&Buffers[0], Reference, Bytes(4, 6), 4);
+
+    CHECK(Agent.InPlaceWrites == 2);
+    CHECK(Agent.Copies.GetCopyCount() == 4);
+
+    Agent.Flush();
+
+    CHECK(Buffers[0].Data == Reference[0].Data);
+    CHECK(Agent.RegionCount == 3); // [0,4), then [4,8) staged at the end of the transit buffer, then [8,64) which is contiguous in both
+}
+
+/* Uploads bigger than a chunk are split, and copies to different buffers are kept apart. */
+static void TestChunksAndDestinations()
+{
+    std::vector<FakeBuffer> Buffers(3, { Bytes(1000, 0) });
+    std::vector<FakeBuffer> Reference = Buffers;
+
+    FakeTransfer Agent(96);
+    Agent.pFirst = Buffers.data();
+
+    std::vector<uint8_t> Ramp(500);
+
+    for(size_t i = 0; i < Ramp.size(); i++) Ramp[i] = (uint8_t)(i*7);
+
+    Agent.Write(&Buffers[2], Reference, Ramp, 100);
+    Agent.Write(&Buffers[0], Reference, Bytes(300, 9), 600);
+    Agent.Write(&Buffers[2], Reference, Bytes(50, 8), 550);
+
+    CHECK(Agent.Copies.GetCopyCount() == 6 + 4 + 1);
+
+    Agent.Flush();
+
+    CHECK(Agent.Copies.GetGroups().size() == 0); // cleared by the flush
+
+    for(size_t i = 0; i < Buffers.size(); i++)
+    {
+        CHECK(Buffers[i].Data == Reference[i].Data);
+    }
+}
+
+/* Deterministic xorshift, so every run writes the same way. */
+static uint32_t Next(uint32_t& State)
+{
+    State ^= State << 13;
+    State ^= State >> 17;
+    State ^= State << 5;
+    return State;
+}
+
+/* Random overlapping, adjacent and repeated writes to a few buffers, over several flushes. The buffers end up exactly as the writes applied in order would leave them. */
+static void TestRandom(uint32_t Seed)
+{
+    std::vector<FakeBuffer> Buffers(4, { Bytes(2048, 0) });
+    std::vector<FakeBuffer> Reference = Buffers;
+
+    FakeTransfer Agent(256);
+    Agent.pFirst = Buffers.data();
+
+    for(uint32_t Flush = 0; Flush < 20; Flush++)
+    {
+        uint32_t WriteCount = Next(Seed) % 40;
+        VkDeviceSize LastEnd = 0;
+
+        for(uint32_t w = 0; w < WriteCount; w++)
+        {
+            FakeBuffer* pDst = &Buffers[Next(Seed) % Buffers.size()];
+
+            VkDeviceSize Size = 1 + Next(Seed) % 600;
+            VkDeviceSize Offset = Next(Seed) % (2048 - Size + 1);
+
+            // every so often write right after the previous write, to exercise merging.
+            if(Next(Seed) % 4 == 0 && LastEnd + Size <= 2048)
+            {
+                Offset = LastEnd;
+            }
+
+            LastEnd = Offset + Size;
+
+            std::vector<uint8_t> Src(Size);
+
+            for(uint8_t& Byte : Src) Byte = (uint8_t)Next(Seed);
+
+            Agent.Write(pDst, Reference, Src, Offset);
+        }
+
+        Agent.Flush();
+
+        for(size_t i = 0; i < Buffers.size(); i++)
+        {
+            CHECK(Buffers[i].Data == Reference[i].Data);
+        }
+    }
+}
+
+/* Image uploads are split into boxes of whole rows (or whole slices), tiling the uploaded region in the order of the data. */
+static void TestImageChunks()
+{
+    std::vector<ImageChunk> Chunks;
+
+    // rows, the last chunk takes the remainder.
+    CHECK(SplitImageUpload(4, {100, 50, 1}, {3, 5, 0}, 4*100*7 + 10, Chunks));
+    CHECK(Chunks.size() == 8);
+
+    VkDeviceSize SrcOffset = 0;
+    int32_t Y = 5;
+
+    for(const ImageChunk& Chunk : Chunks)
+    {
+        CHECK(Chunk.SrcOffset == SrcOffset);
+        CHECK(Chunk.Size == 4*100*Chunk.Extent.height);
+        CHECK(Chunk.Size <= 4*100*7 + 10);
+        CHECK(Chunk.Offset.x == 3 && Chunk.Offset.y == Y && Chunk.Offset.z == 0);
+        CHECK(Chunk.Extent.width == 100 && Chunk.Extent.depth == 1);
+
+        SrcOffset += Chunk.Size;
+        Y += (int32_t)Chunk.Extent.height;
+    }
+
+    CHECK(SrcOffset == 4*100*50);
+    CHECK(Chunks.back().Extent.height == 1);
+
+    // a region that fits is a single chunk, a depth of 0 counts as 1.
+    CHECK(SplitImageUpload(4, {100, 50, 0}, {0, 0, 0}, 4*100*50, Chunks));
+    CHECK(Chunks.size() == 1 && Chunks[0].Size == 4*100*50 && Chunks[0].Extent.height == 50 && Chunks[0].Extent.depth == 1);
+
+    // 3d images are split by slices.
+    CHECK(SplitImageUpload(2, {16, 16, 10}, {0, 0, 4}, 2*16*16*3, Chunks));
+    CHECK(Chunks.size() == 4);
+
+    SrcOffset = 0;
+    int32_t Z = 4;
+
+    for(const ImageChunk& Chunk : Chunks)
+    {
+        CHECK(Chunk.SrcOffset == SrcOffset);
+        CHECK(Chunk.Size == 2*16*16*Chunk.Extent.depth);
+        CHECK(Chunk.Offset.z == Z && Chunk.Extent.height == 16);
+
+        SrcOffset += Chunk.Size;
+        Z += (int32_t)Chunk.Extent.depth;
+    }
+
+    CHECK(Z == 14);
+
+    // a row (or slice) that doesn't fit in a chunk can't be split.
+    CHECK(!SplitImageUpload(4, {100, 1, 1}, {0, 0, 0}, 399, Chunks));
+    CHECK(!SplitImageUpload(1, {16, 16, 2}, {0, 0, 0}, 255, Chunks));
+}
+
+int main()
+{
+    TestOverlap();
+    TestOlderInsideNewer();
+    TestAdjacentAndInPlace();
+    TestChunksAndDestinations();
+    TestRandom(0x1234567u);
+    TestRandom(0xC0FFEEu);
+    TestImageChunks();
+
+    return TestResult("CopyList");
+}
@@ -0,0 +1,726 @@
+#include "MemoryType.hpp"
+#include "Test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Runs draw generation (Draw.comp then Compact.comp) on whatever vulkan device there is (a software driver like lavapipe is enough) and compares the result with a cpu frustum cull of the same scene.
+   The pipelines are built here against the shaders' bindings instead of going through InitWrapperFW(), which needs a window and separate graphics and compute queues. */
+
+#ifndef shader_path
+    #define shader_path "Shaders/"
+#endif
+
+#define SKIP_CODE 77 // SKIP_RETURN_CODE of the test, returned when there's no vulkan device to run on
+#define GROUP_SIZE 64 // DRAW_GROUP_SIZE in Renderer.hpp
+#define DYNAMIC_INSTANCE_BIT 0x80000000u
+#define BATCH_COUNT 3
+
+static void Check(VkResult Result, const char* What)
+{
+    if(Result != VK_SUCCESS)
+    {
+        throw std::runtime_error(std::string("CullTest : ") + What + " failed with error " + std::to_string(Result));
+    }
+}
+
+/* Deterministic xorshift, so every run builds the same scene. */
+static uint32_t Next(uint32_t& State)
+{
+    State ^= State << 13;
+    State ^= State >> 17;
+    State ^= State << 5;
+    return State;
+}
+
+static float Range(uint32_t& State, float Min, float Max)
+{
+    return Min + (Max - Min) * (float)(Next(State) % 10000) / 9999.f;
+}
+
+/* Column major, like glm and the shaders. */
+struct Mat4
+{
+    float m[16];
+};
+
+struct Bounds
+{
+    float Sphere[4]; // center in xyz, radius in w
+    float Extent[4];
+};
+
+/* Cam_t in Draw.comp (std140). Draw generation only reads the planes. */
+struct CameraData
+{
+    Mat4 World, View, Proj, ProjView;
+    float Planes[6][4];
+};
+
+/* The scene draw generation culls, laid out like the renderer's draw buffer slices. */
+struct Scene
+{
+    std::vector<Mat4> Static;
+    std::vector<Mat4> Dynamic;
+    std::vector<Bounds> MeshBounds;
+    std::vector<VkDrawIndexedIndirectCommand> Templates; // a mesh's draw before culling, firstInstance is its first instance in the list
+    std::vector<uint32_t> Instances; // (scene index, mesh index) pairs, grouped by mesh
+    std::vector<uint32_t> BatchTable; // (batch index, first compacted draw) per mesh
+    CameraData Camera;
+
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> Expected; // the visible (scene index, mesh index) pairs of each mesh
+};
+
+/* The sphere test of FrustrumCull() in Draw.comp. (Margin) receives how close the sphere came to deciding the other way, scenes reroll instances that are too close to call in float. */
+static bool CpuCull(const CameraData& Camera, const Bounds& Mesh, const Mat4& T, float& Margin)
+{
+    float Center[3];
+
+    for(uint32_t r = 0; r < 3; r++)
+    {
+        Center[r] = T.m[r]*Mesh.Sphere[0] + T.m[4+r]*Mesh.Sphere[1] + T.m[8+r]*Mesh.Sphere[2] + T.m[12+r];
+    }
+
+    float Scale = 0.f;
+
+    for(uint32_t c = 0; c < 3; c++)
+    {
+        Scale = std::max(Scale, T.m[c*4]*T.m[c*4] + T.m[c*4+1]*T.m[c*4+1] + T.m[c*4+2]*T.m[c*4+2]);
+    }
+
+    float Radius = Mesh.Sphere[3] * std::sqrt(Scale);
+
+    bool bVisible = true;
+    Margin = INFINITY;
+
+    for(uint32_t i = 0; i < 6; i++)
+    {
+        const float* Plane = Camera.Planes[i];
+        float Dist = Plane[0]*Center[0] + Plane[1]*Center[1] + Plane[2]*Center[2] + Plane[3] + Radius;
+
+        Margin = std::min(Margin, std::fabs(Dist));
+
+        if(Dist < 0.f)
+        {
+            bVisible = false;
+        }
+    }
+
+    return bVisible;
+}
+
+/* A box shaped frustum and meshes with (InstanceCounts) instances each, scattered in and around it with non-uniform scales. A quarter of the instances are dynamic. */
+static Scene BuildScene(uint32_t Seed, const std::vector<uint32_t>& InstanceCounts)
+{
+    Scene S{};
+
+    const float Planes[6][4] = { {1, 0, 0, 20}, {-1, 0, 0, 20}, {0, 1, 0, 20}, {0, -1, 0, 20}, {0, 0, 1, -2}, {0, 0, -1, 60} };
+    std::memcpy(S.Camera.Planes, Planes, sizeof(Planes));
+
+    uint32_t MeshCount = (uint32_t)InstanceCounts.size();
+    uint32_t BatchSizes[BATCH_COUNT] = {};
+
+    S.Expected.resize(MeshCount);
+
+    for(uint32_t MeshIdx = 0; MeshIdx < MeshCount; MeshIdx++)
+    {
+        Bounds Mesh{};
+        Mesh.Sphere[0] = Range(Seed, -1.f, 1.f);
+        Mesh.Sphere[1] = Range(Seed, -1.f, 1.f);
+        Mesh.Sphere[2] = Range(Seed, -1.f, 1.f);
+        Mesh.Sphere[3] = Range(Seed, 0.5f, 4.f);
+
+        S.MeshBounds.push_back(Mesh);
+
+        VkDrawIndexedIndirectCommand Template{};
+        Template.indexCount = 3 + 3*MeshIdx;
+        Template.instanceCount = 0;
+        Template.firstIndex = 1000*MeshIdx;
+        Template.vertexOffset = (int32_t)(500*MeshIdx);
+        Template.firstInstance = (uint32_t)(S.Instances.size()/2);
+
+        S.Templates.push_back(Template);
+
+        // a batch's range has room for the draws of all of its meshes, the first compacted draw is filled in once the batch sizes are known.
+        uint32_t Batch = MeshIdx % BATCH_COUNT;
+        S.BatchTable.push_back(Batch);
+        S.BatchTable.push_back(0);
+        BatchSizes[Batch]++;
+
+        for(uint32_t i = 0; i < InstanceCounts[MeshIdx]; i++)
+        {
+            Mat4 T;
+            float Margin;
+            bool bVisible;
+
+            do
+            {
+                T = {};
+                T.m[0] = Range(Seed, 0.2f, 3.f);
+                T.m[5] = Range(Seed, 0.2f, 3.f);
+                T.m[10] = Range(Seed, 0.2f, 3.f);
+                T.m[12] = Range(Seed, -40.f, 40.f);
+                T.m[13] = Range(Seed, -40.f, 40.f);
+                T.m[14] = Range(Seed, -20.f, 80.f);
+                T.m[15] = 1.f;
+
+                bVisible = CpuCull(S.Camera, Mesh, T, Margin);
+            } while(Margin < 0.01f);
+
+            uint32_t SceneIdx;
+
+            if(Next(Seed) % 4 == 0)
+            {
+                SceneIdx = (uint32_t)S.Dynamic.size() | DYNAMIC_INSTANCE_BIT;
+                S.Dynamic.push_back(T);
+            }
+            else
+            {
+                SceneIdx = (uint32_t)S.Static.size();
+                S.Static.push_back(T);
+            }
+
+            S.Instances.push_back(SceneIdx);
+            S.Instances.push_back(MeshIdx);
+
+            if(bVisible)
+            {
+                S.Expected[MeshIdx].push_back({SceneIdx, MeshIdx});
+            }
+        }
+    }
+
+    // batches are laid out one after the other in the compacted list.
+    uint32_t BatchFirst[BATCH_COUNT] = {};
+
+    for(uint32_t b = 1; b < BATCH_COUNT; b++)
+    {
+        BatchFirst[b] = BatchFirst[b-1] + BatchSizes[b-1];
+    }
+
+    for(uint32_t MeshIdx = 0; MeshIdx < MeshCount; MeshIdx++)
+    {
+        S.BatchTable[MeshIdx*2+1] = BatchFirst[S.BatchTable[MeshIdx*2]];
+    }
+
+    return S;
+}
+
+/* A host visible buffer, everything the test touches is read or written by the cpu. */
+struct GpuBuffer
+{
+    VkBuffer Buffer = VK_NULL_HANDLE;
+    VkDeviceMemory Memory = VK_NULL_HANDLE;
+    uint8_t* pData = nullptr;
+    VkDeviceSize Size = 0;
+};
+
+class CullRunner
+{
+public:
+    /*! \brief Create a device on the first gpu with a compute queue, and the two draw generation pipelines.
+        @return false if there is no vulkan device to run on.
+    */
+    bool Init()
+    {
+        VkApplicationInfo AppInfo{};
+        AppInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        AppInfo.pApplicationName = "CullTest";
+        AppInfo.apiVersion = VK_API_VERSION_1_1;
+
+        VkInstanceCreateInfo InstInfo{};
+        InstInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        InstInfo.pApplicationInfo = &AppInfo;
+
+        if(vkCreateInstance(&InstInfo, nullptr, &Instance) != VK_SUCCESS)
+        {
+            Instance = VK_NULL_HANDLE;
+            return false;
+        }
+
+        uint32_t GpuCount = 0;
+        vkEnumeratePhysicalDevices(Instance, &GpuCount, nullptr);
+
+        std::vector<VkPhysicalDevice> Gpus(GpuCount);
+        vkEnumeratePhysicalDevices(Instance, &GpuCount, Gpus.data());
+
+        for(VkPhysicalDevice Candidate : Gpus)
+        {
+            uint32_t FamilyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(Candidate, &FamilyCount, nullptr);
+
+            std::vector<VkQueueFamilyProperties> Families(FamilyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(Candidate, &FamilyCount, Families.data());
+
+            for(uint32_t i = 0; i < FamilyCount && Gpu == VK_NULL_HANDLE; i++)
+            {
+                if(Families[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
+                {
+                    Gpu = Candidate;
+                    Family = i;
+                }
+            }
+        }
+
+        if(Gpu == VK_NULL_HANDLE)
+        {
+            return false;
+        }
+
+        VkPhysicalDeviceProperties Props;
+        vkGetPhysicalDeviceProperties(Gpu, &Props);
+        vkGetPhysicalDeviceMemoryProperties(Gpu, &MemProps);
+
+        std::printf("CullTest : running on %s\n", Props.deviceName);
+
+        float Priority = 1.f;
+
+        VkDeviceQueueCreateInfo QueueInfo{};
+        QueueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        QueueInfo.queueFamilyIndex = Family;
+        QueueInfo.queueCount = 1;
+        QueueInfo.pQueuePriorities = &Priority;
+
+        VkDeviceCreateInfo DeviceInfo{};
+        DeviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        DeviceInfo.queueCreateInfoCount = 1;
+        DeviceInfo.pQueueCreateInfos = &QueueInfo;
+
+        Check(vkCreateDevice(Gpu, &DeviceInfo, nullptr, &Device), "vkCreateDevice");
+        vkGetDeviceQueue(Device, Family, 0, &Queue);
+
+        // the set layouts follow the shaders, set 0 holds the scene and set 1 the draw generation buffers.
+        VkDescriptorSetLayoutBinding SceneBindings[4] = {};
+        uint32_t SceneSlots[4] = { 0, 1, 2, 4 };
+
+        for(uint32_t i = 0; i < 4; i++)
+        {
+            SceneBindings[i].binding = SceneSlots[i];
+            SceneBindings[i].descriptorType = (i == 0) ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            SceneBindings[i].descriptorCount = 1;
+            SceneBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorSetLayoutBinding DrawBindings[6] = {};
+
+        for(uint32_t i = 0; i < 6; i++)
+        {
+            DrawBindings[i].binding = i;
+            DrawBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            DrawBindings[i].descriptorCount = 1;
+            DrawBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo LayoutInfo{};
+        LayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+
+        LayoutInfo.bindingCount = 4;
+        LayoutInfo.pBindings = SceneBindings;
+        Check(vkCreateDescriptorSetLayout(Device, &LayoutInfo, nullptr, &SetLayouts[0]), "vkCreateDescriptorSetLayout");
+
+        LayoutInfo.bindingCount = 6;
+        LayoutInfo.pBindings = DrawBindings;
+        Check(vkCreateDescriptorSetLayout(Device, &LayoutInfo, nullptr, &SetLayouts[1]), "vkCreateDescriptorSetLayout");
+
+        VkPipelineLayoutCreateInfo PipeLayoutInfo{};
+        PipeLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        PipeLayoutInfo.setLayoutCount = 2;
+        PipeLayoutInfo.pSetLayouts = SetLayouts;
+
+        Check(vkCreatePipelineLayout(Device, &PipeLayoutInfo, nullptr, &PipeLayout), "vkCreatePipelineLayout");
+
+        DrawPipeline = CreatePipeline(shader_path "Draw.spv");
+        CompactPipeline = CreatePipeline(shader_path "Compact.spv");
+
+        VkDescriptorPoolSize PoolSizes[2] = { { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 }, { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9 } };
+
+        VkDescriptorPoolCreateInfo PoolInfo{};
+        PoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        PoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+        PoolInfo.maxSets = 2;
+        PoolInfo.poolSizeCount = 2;
+        PoolInfo.pPoolSizes = PoolSizes;
+
+        Check(vkCreateDescriptorPool(Device, &PoolInfo, nullptr, &DescPool), "vkCreateDescriptorPool");
+
+        VkCommandPoolCreateInfo CmdPoolInfo{};
+        CmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        CmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        CmdPoolInfo.queueFamilyIndex = Family;
+
+        Check(vkCreateCommandPool(Device, &CmdPoolInfo, nullptr, &CmdPool), "vkCreateCommandPool");
+
+        return true;
+    }
+
+    ~CullRunner()
+    {
+        if(Device != VK_NULL_HANDLE)
+        {
+            vkDeviceWaitIdle(Device);
+
+            vkDestroyCommandPool(Device, CmdPool, nullptr);
+            vkDestroyDescriptorPool(Device, DescPool, nullptr);
+            vkDestroyPipeline(Device, DrawPipeline, nullptr);
+            vkDestroyPipeline(Device, CompactPipeline, nullptr);
+            vkDestroyPipelineLayout(Device, PipeLayout, nullptr);
+            vkDestroyDescriptorSetLayout(Device, SetLayouts[0], nullptr);
+            vkDestroyDescriptorSetLayout(Device, SetLayouts[1], nullptr);
+            vkDestroyDevice(Device, nullptr);
+        }
+
+        if(Instance != VK_NULL_HANDLE)
+        {
+            vkDestroyInstance(Instance, nullptr);
+        }
+    }
+
+    /*! \brief Cull (S) on the gpu and check the visible instances and compacted draws against the cpu cull. */
+    void Run(const Scene& S)
+    {
+        uint32_t MeshCount = (uint32_t)S.Templates.size();
+        uint32_t InstanceCount = (uint32_t)(S.Instances.size()/2);
+
+        // inputs
+        GpuBuffer Camera = CreateBuffer(sizeof(CameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        GpuBuffer Static = CreateBuffer(sizeof(Mat4)*std::max<size_t>(S.Static.size(), 1), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        GpuBuffer Dynamic = CreateBuffer(sizeof(Mat4)*std::max<size_t>(S.Dynamic.size(), 1), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        GpuBuffer MeshBounds = CreateBuffer(sizeof(Bounds)*MeshCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        GpuBuffer InstanceList = CreateBuffer(sizeof(uint32_t)*2 + sizeof(uint32_t)*S.Instances.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        GpuBuffer BatchTable = CreateBuffer(sizeof(uint32_t)*2 + sizeof(uint32_t)*S.BatchTable.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+        // outputs
+        GpuBuffer Draws = CreateBuffer(sizeof(VkDrawIndexedIndirectCommand)*MeshCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        GpuBuffer Visible = CreateBuffer(sizeof(uint32_t)*2*std::max(InstanceCount, 1u), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        GpuBuffer DrawCounts = CreateBuffer(sizeof(uint32_t)*BATCH_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        GpuBuffer Compacted = CreateBuffer(sizeof(VkDrawIndexedIndirectCommand)*MeshCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+        std::memcpy(Camera.pData, &S.Camera, sizeof(CameraData));
+        std::memcpy(Static.pData, S.Static.data(), sizeof(Mat4)*S.Static.size());
+        std::memcpy(Dynamic.pData, S.Dynamic.data(), sizeof(Mat4)*S.Dynamic.size());
+        std::memcpy(MeshBounds.pData, S.MeshBounds.data(), sizeof(Bounds)*MeshCount);
+
+        // counts are padded to the alignment of the pairs that follow them, like the renderer's draw buffer.
+        std::memcpy(InstanceList.pData, &InstanceCount, sizeof(uint32_t));
+        std::memcpy(InstanceList.pData + sizeof(uint32_t)*2, S.Instances.data(), sizeof(uint32_t)*S.Instances.size());
+        std::memcpy(BatchTable.pData, &MeshCount, sizeof(uint32_t));
+        std::memcpy(BatchTable.pData + sizeof(uint32_t)*2, S.BatchTable.data(), sizeof(uint32_t)*S.BatchTable.size());
+
+        // the draws are reset from their templates and the counts zeroed before draw generation, and the outputs poisoned so stray writes show up.
+        std::memcpy(Draws.pData, S.Templates.data(), sizeof(VkDrawIndexedIndirectCommand)*MeshCount);
+        std::memset(Visible.pData, 0xFF, Visible.Size);
+        std::memset(DrawCounts.pData, 0, DrawCounts.Size);
+        std::memset(Compacted.pData, 0xFF, Compacted.Size);
+
+        // descriptor sets
+        VkDescriptorSet Sets[2];
+
+        VkDescriptorSetAllocateInfo SetInfo{};
+        SetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        SetInfo.descriptorPool = DescPool;
+        SetInfo.descriptorSetCount = 2;
+        SetInfo.pSetLayouts = SetLayouts;
+
+        Check(vkAllocateDescriptorSets(Device, &SetInfo, Sets), "vkAllocateDescriptorSets");
+
+        const std::pair<uint32_t, GpuBuffer*> SceneSlots[] = { {0, &Camera}, {1, &Static}, {2, &Dynamic}, {4, &MeshBounds} };
+        const std::pair<uint32_t, GpuBuffer*> DrawSlots[] = { {0, &Draws}, {1, &InstanceList}, {2, &Visible}, {3, &BatchTable}, {4, &DrawCounts}, {5, &Compacted} };
+
+        VkDescriptorBufferInfo BufferInfos[10];
+        VkWriteDescriptorSet Writes[10] = {};
+        uint32_t WriteCount = 0;
+
+        for(uint32_t s = 0; s < 2; s++)
+        {
+            const std::pair<uint32_t, GpuBuffer*>* pSlots = (s == 0) ? SceneSlots : DrawSlots;
+            uint32_t SlotCount = (s == 0) ? 4 : 6;
+
+            for(uint32_t i = 0; i < SlotCount; i++)
+            {
+                BufferInfos[WriteCount] = { pSlots[i].second->Buffer, 0, VK_WHOLE_SIZE };
+
+                VkWriteDescriptorSet& Write = Writes[WriteCount];
+                Write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                Write.dstSet = Sets[s];
+                Write.dstBinding = pSlots[i].first;
+                Write.descriptorCount = 1;
+                Write.descriptorType = (s == 0 && pSlots[i].first == 0) ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                Write.pBufferInfo = &BufferInfos[WriteCount];
+
+                WriteCount++;
+            }
+        }
+
+        vkUpdateDescriptorSets(Device, WriteCount, Writes, 0, nullptr);
+
+        // record draw generation the way SceneRenderer::Render() does.
+        VkCommandBuffer Cmd;
+
+        VkCommandBufferAllocateInfo CmdInfo{};
+        CmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        CmdInfo.commandPool = CmdPool;
+        CmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        CmdInfo.commandBufferCount = 1;
+
+        Check(vkAllocateCommandBuffers(Device, &CmdInfo, &Cmd), "vkAllocateCommandBuffers");
+
+        VkCommandBufferBeginInfo BeginInfo{};
+        BeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        BeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        Check(vkBeginCommandBuffer(Cmd, &BeginInfo), "vkBeginCommandBuffer");
+
+            vkCmdBindDescriptorSets(Cmd, VK_PIPELINE_BIND_POINT_COMPUTE, PipeLayout, 0, 2, Sets, 0, nullptr);
+
+            vkCmdBindPipeline(Cmd, VK_PIPELINE_BIND_POINT_COMPUTE, DrawPipeline);
+            vkCmdDispatch(Cmd, (InstanceCount+GROUP_SIZE-1)/GROUP_SIZE, 1, 1);
+
+            VkMemoryBarrier Barrier{};
+            Barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            Barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            Barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            vkCmdPipelineBarrier(Cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &Barrier, 0, nullptr, 0, nullptr);
+
+            vkCmdBindPipeline(Cmd, VK_PIPELINE_BIND_POINT_COMPUTE, CompactPipeline);
+            vkCmdDispatch(Cmd, (MeshCount+GROUP_SIZE-1)/GROUP_SIZE, 1, 1);
+
+            Barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+            vkCmdPipelineBarrier(Cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &Barrier, 0, nullptr, 0, nullptr);
+
+        Check(vkEndCommandBuffer(Cmd), "vkEndCommandBuffer");
+
+        VkFence Fence;
+
+        VkFenceCreateInfo FenceInfo{};
+        FenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        Check(vkCreateFence(Device, &FenceInfo, nullptr, &Fence), "vkCreateFence");
+
+        VkSubmitInfo Submit{};
+        Submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        Submit.commandBufferCount = 1;
+        Submit.pCommandBuffers = &Cmd;
+
+        Check(vkQueueSubmit(Queue, 1, &Submit, Fence), "vkQueueSubmit");
+        Check(vkWaitForFences(Device, 1, &Fence, VK_TRUE, UINT64_MAX), "vkWaitForFences");
+
+        vkDestroyFence(Device, Fence, nullptr);
+        vkFreeCommandBuffers(Device, CmdPool, 1, &Cmd);
+        vkFreeDescriptorSets(Device, DescPool, 2, Sets);
+
+        CheckResults(S, (const VkDrawIndexedIndirectCommand*)Draws.pData, (const uint32_t*)Visible.pData, (const uint32_t*)DrawCounts.pData, (const VkDrawIndexedIndirectCommand*)Compacted.pData);
+
+        for(GpuBuffer* pBuffer : { &Camera, &Static, &Dynamic, &MeshBounds, &InstanceList, &BatchTable, &Draws, &Visible, &DrawCounts, &Compacted })
+        {
+            DestroyBuffer(*pBuffer);
+        }
+    }
+
+private:
+    static bool SameDraw(const VkDrawIndexedIndirectCommand& A, const VkDrawIndexedIndirectCommand& B)
+    {
+        return A.indexCount == B.indexCount && A.instanceCount == B.instanceCount && A.firstIndex == B.firstIndex && A.vertexOffset == B.vertexOffset && A.firstInstance == B.firstInstance;
+    }
+
+    void CheckResults(const Scene& S, const VkDrawIndexedIndirectCommand* pDraws, const uint32_t* pVisible, const uint32_t* pCounts, const VkDrawIndexedIndirectCommand* pCompacted)
+    {
+        uint32_t MeshCount = (uint32_t)S.Templates.size();
+        uint32_t VisibleMeshes[BATCH_COUNT] = {};
+
+        // every mesh's draw counts its visible instances, which fill the start of its range of the visible list.
+        for(uint32_t MeshIdx = 0; MeshIdx < MeshCount; MeshIdx++)
+        {
+            const VkDrawIndexedIndirectCommand& Template = S.Templates[MeshIdx];
+            const VkDrawIndexedIndirectCommand& Draw = pDraws[MeshIdx];
+
+            std::vector<std::pair<uint32_t, uint32_t>> Expected = S.Expected[MeshIdx];
+
+            CHECK(Draw.instanceCount == Expected.size());
+            CHECK(Draw.indexCount == Template.indexCount && Draw.firstIndex == Template.firstIndex && Draw.vertexOffset == Template.vertexOffset && Draw.firstInstance == Template.firstInstance);
+
+            std::vector<std::pair<uint32_t, uint32_t>> Written;
+
+            for(uint32_t i = 0; i < std::min<uint32_t>(Draw.instanceCount, (uint32_t)Expected.size()); i++)
+            {
+                Written.push_back({pVisible[(Template.firstInstance+i)*2], pVisible[(Template.firstInstance+i)*2+1]});
+            }
+
+            // the order within a mesh's range depends on the order the workgroups ran in.
+            std::sort(Written.begin(), Written.end());
+            std::sort(Expected.begin(), Expected.end());
+
+            CHECK(Written == Expected);
+
+            if(Expected.size() != 0)
+            {
+                VisibleMeshes[S.BatchTable[MeshIdx*2]]++;
+            }
+        }
+
+        // every batch's range starts with the draws of its meshes that have visible instances, and nothing else.
+        for(uint32_t Batch = 0; Batch < BATCH_COUNT; Batch++)
+        {
+            CHECK(pCounts[Batch] == VisibleMeshes[Batch]);
+
+            std::vector<uint32_t> Expected;
+            uint32_t BatchFirst = 0;
+
+            for(uint32_t MeshIdx = 0; MeshIdx < MeshCount; MeshIdx++)
+            {
+                if(S.BatchTable[MeshIdx*2] != Batch) continue;
+
+                BatchFirst = S.BatchTable[MeshIdx*2+1];
+
+                if(S.Expected[MeshIdx].size() != 0) Expected.push_back(MeshIdx);
+            }
+
+            std::vector<uint32_t> Written;
+
+            for(uint32_t i = 0; i < std::min(pCounts[Batch], VisibleMeshes[Batch]); i++)
+            {
+                const VkDrawIndexedIndirectCommand& Draw = pCompacted[BatchFirst + i];
+
+                // the template's first index identifies the mesh.
+                uint32_t MeshIdx = Draw.firstIndex / 1000;
+
+                CHECK(MeshIdx < MeshCount && SameDraw(Draw, pDraws[std::min(MeshIdx, MeshCount-1)]));
+
+                Written.push_back(MeshIdx);
+            }
+
+            std::sort(Written.begin(), Written.end());
+
+            CHECK(Written == Expected);
+        }
+    }
+
+    VkPipeline CreatePipeline(const char* Path)
+    {
+        std::ifstream File(Path, std::ios::binary | std::ios::ate);
+
+        if(!File.is_open())
+        {
+            throw std::runtime_error(std::string("CullTest : failed to open ") + Path + ", build the Shaders target first.");
+        }
+
+        std::vector<uint32_t> Code((size_t)File.tellg() / sizeof(uint32_t));
+        File.seekg(0);
+        File.read((char*)Code.data(), Code.size()*sizeof(uint32_t));
+
+        VkShaderModuleCreateInfo ModuleInfo{};
+        ModuleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        ModuleInfo.codeSize = Code.size()*sizeof(uint32_t);
+        ModuleInfo.pCode = Code.data();
+
+        VkShaderModule Module;
+        Check(vkCreateShaderModule(Device, &ModuleInfo, nullptr, &Module), "vkCreateShaderModule");
+
+        VkComputePipelineCreateInfo PipeInfo{};
+        PipeInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        PipeInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        PipeInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        PipeInfo.stage.module = Module;
+        PipeInfo.stage.pName = "main";
+        PipeInfo.layout = PipeLayout;
+
+        VkPipeline Pipeline;
+        VkResult Result = vkCreateComputePipelines(Device, VK_NULL_HANDLE, 1, &PipeInfo, nullptr, &Pipeline);
+
+        vkDestroyShaderModule(Device, Module, nullptr);
+        Check(Result, "vkCreateComputePipelines");
+
+        return Pipeline;
+    }
+
+    GpuBuffer CreateBuffer(VkDeviceSize Size, VkBufferUsageFlags Usage)
+    {
+        GpuBuffer Buffer;
+        Buffer.Size = Size;
+
+        VkBufferCreateInfo BuffInfo{};
+        BuffInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        BuffInfo.size = Size;
+        BuffInfo.usage = Usage;
+        BuffInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        Check(vkCreateBuffer(Device, &BuffInfo, nullptr, &Buffer.Buffer), "vkCreateBuffer");
+
+        VkMemoryRequirements MemReq;
+        vkGetBufferMemoryRequirements(Device, Buffer.Buffer, &MemReq);
+
+        VkMemoryAllocateInfo AllocInfo{};
+        AllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        AllocInfo.allocationSize = MemReq.size;
+        AllocInfo.memoryTypeIndex = FindMemoryType(MemProps, MemReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        if(AllocInfo.memoryTypeIndex == UINT32_MAX)
+        {
+            throw std::runtime_error("CullTest : the device has no host visible, coherent memory for a buffer.");
+        }
+
+        Check(vkAllocateMemory(Device, &AllocInfo, nullptr, &Buffer.Memory), "vkAllocateMemory");
+        Check(vkBindBufferMemory(Device, Buffer.Buffer, Buffer.Memory, 0), "vkBindBufferMemory");
+        Check(vkMapMemory(Device, Buffer.Memory, 0, VK_WHOLE_SIZE, 0, (void**)&Buffer.pData), "vkMapMemory");
+
+        return Buffer;
+    }
+
+    void DestroyBuffer(GpuBuffer& Buffer)
+    {
+        vkDestroyBuffer(Device, Buffer.Buffer, nullptr);
+        vkFreeMemory(Device, Buffer.Memory, nullptr);
+    }
+
+    VkInstance Instance = VK_NULL_HANDLE;
+    VkPhysicalDevice Gpu = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties MemProps;
+    VkDevice Device = VK_NULL_HANDLE;
+    uint32_t Family = 0;
+    VkQueue Queue = VK_NULL_HANDLE;
+
+    VkDescriptorSetLayout SetLayouts[2] = {};
+    VkPipelineLayout PipeLayout = VK_NULL_HANDLE;
+    VkPipeline DrawPipeline = VK_NULL_HANDLE;
+    VkPipeline CompactPipeline = VK_NULL_HANDLE;
+    VkDescriptorPool DescPool = VK_NULL_HANDLE;
+    VkCommandPool CmdPool = VK_NULL_HANDLE;
+};
+
+int main()
+{
+    try
+    {
+        CullRunner Runner;
+
+        if(!Runner.Init())
+        {
+            std::printf("CullTest : no vulkan device with a compute queue, skipped\n");
+            return SKIP_CODE;
+        }
+
+        // meshes whose instance runs start and end mid-workgroup, span several workgroups, fill one exactly, or have no instances at all.
+        Runner.Run(BuildScene(0x1234567u, { 37, 1, 0, 100, 64, 5, 130, 3, 27 }));
+
+        // many small meshes, so most workgroups hold several runs.
+        std::vector<uint32_t> Small(150);
+
+        for(uint32_t i = 0; i < Small.size(); i++) Small[i] = 1 + (i*7) % 5;
+
+        Runner.Run(BuildScene(0xBADC0DEu, Small));
+    }
+    catch(std::exception& Err)
+    {
+        std::printf("%s\n", Err.what());
+        return 1;
+    }
+
+    return TestResult("Cull");
+}
@@ -0,0 +1,346 @@
+#include "MemoryHeap.hpp"
+#include "Test.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+/* Stands in for a Resources::Buffer, the heap bookkeeping only ever stores and compares buffer pointers. */
+struct FakeBuffer
+{
+    uint64_t Size;
+    uint64_t Alignment;
+
+    MemoryHeap* pHeap;
+    uint64_t Offset;
+    uint32_t Block;
+};
+
+static Resources::Buffer* AsBuffer(FakeBuffer* pFake) { return reinterpret_cast<Resources::Buffer*>(pFake); }
+static FakeBuffer* AsFake(Resources::Buffer* pBuffer) { return reinterpret_cast<FakeBuffer*>(pBuffer); }
+
+static VkMemoryRequirements GetRequirements(Resources::Buffer* pBuffer)
+{
+    VkMemoryRequirements MemReq{};
+    MemReq.size = AsFake(pBuffer)->Size;
+    MemReq.alignment = AsFake(pBuffer)->Alignment;
+    MemReq.memoryTypeBits = ~0u;
+
+    return MemReq;
+}
+
+static constexpr VkMemoryPropertyFlags DeviceLocal = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+static constexpr VkMemoryPropertyFlags HostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+static constexpr uint64_t KiB = 1024;
+
+/* The application's heaps and buffers, mirroring what the framework's Allocate() and Free() keep track of. */
+struct FakeMemory
+{
+    FakeMemory(std::initializer_list<VkMemoryPropertyFlags> Types) : Props{}
+    {
+        for(VkMemoryPropertyFlags Flags : Types)
+        {
+            Props.memoryTypes[Props.memoryTypeCount++].propertyFlags = Flags;
+        }
+
+        Props.memoryHeapCount = 1;
+    }
+
+    ~FakeMemory()
+    {
+        for(std::vector<MemoryHeap*>& TypeHeaps : Heaps)
+        {
+            for(MemoryHeap* pHeap : TypeHeaps) delete pHeap;
+        }
+    }
+
+    MemoryHeap* AddHeap(uint32_t MemIdx, uint64_t Size, bool bDedicated = false)
+    {
+        MemoryHeap* pHeap = new MemoryHeap();
+        pHeap->Size = Size;
+        pHeap->MemIdx = MemIdx;
+        pHeap->bDedicated = bDedicated;
+        pHeap->SubAllocator.Reset(Size);
+
+        Heaps[MemIdx].push_back(pHeap);
+
+        return pHeap;
+    }
+
+    FakeBuffer* AddBuffer(MemoryHeap* pHeap, uint64_t Size, uint64_t Alignment = 256)
+    {
+        Buffers.push_back({ Size, Alignment, pHeap, 0, 0 });
+        FakeBuffer* pFake = &Buffers.back();
+
+        pFake->Block = pHeap->SubAllocator.Allocate(Size, Alignment, pFake->Offset);
+        CHECK(pFake->Block != Allocators::HeapAllocator::InvalidBlock);
+
+        pHeap->Buffers.push_back(AsBuffer(pFake));
+
+        return pFake;
+    }
+
+    void FreeBuffer(FakeBuffer* pFake)
+    {
+        std::vector<Resources::Buffer*>& List = pFake->pHeap->Buffers;
+        List.erase(std::find(List.begin(), List.end(), AsBuffer(pFake)));
+
+        pFake->pHeap->SubAllocator.Free(pFake->Block);
+        pFake->pHeap = nullptr;
+    }
+
+    /* What Defragment() does once the copies are done: bind the buffers to their new ranges and free the old ones. */
+    void ApplyMoves(const std::vector<DefragMove>& Moves)
+    {
+        for(const DefragMove& Move : Moves)
+        {
+            FakeBuffer* pFake = AsFake(Move.pBuffer);
+            pFake->pHeap->SubAllocator.Free(pFake->Block);
+
+            pFake->pHeap = Move.pHeap;
+            pFake->Offset = Move.Offset;
+            pFake->Block = Move.Block;
+        }
+    }
+
+    VkPhysicalDeviceMemoryProperties Props;
+    std::vector<MemoryHeap*> Heaps[VK_MAX_MEMORY_TYPES];
+    std::deque<FakeBuffer> Buffers; // a deque so buffer pointers stay valid as buffers are added
+};
+
+/* Fragmentation of a memory type's heaps taken together, in the sense of HeapAllocator::GetFragmentation(). */
+static float TypeFragmentation(const std::vector<MemoryHeap*>& Heaps)
+{
+    uint64_t Free = 0;
+    uint64_t Largest = 0;
+
+    for(MemoryHeap* pHeap : Heaps)
+    {
+        Free += pHeap->SubAllocator.GetFree();
+        Largest = std::max(Largest, pHeap->SubAllocator.GetLargestFreeBlock());
+    }
+
+    return Free == 0 ? 0.f : 1.f - (float)Largest / (float)Free;
+}
+
+/* Every buffer in (pHeap)'s list is bound to it, aligned, and no two of them overlap. */
+static void CheckBindings(MemoryHeap* pHeap)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> Ranges;
+
+    for(Resources::Buffer* pBuffer : pHeap->Buffers)
+    {
+        FakeBuffer* pFake = AsFake(pBuffer);
+
+        CHECK(pFake->pHeap == pHeap);
+        CHECK(pFake->Offset % pFake->Alignment == 0);
+        CHECK(pFake->Offset + pFake->Size <= pHeap->Size);
+
+        Ranges.push_back({ pFake->Offset, pFake->Offset + pFake->Size });
+    }
+
+    std::sort(Ranges.begin(), Ranges.end());
+
+    for(size_t i = 1; i < Ranges.size(); i++)
+    {
+        CHECK(Ranges[i-1].second <= Ranges[i].first);
+    }
+
+    CHECK(pHeap->Buffers.size() == pHeap->SubAllocator.GetAllocationCount());
+}
+
+/* Only the least used device local heap below the usage limit, that holds nothing but buffers and has another shared heap to move into, is picked. */
+static void TestPickSource()
+{
+    FakeMemory Mem({ DeviceLocal, HostVisible });
+
+    // host visible heaps are never picked, however empty.
+    for(uint32_t i = 0; i < 2; i++)
+    {
+        Mem.AddBuffer(Mem.AddHeap(1, 1024*KiB), 64*KiB);
+    }
+
+    // a single shared heap has nowhere to move its buffers to (the dedicated heap doesn't count).
+    MemoryHeap* pA = Mem.AddHeap(0, 1024*KiB);
+    MemoryHeap* pDedicated = Mem.AddHeap(0, 64*KiB, true);
+
+    for(uint32_t i = 0; i < 4; i++) Mem.AddBuffer(pA, 64*KiB);
+    Mem.AddBuffer(pDedicated, 64*KiB, 1);
+
+    CHECK(PickDefragSource(Mem.Heaps, Mem.Props, 0.5f) == nullptr);
+
+    // with a second shared heap the least used heap is picked, as long as it's below the limit.
+    MemoryHeap* pB = Mem.AddHeap(0, 1024*KiB);
+
+    for(uint32_t i = 0; i < 6; i++) Mem.AddBuffer(pB, 64*KiB);
+
+    CHECK(PickDefragSource(Mem.Heaps, Mem.Props, 0.5f) == pA);
+    CHECK(PickDefragSource(Mem.Heaps, Mem.Props, 0.25f) == nullptr);
+
+    // empty heaps have nothing to move.
+    MemoryHeap* pEmpty = Mem.AddHeap(0, 1024*KiB);
+
+    CHECK(PickDefragSource(Mem.Heaps, Mem.Props, 0.5f) == pA);
+
+    // a heap that holds anything but buffers (i.e. an image) can't be emptied.
+    uint64_t Offset;
+    pA->SubAllocator.Allocate(16*KiB, 256, Offset);
+
+    CHECK(PickDefragSource(Mem.Heaps, Mem.Props, 0.5f) == pB);
+
+    (void)pEmpty;
+}
+
+/* Fragment a heap, move everything out of it, and check where the buffers ended up and what that did to fragmentation. */
+static void TestMoves()
+{
+    FakeMemory Mem({ DeviceLocal });
+
+    MemoryHeap* pSrc = Mem.AddHeap(0, 1024*KiB);
+    MemoryHeap* pDst = Mem.AddHeap(0, 2048*KiB);
+
+    // fill the source with mixed sizes and free most of them, leaving a few buffers scattered across the heap.
+    std::vector<FakeBuffer*> SrcBuffers;
+
+    for(uint32_t i = 0; i < 16; i++)
+    {
+        SrcBuffers.push_back(Mem.AddBuffer(pSrc, (i % 3 == 0) ? 40000 : 64*KiB, (i % 2 == 0) ? 256 : 4096));
+    }
+
+    for(uint32_t i = 0; i < 16; i++)
+    {
+        if(i % 3 != 1) Mem.FreeBuffer(SrcBuffers[i]);
+    }
+
+    // the destination is fuller (so it isn't the one picked), with a couple of holes of its own.
+    std::vector<FakeBuffer*> DstBuffers;
+
+    for(uint32_t i = 0; i < 20; i++)
+    {
+        DstBuffers.push_back(Mem.AddBuffer(pDst, 64*KiB));
+    }
+
+    Mem.FreeBuffer(DstBuffers[3]);
+    Mem.FreeBuffer(DstBuffers[11]);
+
+    float SrcFragmentation = pSrc->SubAllocator.GetFragmentation();
+    float Fragmentation = TypeFragmentation(Mem.Heaps[0]);
+    uint64_t DstUsed = pDst->SubAllocator.GetUsed();
+
+    CHECK(SrcFragmentation > 0.f);
+    CHECK(PickDefragSource(Mem.Heaps, Mem.Props, 0.5f) == pSrc);
+
+    std::vector<Resources::Buffer*> ToMove = pSrc->Buffers;
+
+    std::vector<DefragMove> Moves = PlanDefragMoves(Mem.Heaps[0], pSrc, UINT64_MAX, GetRequirements);
+
+    // every buffer moved, taken from the back of the source's list, into the other heap.
+    CHECK(Moves.size() == ToMove.size());
+    CHECK(pSrc->Buffers.empty());
+
+    uint64_t MovedBytes = 0;
+
+    for(size_t i = 0; i < Moves.size(); i++)
+    {
+        CHECK(Moves[i].pBuffer == ToMove[ToMove.size()-1-i]);
+        CHECK(Moves[i].pHeap == pDst);
+        CHECK(Moves[i].Size == AsFake(Moves[i].pBuffer)->Size);
+        CHECK(std::find(pDst->Buffers.begin(), pDst->Buffers.end(), Moves[i].pBuffer) != pDst->Buffers.end());
+
+        MovedBytes += Moves[i].Size;
+    }
+
+    // the old ranges stay allocated until the caller frees them (the copies read from them).
+    CHECK(pSrc->SubAllocator.GetAllocationCount() == ToMove.size());
+    CHECK(pDst->SubAllocator.GetUsed() == DstUsed + MovedBytes);
+
+    Mem.ApplyMoves(Moves);
+
+    CheckBindings(pDst);
+
+    // the source is empty and in one piece (so Free() can release it), and the memory type as a whole is less fragmented.
+    CHECK(pSrc->SubAllocator.GetAllocationCount() == 0);
+    CHECK(pSrc->SubAllocator.GetLargestFreeBlock() == pSrc->Size);
+    CHECK(pSrc->SubAllocator.GetFragmentation() == 0.f);
+    CHECK(pSrc->SubAllocator.GetFragmentation() < SrcFragmentation);
+    CHECK(TypeFragmentation(Mem.Heaps[0]) < Fragmentation);
+
+    // with nothing left to move, and the destination too full, nothing is picked.
+    CHECK(PickDefragSource(Mem.Heaps, Mem.Props, 0.5f) == nullptr);
+}
+
+/* Planning stops once the budget is spent, the rest of the heap waits for the next call. */
+static void TestBudget()
+{
+    FakeMemory Mem({ DeviceLocal });
+
+    MemoryHeap* pSrc = Mem.AddHeap(0, 1024*KiB);
+    MemoryHeap* pDst = Mem.AddHeap(0, 1024*KiB);
+
+    for(uint32_t i = 0; i < 6; i++) Mem.AddBuffer(pSrc, 64*KiB);
+    for(uint32_t i = 0; i < 8; i++) Mem.AddBuffer(pDst, 64*KiB);
+
+    // the budget is checked before each buffer, so the buffer that crosses it still moves.
+    std::vector<DefragMove> Moves = PlanDefragMoves(Mem.Heaps[0], pSrc, 100000, GetRequirements);
+
+    CHECK(Moves.size() == 2);
+    CHECK(pSrc->Buffers.size() == 4);
+    CHECK(pDst->Buffers.size() == 10);
+
+    Mem.ApplyMoves(Moves);
+
+    CheckBindings(pSrc);
+    CheckBindings(pDst);
+
+    // the next call picks up where this one stopped.
+    Moves = PlanDefragMoves(Mem.Heaps[0], pSrc, UINT64_MAX, GetRequirements);
+
+    CHECK(Moves.size() == 4);
+
+    Mem.ApplyMoves(Moves);
+
+    CheckBindings(pDst);
+    CHECK(pSrc->SubAllocator.GetAllocationCount() == 0);
+}
+
+/* Heaps are never created to make room, and neither dedicated heaps nor the source itself take moved buffers. */
+static void TestNoRoom()
+{
+    FakeMemory Mem({ DeviceLocal });
+
+    MemoryHeap* pSrc = Mem.AddHeap(0, 1024*KiB);
+    MemoryHeap* pDedicated = Mem.AddHeap(0, 1024*KiB, true);
+    MemoryHeap* pDst = Mem.AddHeap(0, 1024*KiB);
+
+    FakeBuffer* pFirst = Mem.AddBuffer(pSrc, 64*KiB);
+    FakeBuffer* pBig = Mem.AddBuffer(pSrc, 256*KiB);
+    FakeBuffer* pLast = Mem.AddBuffer(pSrc, 64*KiB);
+
+    for(uint32_t i = 0; i < 13; i++) Mem.AddBuffer(pDst, 64*KiB);
+
+    // the last buffer fits, the big one doesn't, so planning stops there even though the first one would fit.
+    std::vector<DefragMove> Moves = PlanDefragMoves(Mem.Heaps[0], pSrc, UINT64_MAX, GetRequirements);
+
+    CHECK(Moves.size() == 1);
+    CHECK(Moves.size() == 1 && Moves[0].pBuffer == AsBuffer(pLast) && Moves[0].pHeap == pDst);
+    CHECK(pSrc->Buffers.size() == 2 && pSrc->Buffers.back() == AsBuffer(pBig));
+    CHECK(pDedicated->SubAllocator.GetAllocationCount() == 0);
+
+    Mem.ApplyMoves(Moves);
+
+    CheckBindings(pSrc);
+    CheckBindings(pDst);
+    CHECK(pFirst->pHeap == pSrc && pBig->pHeap == pSrc);
+}
+
+int main()
+{
+    TestPickSource();
+    TestMoves();
+    TestBudget();
+    TestNoRoom();
+
+    return TestResult("Defragment");
+}
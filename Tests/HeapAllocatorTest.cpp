@@ -0,0 +1,192 @@
+#include "HeapAllocator.hpp"
+#include "Test.hpp"
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <vector>
+
+using Allocators::HeapAllocator;
+
+struct LiveBlock
+{
+    uint32_t Block;
+    uint64_t Offset;
+    uint64_t Size;
+};
+
+/* Deterministic xorshift, so every run replays the same trace. */
+static uint64_t Next(uint64_t& State)
+{
+    State ^= State << 13;
+    State ^= State >> 7;
+    State ^= State << 17;
+    return State;
+}
+
+/* Replay a mixed allocate/free trace, checking after every step that live ranges are aligned, inside the heap and never overlap, and that UsedBytes tracks them.
+   The trace is generated (sizes up to a page, alignments up to 256, slightly more allocations than frees), it stands in for a trace recorded from the renderer. */
+static void TestTraceReplay()
+{
+    constexpr uint64_t HeapSize = 1 << 20;
+    constexpr uint32_t Steps = 20000;
+
+    HeapAllocator Heap(HeapSize);
+
+    std::vector<LiveBlock> Live;
+    std::map<uint64_t, uint64_t> Ranges; // offset -> end of every live range
+
+    uint64_t State = 0x9E3779B97F4A7C15ull;
+    uint64_t Requested = 0;
+
+    for(uint32_t Step = 0; Step < Steps; Step++)
+    {
+        bool bAllocate = Live.empty() || (Next(State) % 100) < 55;
+
+        if(bAllocate)
+        {
+            uint64_t Size = 1 + Next(State) % 4096;
+            uint64_t Alignment = 1ull << (Next(State) % 9);
+
+            uint64_t Offset;
+            uint32_t Block = Heap.Allocate(Size, Alignment, Offset);
+
+            if(Block == HeapAllocator::InvalidBlock)
+            {
+                // a failed allocation is only acceptable when no free range could hold it.
+                CHECK(Heap.GetLargestFreeBlock() < Size + Alignment - 1);
+                continue;
+            }
+
+            CHECK(Offset % Alignment == 0);
+            CHECK(Offset + Size <= HeapSize);
+
+            auto After = Ranges.lower_bound(Offset);
+
+            if(After != Ranges.end()) CHECK(Offset + Size <= After->first);
+            if(After != Ranges.begin()) CHECK(std::prev(After)->second <= Offset);
+
+            Ranges[Offset] = Offset + Size;
+            Live.push_back({Block, Offset, Size});
+            Requested += Size;
+        }
+        else
+        {
+            uint32_t Idx = (uint32_t)(Next(State) % Live.size());
+
+            Heap.Free(Live[Idx].Block);
+
+            Ranges.erase(Live[Idx].Offset);
+            Requested -= Live[Idx].Size;
+
+            Live[Idx] = Live.back();
+            Live.pop_back();
+        }
+
+        // blocks keep tails too small to split off, so each allocation may account for a few bytes more than it asked for.
+        CHECK(Heap.GetAllocationCount() == Live.size());
+        CHECK(Heap.GetUsed() >= Requested);
+        CHECK(Heap.GetUsed() < Requested + Live.size() * 16 + 1);
+    }
+
+    for(LiveBlock& Blk : Live)
+    {
+        Heap.Free(Blk.Block);
+    }
+
+    // with everything freed, every range must have merged back into one block spanning the heap.
+    CHECK(Heap.GetUsed() == 0);
+    CHECK(Heap.GetAllocationCount() == 0);
+    CHECK(Heap.GetLargestFreeBlock() == HeapSize);
+    CHECK(Heap.GetFragmentation() == 0.f);
+}
+
+/* Freeing neighbours in any order leaves a single free range. */
+static void TestMerge()
+{
+    HeapAllocator Heap(300);
+
+    uint64_t A, B, C;
+    uint32_t BlkA = Heap.Allocate(100, 1, A);
+    uint32_t BlkB = Heap.Allocate(100, 1, B);
+    uint32_t BlkC = Heap.Allocate(100, 1, C);
+
+    CHECK(A == 0 && B == 100 && C == 200);
+    CHECK(Heap.GetFree() == 0);
+
+    Heap.Free(BlkA);
+    Heap.Free(BlkC);
+
+    CHECK(Heap.GetLargestFreeBlock() == 100);
+    CHECK(Heap.GetFragmentation() > 0.f);
+
+    // B's free neighbours on both sides are merged into it.
+    Heap.Free(BlkB);
+
+    CHECK(Heap.GetLargestFreeBlock() == 300);
+    CHECK(Heap.GetFragmentation() == 0.f);
+}
+
+/* Freeing a block twice throws, including when the first free merged it into its predecessor. */
+static void TestDoubleFree()
+{
+    HeapAllocator Heap(256);
+
+    uint64_t Offset;
+    uint32_t BlkA = Heap.Allocate(64, 1, Offset);
+    uint32_t BlkB = Heap.Allocate(64, 1, Offset);
+
+    Heap.Free(BlkA);
+    Heap.Free(BlkB); // merged into A's free block, B's node is released.
+
+    CHECK_THROWS(Heap.Free(BlkA));
+    CHECK_THROWS(Heap.Free(BlkB));
+    CHECK_THROWS(Heap.Free(12345));
+
+    CHECK(Heap.GetUsed() == 0);
+    CHECK(Heap.GetAllocationCount() == 0);
+    CHECK(Heap.GetLargestFreeBlock() == 256);
+}
+
+/* An already aligned free block that fits exactly is found, even though the request padded for alignment would not fit it. */
+static void TestAlignedExactFit()
+{
+    HeapAllocator Heap(256);
+
+    uint64_t A, B, C;
+    uint32_t BlkA = Heap.Allocate(64, 1, A);
+    uint32_t BlkB = Heap.Allocate(64, 1, B);
+    uint32_t BlkC = Heap.Allocate(128, 1, C);
+
+    Heap.Free(BlkB);
+
+    uint64_t Offset;
+    uint32_t Blk = Heap.Allocate(64, 64, Offset);
+
+    CHECK(Blk != HeapAllocator::InvalidBlock);
+    CHECK(Offset == 64);
+    CHECK(Heap.GetFree() == 0);
+
+    // a free block that starts misaligned has to leave room for the gap in front of the aligned offset.
+    Heap.Free(BlkA);
+    Heap.Free(Blk);
+
+    uint32_t Front = Heap.Allocate(32, 1, Offset);
+
+    CHECK(Heap.Allocate(96, 64, Offset) == HeapAllocator::InvalidBlock);
+    CHECK(Heap.Allocate(64, 64, Offset) != HeapAllocator::InvalidBlock);
+    CHECK(Offset == 64);
+
+    (void)Front;
+    (void)BlkC;
+}
+
+int main()
+{
+    TestTraceReplay();
+    TestMerge();
+    TestDoubleFree();
+    TestAlignedExactFit();
+
+    return TestResult("HeapAllocator");
+}
@@ -0,0 +1,100 @@
+#include "JobSystem.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+/* Job system micro-benchmark. Reports task throughput and how many tasks were stolen for a few workload shapes.
+   usage : JobSystemBench [ThreadCount] (defaults to one thread per hardware thread) */
+
+static volatile uint32_t gSink;
+
+/* Spin for roughly (Iterations) steps, standing in for a task's work. */
+static void Work(uint32_t Iterations)
+{
+    uint32_t Value = Iterations;
+
+    for(uint32_t i = 0; i < Iterations; i++)
+    {
+        Value = Value * 1664525u + 1013904223u;
+    }
+
+    gSink = Value;
+}
+
+template<typename Func>
+static void Measure(JobSystem& Jobs, const char* Name, Func&& Body)
+{
+    Jobs.ResetStats();
+
+    auto Start = std::chrono::steady_clock::now();
+    Body();
+    auto End = std::chrono::steady_clock::now();
+
+    double Seconds = std::chrono::duration<double>(End - Start).count();
+    JobStats Stats = Jobs.GetStats();
+
+    std::printf("%-24s %10.3f ms %12.0f tasks/s  executed %9llu  stolen %9llu (%5.1f%%)\n", Name, Seconds*1000.0, (double)Stats.Executed / Seconds,
+        (unsigned long long)Stats.Executed, (unsigned long long)Stats.Stolen, Stats.Executed != 0 ? 100.0 * (double)Stats.Stolen / (double)Stats.Executed : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t ThreadCount = (argc > 1) ? (uint32_t)std::atoi(argv[1]) : std::max(std::thread::hardware_concurrency(), 1u);
+    ThreadCount = std::max(ThreadCount, 1u);
+
+    JobSystem Jobs(ThreadCount);
+
+    std::printf("JobSystemBench : %u threads\n", ThreadCount);
+
+    // many tiny tasks, dominated by queueing overhead.
+    Measure(Jobs, "dispatch 100k empty", [&]()
+    {
+        Jobs.Dispatch(100000, [](uint32_t, uint32_t) {});
+    });
+
+    // evenly sized tasks, all queued by thread 0 so every other thread has to steal.
+    Measure(Jobs, "dispatch 10k uniform", [&]()
+    {
+        Jobs.Dispatch(10000, [](uint32_t, uint32_t) { Work(2000); });
+    });
+
+    // a few tasks are far bigger than the rest, idle threads steal the small ones around them.
+    Measure(Jobs, "dispatch 10k skewed", [&]()
+    {
+        Jobs.Dispatch(10000, [](uint32_t JobIdx, uint32_t) { Work((JobIdx % 100 == 0) ? 200000 : 500); });
+    });
+
+    // tasks spawning and waiting on their own tasks (recursive splitting).
+    Measure(Jobs, "nested 64x256", [&]()
+    {
+        Jobs.Dispatch(64, [&](uint32_t, uint32_t)
+        {
+            Jobs.Dispatch(256, [](uint32_t, uint32_t) { Work(1000); });
+        });
+    });
+
+    // chains of continuations, each link only becomes runnable once the one before it is done.
+    Measure(Jobs, "continuation chains", [&]()
+    {
+        constexpr uint32_t Chains = 256;
+        constexpr uint32_t Links = 64;
+
+        Jobs.Dispatch(Chains, [&](uint32_t, uint32_t)
+        {
+            JobCounter Counters[Links];
+
+            for(uint32_t i = 0; i < Links; i++)
+            {
+                Jobs.Run([](uint32_t) { Work(500); }, &Counters[i], (i != 0) ? &Counters[i-1] : nullptr);
+            }
+
+            Jobs.Wait(&Counters[Links-1]);
+        });
+    });
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "JobSystem.hpp"
+#include "Test.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/* Every job index runs exactly once, on a valid thread, and Dispatch() only returns once all of them have. */
+static void TestDispatch(JobSystem& Jobs)
+{
+    constexpr uint32_t JobCount = 10000;
+
+    std::vector<std::atomic<uint32_t>> Runs(JobCount);
+    std::atomic<bool> bBadThread{false};
+
+    for(std::atomic<uint32_t>& Run : Runs)
+    {
+        Run = 0;
+    }
+
+    Jobs.Dispatch(JobCount, [&](uint32_t JobIdx, uint32_t ThreadIdx)
+    {
+        if(ThreadIdx >= Jobs.GetThreadCount()) bBadThread = true;
+
+        Runs[JobIdx]++;
+    });
+
+    bool bAllOnce = true;
+
+    for(std::atomic<uint32_t>& Run : Runs)
+    {
+        bAllOnce &= (Run == 1);
+    }
+
+    CHECK(bAllOnce);
+    CHECK(!bBadThread);
+
+    // an empty dispatch returns right away.
+    Jobs.Dispatch(0, [&](uint32_t, uint32_t) { bBadThread = true; });
+    CHECK(!bBadThread);
+}
+
+/* Tasks queue and wait on tasks of their own, the waiting task runs (or steals) work instead of blocking its thread. */
+static void TestNested(JobSystem& Jobs)
+{
+    constexpr uint32_t Outer = 64;
+    constexpr uint32_t Inner = 64;
+
+    std::atomic<uint32_t> InnerRuns{0};
+    std::atomic<uint32_t> OuterDone{0};
+    std::atomic<bool> bEarly{false};
+
+    JobCounter Counter;
+
+    for(uint32_t i = 0; i < Outer; i++)
+    {
+        Jobs.Run([&](uint32_t)
+        {
+            JobCounter Children;
+            std::atomic<uint32_t> ChildRuns{0};
+
+            for(uint32_t j = 0; j < Inner; j++)
+            {
+                Jobs.Run([&](uint32_t) { ChildRuns++; InnerRuns++; }, &Children);
+            }
+
+            Jobs.Wait(&Children);
+
+            if(ChildRuns != Inner) bEarly = true;
+
+            OuterDone++;
+        }, &Counter);
+    }
+
+    Jobs.Wait(&Counter);
+
+    CHECK(Counter.GetPending() == 0);
+    CHECK(OuterDone == Outer);
+    CHECK(InnerRuns == Outer*Inner);
+    CHECK(!bEarly);
+}
+
+/* Continuations are held back until their counter reaches zero, and can themselves be waited on and chained. */
+static void TestContinuations(JobSystem& Jobs)
+{
+    constexpr uint32_t Producers = 256;
+
+    std::atomic<uint32_t> Produced{0};
+    std::atomic<uint32_t> SeenByFirst{0};
+    std::atomic<uint32_t> SeenBySecond{0};
+
+    JobCounter ProduceCounter;
+    JobCounter FirstCounter;
+    JobCounter SecondCounter;
+
+    for(uint32_t i = 0; i < Producers; i++)
+    {
+        Jobs.Run([&](uint32_t)
+        {
+            std::this_thread::yield();
+            Produced++;
+        }, &ProduceCounter);
+    }
+
+    // queued while the producers are (likely) still running, and after the first continuation.
+    Jobs.Run([&](uint32_t) { SeenByFirst = Produced.load(); }, &FirstCounter, &ProduceCounter);
+    Jobs.Run([&](uint32_t) { SeenBySecond = SeenByFirst.load() + 1; }, &SecondCounter, &FirstCounter);
+
+    Jobs.Wait(&SecondCounter);
+
+    CHECK(SeenByFirst == Producers);
+    CHECK(SeenBySecond == Producers + 1);
+
+    // a continuation of a counter that is already at zero is queued right away.
+    std::atomic<bool> bRan{false};
+    JobCounter Idle;
+    JobCounter Done;
+
+    Jobs.Run([&](uint32_t) { bRan = true; }, &Done, &Idle);
+    Jobs.Wait(&Done);
+
+    CHECK(bRan);
+}
+
+/* Tasks can be queued from any thread, but only known threads can wait (they run tasks as themselves). */
+static void TestForeignThread(JobSystem& Jobs)
+{
+    JobCounter Counter;
+    std::atomic<bool> bRan{false};
+    bool bWaitThrew = false;
+
+    std::thread Foreign([&]()
+    {
+        Jobs.Run([&](uint32_t) { bRan = true; }, &Counter);
+
+        try { Jobs.Wait(&Counter); } catch(...) { bWaitThrew = true; }
+    });
+
+    Foreign.join();
+
+    Jobs.Wait(&Counter);
+
+    CHECK(bRan);
+    CHECK(bWaitThrew);
+}
+
+int main()
+{
+    uint32_t HardwareThreads = std::max(std::thread::hardware_concurrency(), 2u);
+
+    // a single thread (no workers, everything runs inside Wait()) and a pool with more threads than cores.
+    for(uint32_t ThreadCount : { 1u, HardwareThreads*2 })
+    {
+        JobSystem Jobs(ThreadCount);
+
+        TestDispatch(Jobs);
+        TestNested(Jobs);
+        TestContinuations(Jobs);
+        TestForeignThread(Jobs);
+
+        CHECK(Jobs.GetStats().Executed != 0);
+
+        if(ThreadCount == 1)
+        {
+            CHECK(Jobs.GetStats().Stolen == 0);
+        }
+    }
+
+    return TestResult("JobSystem");
+}
@@ -0,0 +1,107 @@
+#include "MemoryType.hpp"
+#include "Test.hpp"
+
+#include <initializer_list>
+
+/* Build a fake memory properties table, one memory type per entry of (Types). */
+static VkPhysicalDeviceMemoryProperties MakeProps(std::initializer_list<VkMemoryPropertyFlags> Types)
+{
+    VkPhysicalDeviceMemoryProperties Props{};
+
+    for(VkMemoryPropertyFlags Flags : Types)
+    {
+        Props.memoryTypes[Props.memoryTypeCount].propertyFlags = Flags;
+        Props.memoryTypes[Props.memoryTypeCount].heapIndex = 0;
+        Props.memoryTypeCount++;
+    }
+
+    Props.memoryHeapCount = 1;
+
+    return Props;
+}
+
+static uint32_t FindForUsage(const VkPhysicalDeviceMemoryProperties& Props, uint32_t TypeBits, MemoryUsage Usage)
+{
+    VkMemoryPropertyFlags Required, Preferred, Avoided;
+    GetUsageFlags(Usage, Required, Preferred, Avoided);
+
+    return FindMemoryType(Props, TypeBits, Required, Preferred, Avoided);
+}
+
+static constexpr VkMemoryPropertyFlags DeviceLocal = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+static constexpr VkMemoryPropertyFlags HostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+static constexpr VkMemoryPropertyFlags HostCoherent = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+static constexpr VkMemoryPropertyFlags HostCached = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+static constexpr VkMemoryPropertyFlags Lazy = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+/* A discrete card with a ReBAR heap: device local types win where the usage prefers them, staging stays out of them. */
+static void TestDeviceLocalPreferred()
+{
+    VkPhysicalDeviceMemoryProperties Props = MakeProps({
+        HostVisible | HostCoherent,
+        DeviceLocal,
+        DeviceLocal | HostVisible | HostCoherent,
+        HostVisible | HostCoherent | HostCached
+    });
+
+    CHECK(FindForUsage(Props, ~0u, MemoryUsage::eGpuOnly) == 1);
+    CHECK(FindForUsage(Props, ~0u, MemoryUsage::eCpuToGpu) == 2);
+    CHECK(FindForUsage(Props, ~0u, MemoryUsage::eStaging) == 0);
+    CHECK(FindForUsage(Props, ~0u, MemoryUsage::eReadback) == 3);
+
+    // without ReBAR, per-frame uploads fall back to plain host memory.
+    CHECK(FindForUsage(Props, ~0u & ~(1u << 2), MemoryUsage::eCpuToGpu) == 0);
+
+    // memoryTypeBits always wins over preference.
+    CHECK(FindForUsage(Props, 1u << 2, MemoryUsage::eGpuOnly) == 2);
+    CHECK(FindForUsage(Props, 1u << 0, MemoryUsage::eGpuOnly) == UINT32_MAX);
+}
+
+/* Host visible types that aren't coherent are only picked by usages that don't require coherence. */
+static void TestCoherentMissing()
+{
+    VkPhysicalDeviceMemoryProperties Props = MakeProps({
+        DeviceLocal,
+        HostVisible | HostCached,
+        HostVisible | HostCoherent
+    });
+
+    // readback prefers cached and coherent, without a type that has both the lowest index of the best matches is used.
+    CHECK(FindForUsage(Props, ~0u, MemoryUsage::eReadback) == 1);
+    CHECK(FindForUsage(Props, (1u << 0) | (1u << 2), MemoryUsage::eReadback) == 2);
+
+    // cpu written memory requires coherence, it never lands in the non-coherent type.
+    CHECK(FindForUsage(Props, ~0u, MemoryUsage::eCpuToGpu) == 2);
+    CHECK(FindForUsage(Props, ~0u, MemoryUsage::eStaging) == 2);
+    CHECK(FindForUsage(Props, (1u << 0) | (1u << 1), MemoryUsage::eCpuToGpu) == UINT32_MAX);
+}
+
+/* Transient attachments take lazily allocated memory when the device has it, everything else stays out of it. */
+static void TestLazilyAllocated()
+{
+    VkPhysicalDeviceMemoryProperties Tiler = MakeProps({
+        DeviceLocal | Lazy,
+        DeviceLocal,
+        DeviceLocal | HostVisible | HostCoherent
+    });
+
+    CHECK(FindForUsage(Tiler, ~0u, MemoryUsage::eTransient) == 0);
+    CHECK(FindForUsage(Tiler, ~0u, MemoryUsage::eGpuOnly) == 1);
+    CHECK(FindForUsage(Tiler, ~0u, MemoryUsage::eCpuToGpu) == 2);
+
+    VkPhysicalDeviceMemoryProperties Desktop = MakeProps({
+        DeviceLocal,
+        HostVisible | HostCoherent
+    });
+
+    CHECK(FindForUsage(Desktop, ~0u, MemoryUsage::eTransient) == 0);
+}
+
+int main()
+{
+    TestDeviceLocalPreferred();
+    TestCoherentMissing();
+    TestLazilyAllocated();
+
+    return TestResult("MemoryType");
+}
@@ -0,0 +1,182 @@
+#include "MeshOptimizer.hpp"
+#include "Test.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+typedef std::array<uint32_t, 3> Triangle;
+
+/* Deterministic xorshift, so every run shuffles the same way. */
+static uint32_t Next(uint32_t& State)
+{
+    State ^= State << 13;
+    State ^= State >> 17;
+    State ^= State << 5;
+    return State;
+}
+
+/* A sphere built from a (Rings x Segments) grid, every quad split into two triangles. */
+static void BuildSphere(uint32_t Rings, uint32_t Segments, std::vector<glm::vec3>& Positions, std::vector<uint32_t>& Indices)
+{
+    for(uint32_t r = 0; r <= Rings; r++)
+    {
+        float Theta = 3.14159265f * (float)r / (float)Rings;
+
+        for(uint32_t s = 0; s <= Segments; s++)
+        {
+            float Phi = 6.28318531f * (float)s / (float)Segments;
+            Positions.push_back(glm::vec3(std::sin(Theta)*std::cos(Phi), std::cos(Theta), std::sin(Theta)*std::sin(Phi)));
+        }
+    }
+
+    for(uint32_t r = 0; r < Rings; r++)
+    {
+        for(uint32_t s = 0; s < Segments; s++)
+        {
+            uint32_t A = r*(Segments+1) + s;
+            uint32_t B = A + Segments + 1;
+
+            Indices.insert(Indices.end(), { A, B, A+1, A+1, B, B+1 });
+        }
+    }
+}
+
+/* Shuffle the triangles (keeping each triangle's winding), so the cache optimization has something to do. */
+static void ShuffleTriangles(std::vector<uint32_t>& Indices, uint32_t Seed)
+{
+    uint32_t TriCount = (uint32_t)Indices.size()/3;
+
+    for(uint32_t t = TriCount-1; t > 0; t--)
+    {
+        uint32_t Other = Next(Seed) % (t+1);
+
+        for(uint32_t k = 0; k < 3; k++)
+        {
+            std::swap(Indices[t*3+k], Indices[Other*3+k]);
+        }
+    }
+}
+
+/* The triangles of an index buffer as a sorted list, each rotated to start at its smallest index so the winding is compared as well. */
+static std::vector<Triangle> TriangleSet(const std::vector<uint32_t>& Indices, const std::vector<uint32_t>* pToOriginal = nullptr)
+{
+    std::vector<Triangle> Tris;
+
+    for(uint32_t t = 0; t < Indices.size()/3; t++)
+    {
+        Triangle Tri = { Indices[t*3], Indices[t*3+1], Indices[t*3+2] };
+
+        if(pToOriginal != nullptr)
+        {
+            for(uint32_t& Index : Tri) Index = (*pToOriginal)[Index];
+        }
+
+        std::rotate(Tri.begin(), std::min_element(Tri.begin(), Tri.end()), Tri.end());
+        Tris.push_back(Tri);
+    }
+
+    std::sort(Tris.begin(), Tris.end());
+
+    return Tris;
+}
+
+/* Each pass only permutes the triangles (and renumbers the vertices), and never makes the cache efficiency worse than its input. */
+static void TestPasses(uint32_t Rings, uint32_t Segments, uint32_t Seed)
+{
+    std::vector<glm::vec3> Positions;
+    std::vector<uint32_t> Indices;
+
+    BuildSphere(Rings, Segments, Positions, Indices);
+    ShuffleTriangles(Indices, Seed);
+
+    uint32_t IndexCount = (uint32_t)Indices.size();
+    uint32_t VertexCount = (uint32_t)Positions.size();
+
+    std::vector<Triangle> Original = TriangleSet(Indices);
+    MeshOptimizer::CacheStats Shuffled = MeshOptimizer::AnalyzeVertexCache(Indices.data(), IndexCount, VertexCount);
+
+    // vertex cache
+    MeshOptimizer::OptimizeVertexCache(Indices.data(), IndexCount, VertexCount);
+
+    MeshOptimizer::CacheStats Cached = MeshOptimizer::AnalyzeVertexCache(Indices.data(), IndexCount, VertexCount);
+
+    CHECK(TriangleSet(Indices) == Original);
+    CHECK(Cached.Acmr <= Shuffled.Acmr);
+    CHECK(Cached.Atvr <= Shuffled.Atvr);
+    CHECK(Cached.Acmr < 1.f); // a shuffled grid is near 3, a cache ordered one well below 1
+
+    // overdraw gives back some of the cache efficiency, about its threshold on large meshes, a little more on small ones where each cache restart weighs more.
+    MeshOptimizer::OptimizeOverdraw(Indices.data(), IndexCount, Positions.data(), VertexCount);
+
+    MeshOptimizer::CacheStats Overdraw = MeshOptimizer::AnalyzeVertexCache(Indices.data(), IndexCount, VertexCount);
+
+    CHECK(TriangleSet(Indices) == Original);
+    CHECK(Overdraw.Acmr <= Shuffled.Acmr);
+    CHECK(Overdraw.Acmr <= Cached.Acmr * (IndexCount < 3000 ? 1.15f : 1.06f));
+
+    // vertex fetch, the renumbered buffer maps back onto the same triangles.
+    std::vector<uint32_t> Remap;
+    uint32_t UsedCount = MeshOptimizer::OptimizeVertexFetch(Indices.data(), IndexCount, VertexCount, Remap);
+
+    CHECK(UsedCount == VertexCount); // every vertex of the sphere is used
+    CHECK(Remap.size() == VertexCount);
+
+    std::vector<uint32_t> ToOriginal(UsedCount, MeshOptimizer::InvalidIndex);
+
+    for(uint32_t i = 0; i < VertexCount; i++)
+    {
+        if(Remap[i] != MeshOptimizer::InvalidIndex && Remap[i] < UsedCount)
+        {
+            CHECK(ToOriginal[Remap[i]] == MeshOptimizer::InvalidIndex); // no two vertices share a new index
+            ToOriginal[Remap[i]] = i;
+        }
+    }
+
+    CHECK(std::find(ToOriginal.begin(), ToOriginal.end(), MeshOptimizer::InvalidIndex) == ToOriginal.end());
+    CHECK(TriangleSet(Indices, &ToOriginal) == Original);
+
+    // vertices are numbered in the order they're first used.
+    uint32_t NextNew = 0;
+    bool bFirstUseOrder = true;
+
+    for(uint32_t Index : Indices)
+    {
+        if(Index > NextNew) bFirstUseOrder = false;
+        if(Index == NextNew) NextNew++;
+    }
+
+    CHECK(bFirstUseOrder);
+    CHECK(NextNew == UsedCount);
+
+    // the renumbering doesn't change which vertices are cached.
+    MeshOptimizer::CacheStats Fetch = MeshOptimizer::AnalyzeVertexCache(Indices.data(), IndexCount, UsedCount);
+
+    CHECK(std::fabs(Fetch.Acmr - Overdraw.Acmr) < 1e-5f);
+}
+
+/* Vertices no triangle uses are dropped by the fetch pass. */
+static void TestUnusedVertices()
+{
+    std::vector<uint32_t> Indices = { 4, 2, 5, 5, 2, 7 };
+    std::vector<uint32_t> Remap;
+
+    uint32_t UsedCount = MeshOptimizer::OptimizeVertexFetch(Indices.data(), (uint32_t)Indices.size(), 8, Remap);
+
+    CHECK(UsedCount == 4);
+    CHECK((Indices == std::vector<uint32_t>{ 0, 1, 2, 2, 1, 3 }));
+    CHECK(Remap[0] == MeshOptimizer::InvalidIndex);
+    CHECK(Remap[4] == 0 && Remap[2] == 1 && Remap[5] == 2 && Remap[7] == 3);
+}
+
+int main()
+{
+    TestPasses(8, 8, 0x1234567u);
+    TestPasses(40, 60, 0xBADC0DEu);
+    TestPasses(100, 100, 0x5EED5EEDu);
+    TestUnusedVertices();
+
+    return TestResult("MeshOptimizer");
+}
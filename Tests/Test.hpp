@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdio>
+
+/* Minimal assertion helpers shared by the test executables. A failed CHECK is reported and counted, main() returns TestResult() so ctest sees the failure. */
+
+inline int& TestFailures()
+{
+    static int Failures = 0;
+    return Failures;
+}
+
+#define CHECK(Cond) \
+    do \
+    { \
+        if(!(Cond)) \
+        { \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #Cond); \
+            TestFailures()++; \
+        } \
+    } while(0)
+
+#define CHECK_THROWS(Expr) \
+    do \
+    { \
+        bool bThrew = false; \
+        try { Expr; } catch(...) { bThrew = true; } \
+        if(!bThrew) \
+        { \
+            std::printf("%s:%d: CHECK_THROWS(%s) did not throw\n", __FILE__, __LINE__, #Expr); \
+            TestFailures()++; \
+        } \
+    } while(0)
+
+inline int TestResult(const char* Name)
+{
+    if(TestFailures() == 0)
+    {
+        std::printf("%s : all checks passed\n", Name);
+        return 0;
+    }
+
+    std::printf("%s : %d check(s) failed\n", Name, TestFailures());
+    return 1;
+}
@@ -0,0 +1,284 @@
+#include "VertexPacking.hpp"
+#include "Test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define SNORM16_STEP (1.f / 32767.f) // distance between two snorm16 values
+#define HALF_EPSILON (1.f / 2048.f) // relative rounding error of a half float (11 bit significand), below half of the distance to the next value
+#define HALF_DENORM (1.f / 16777216.f) // distance between two subnormal half floats
+#define OCT_MAX_ANGLE 1e-4f // radians, the measured worst case over the random normals below is about 6.4e-5
+
+/* Deterministic xorshift, so every run packs the same vertices. */
+static uint32_t Next(uint32_t& State)
+{
+    State ^= State << 13;
+    State ^= State >> 17;
+    State ^= State << 5;
+    return State;
+}
+
+static float Range(uint32_t& State, float Min, float Max)
+{
+    return Min + (Max - Min) * (float)(Next(State) % 1000000) / 999999.f;
+}
+
+static float Angle(glm::vec3 A, glm::vec3 B)
+{
+    // atan2 of the cross and dot products stays accurate for tiny angles, unlike acos.
+    return std::atan2(glm::length(glm::cross(A, B)), glm::dot(A, B));
+}
+
+static glm::vec3 RandomNormal(uint32_t& State)
+{
+    glm::vec3 N;
+
+    do
+    {
+        N = glm::vec3(Range(State, -1.f, 1.f), Range(State, -1.f, 1.f), Range(State, -1.f, 1.f));
+    } while(glm::length(N) < 0.1f);
+
+    return glm::normalize(N);
+}
+
+/* Every decoded position is within half a snorm16 step of the box's half size of the original, per axis. */
+static void TestPositions()
+{
+    uint32_t Seed = 0x2545F491u;
+
+    std::vector<Vertex> Vertices(5000);
+
+    for(Vertex& V : Vertices)
+    {
+        V.Position = glm::vec3(Range(Seed, -300.f, 20.f), Range(Seed, 4.f, 5.f), Range(Seed, -0.01f, 0.01f));
+        V.Normal = glm::vec3(0.f, 1.f, 0.f);
+        V.UV = glm::vec2(0.f);
+    }
+
+    glm::vec4 Sphere, Extent;
+    VertexPacking::FitBounds(Vertices.data(), (uint32_t)Vertices.size(), Sphere, Extent);
+
+    glm::vec3 Center(Sphere), HalfSize(Extent);
+
+    // the box contains every vertex, up to the float rounding of its center and half size.
+    for(const Vertex& V : Vertices)
+    {
+        CHECK(glm::length(V.Position - Center) <= Sphere.w);
+
+        for(uint32_t Axis = 0; Axis < 3; Axis++)
+        {
+            CHECK(std::abs(V.Position[Axis] - Center[Axis]) <= HalfSize[Axis] + (std::abs(Center[Axis]) + HalfSize[Axis]) * 4e-7f);
+        }
+    }
+
+    std::vector<PackedVertex> Packed(Vertices.size());
+    VertexPacking::Pack(Vertices.data(), (uint32_t)Vertices.size(), Center, HalfSize, Packed.data());
+
+    float MaxError[3] = {};
+
+    for(size_t i = 0; i < Vertices.size(); i++)
+    {
+        Vertex Decoded = VertexPacking::Unpack(Packed[i], Center, HalfSize);
+
+        for(uint32_t Axis = 0; Axis < 3; Axis++)
+        {
+            MaxError[Axis] = std::max(MaxError[Axis], std::abs(Decoded.Position[Axis] - Vertices[i].Position[Axis]));
+        }
+
+        // w is padding and reads as 0.
+        CHECK((Packed[i].PositionZ >> 16) == 0);
+    }
+
+    for(uint32_t Axis = 0; Axis < 3; Axis++)
+    {
+        // float rounding of the normalization and decode adds a few ulps of the coordinates on top of the quantization.
+        float Bound = HalfSize[Axis] * SNORM16_STEP * 0.5f + (std::abs(Center[Axis]) + HalfSize[Axis]) * 4e-7f;
+
+        CHECK(MaxError[Axis] <= Bound);
+    }
+}
+
+/* Flat meshes have no extent along an axis, positions there decode exactly to the center. */
+static void TestFlatMesh()
+{
+    std::vector<Vertex> Vertices(4);
+
+    Vertices[0].Position = glm::vec3(-1.f, 2.f, 3.f);
+    Vertices[1].Position = glm::vec3(1.f, 2.f, 3.f);
+    Vertices[2].Position = glm::vec3(1.f, 2.f, 5.f);
+    Vertices[3].Position = glm::vec3(-1.f, 2.f, 5.f);
+
+    for(Vertex& V : Vertices)
+    {
+        V.Normal = glm::vec3(0.f, 1.f, 0.f);
+        V.UV = glm::vec2(0.f);
+    }
+
+    glm::vec4 Sphere, Extent;
+    VertexPacking::FitBounds(Vertices.data(), 4, Sphere, Extent);
+
+    CHECK(Extent.y == 0.f);
+
+    std::vector<PackedVertex> Packed(4);
+    VertexPacking::Pack(Vertices.data(), 4, glm::vec3(Sphere), glm::vec3(Extent), Packed.data());
+
+    for(uint32_t i = 0; i < 4; i++)
+    {
+        Vertex Decoded = VertexPacking::Unpack(Packed[i], glm::vec3(Sphere), glm::vec3(Extent));
+
+        // the corners of the box are exactly -1 and 1.
+        CHECK(Decoded.Position.x == Vertices[i].Position.x);
+        CHECK(Decoded.Position.y == 2.f);
+        CHECK(Decoded.Position.z == Vertices[i].Position.z);
+    }
+
+    // no vertices, no bounds.
+    VertexPacking::FitBounds(nullptr, 0, Sphere, Extent);
+
+    CHECK(Sphere == glm::vec4(0.f) && Extent == glm::vec4(0.f));
+}
+
+/* Octahedral normals decode within OCT_MAX_ANGLE of the original, including the axes and the folded lower half. */
+static void TestNormals()
+{
+    uint32_t Seed = 0x9E3779B9u;
+
+    std::vector<glm::vec3> Normals = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+
+    // the edges of the unfolded octahedron, where the lower half meets the upper one.
+    for(float x : { -1.f, 1.f })
+    {
+        for(float y : { -1.f, 1.f })
+        {
+            Normals.push_back(glm::normalize(glm::vec3(x, y, 0.f)));
+            Normals.push_back(glm::normalize(glm::vec3(x, y, -1.f)));
+            Normals.push_back(glm::normalize(glm::vec3(x, y, 1.f)));
+            Normals.push_back(glm::normalize(glm::vec3(x*1e-4f, y, -1.f)));
+        }
+    }
+
+    for(uint32_t i = 0; i < 100000; i++)
+    {
+        Normals.push_back(RandomNormal(Seed));
+    }
+
+    float MaxAngle = 0.f;
+
+    for(glm::vec3 N : Normals)
+    {
+        glm::vec2 Oct = VertexPacking::OctEncode(N);
+
+        CHECK(std::abs(Oct.x) <= 1.f && std::abs(Oct.y) <= 1.f);
+
+        // without quantization the encoding is exact up to float rounding.
+        CHECK(Angle(VertexPacking::OctDecode(Oct), N) <= 1e-5f);
+
+        Vertex V;
+        V.Position = glm::vec3(0.f);
+        V.Normal = N;
+        V.UV = glm::vec2(0.f);
+
+        PackedVertex Packed;
+        VertexPacking::Pack(&V, 1, glm::vec3(0.f), glm::vec3(1.f), &Packed);
+
+        glm::vec3 Decoded = VertexPacking::Unpack(Packed, glm::vec3(0.f), glm::vec3(1.f)).Normal;
+
+        CHECK(std::abs(glm::length(Decoded) - 1.f) <= 1e-5f);
+
+        MaxAngle = std::max(MaxAngle, Angle(Decoded, N));
+    }
+
+    CHECK(MaxAngle <= OCT_MAX_ANGLE);
+
+    // a zero normal (i.e. from a file without normals) decodes to +z instead of NaN.
+    glm::vec3 Zero = VertexPacking::OctDecode(VertexPacking::OctEncode(glm::vec3(0.f)));
+
+    CHECK(Zero == glm::vec3(0.f, 0.f, 1.f));
+}
+
+/* Half float UVs round to the nearest half, exactly representable ones come back unchanged. */
+static void TestUVs()
+{
+    uint32_t Seed = 0xC0FFEEu;
+
+    const float Exact[] = { 0.f, 1.f, -1.f, 0.5f, 0.25f, 2.f, 0.75f, 1024.f, 1.f/1024.f };
+
+    for(float U : Exact)
+    {
+        Vertex V;
+        V.Position = glm::vec3(0.f);
+        V.Normal = glm::vec3(0.f, 0.f, 1.f);
+        V.UV = glm::vec2(U, -U);
+
+        PackedVertex Packed;
+        VertexPacking::Pack(&V, 1, glm::vec3(0.f), glm::vec3(1.f), &Packed);
+
+        CHECK(VertexPacking::Unpack(Packed, glm::vec3(0.f), glm::vec3(1.f)).UV == V.UV);
+    }
+
+    for(uint32_t i = 0; i < 100000; i++)
+    {
+        Vertex V;
+        V.Position = glm::vec3(0.f);
+        V.Normal = glm::vec3(0.f, 0.f, 1.f);
+
+        // tiling UVs go past [0, 1], and tiny ones hit the subnormal halves.
+        V.UV = (i % 10 == 0) ? glm::vec2(Range(Seed, -1e-5f, 1e-5f), Range(Seed, -1e-5f, 1e-5f)) : glm::vec2(Range(Seed, -8.f, 8.f), Range(Seed, 0.f, 1.f));
+
+        PackedVertex Packed;
+        VertexPacking::Pack(&V, 1, glm::vec3(0.f), glm::vec3(1.f), &Packed);
+
+        glm::vec2 Decoded = VertexPacking::Unpack(Packed, glm::vec3(0.f), glm::vec3(1.f)).UV;
+
+        for(uint32_t c = 0; c < 2; c++)
+        {
+            CHECK(std::abs(Decoded[c] - V.UV[c]) <= std::abs(V.UV[c]) * HALF_EPSILON + HALF_DENORM);
+        }
+    }
+}
+
+/* The position-only stream holds the same bytes as the first half of every packed vertex, so both streams rasterize identical positions. */
+static void TestPositionStream()
+{
+    uint32_t Seed = 0x1234u;
+
+    CHECK(sizeof(PackedVertex) == 16 && sizeof(PackedPosition) == 8);
+    CHECK(offsetof(PackedVertex, PositionXY) == 0 && offsetof(PackedVertex, PositionZ) == 4);
+
+    std::vector<Vertex> Vertices(100);
+
+    for(Vertex& V : Vertices)
+    {
+        V.Position = glm::vec3(Range(Seed, -1.f, 1.f), Range(Seed, -1.f, 1.f), Range(Seed, -1.f, 1.f));
+        V.Normal = RandomNormal(Seed);
+        V.UV = glm::vec2(Range(Seed, 0.f, 1.f), Range(Seed, 0.f, 1.f));
+    }
+
+    glm::vec4 Sphere, Extent;
+    VertexPacking::FitBounds(Vertices.data(), (uint32_t)Vertices.size(), Sphere, Extent);
+
+    std::vector<PackedVertex> Packed(Vertices.size());
+    VertexPacking::Pack(Vertices.data(), (uint32_t)Vertices.size(), glm::vec3(Sphere), glm::vec3(Extent), Packed.data());
+
+    for(const PackedVertex& P : Packed)
+    {
+        PackedPosition Position = VertexPacking::GetPosition(P);
+
+        CHECK(std::memcmp(&Position, &P, sizeof(PackedPosition)) == 0);
+    }
+}
+
+int main()
+{
+    TestPositions();
+    TestFlatMesh();
+    TestNormals();
+    TestUVs();
+    TestPositionStream();
+
+    return TestResult("VertexPacking");
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+/* Bookkeeping for the transfer agent's staged uploads. Nothing here records commands or touches memory, so the copy resolution and chunking can be tested without a device. */
+
+namespace Resources
+{
+    struct Buffer;
+}
+
+/*! \brief The buffer copies queued for a flush, all reading from the transit buffer.
+*   Copies may overlap, the copy queued last wins. Resolve() turns the queue into the regions of one vkCmdCopyBuffer per destination.
+*/
+class BufferCopyList
+{
+    public:
+        /*! \brief The resolved regions of one destination, see Resolve(). */
+        struct Group
+        {
+            Resources::Buffer* pDst;
+            uint32_t FirstRegion; //! > Index of the group's first region in GetRegions().
+            uint32_t RegionCount;
+        };
+
+        /*! \brief Queue a copy of (Size) bytes staged at (SrcOffset) in the transit buffer to (DstOffset) in (pDst). */
+        void Add(Resources::Buffer* pDst, VkDeviceSize SrcOffset, VkDeviceSize DstOffset, VkDeviceSize Size);
+
+        /*! \brief Find where a write to [DstOffset, DstOffset+Size) of (pDst) can be staged in place, when it lands inside the last copy queued to (pDst).
+            The last copy is the newest write to those bytes, so overwriting its staged bytes keeps the last write winning.
+            @param SrcOffset Receives the offset in the transit buffer to write the bytes to.
+            @return false if the write isn't inside the last copy to (pDst) (or nothing was queued to it).
+        */
+        bool FindInLast(Resources::Buffer* pDst, VkDeviceSize DstOffset, VkDeviceSize Size, VkDeviceSize& SrcOffset) const;
+
+        /*! \brief Resolve the queued copies into one group of regions per destination.
+            A group's regions are sorted by offset and never overlap, every byte is copied from the newest copy covering it, and regions contiguous in both the transit buffer and the destination are merged.
+        */
+        void Resolve();
+
+        const std::vector<Group>& GetGroups() const { return Groups; }
+        const std::vector<VkBufferCopy>& GetRegions() const { return Regions; }
+
+        /*! \brief The destination of every queued copy, in the order they were queued (a buffer appears once per copy to it). */
+        const std::vector<Resources::Buffer*>& GetDestinations() const { return Destinations; }
+
+        size_t GetCopyCount() const { return Copies.size(); }
+
+        void Clear();
+
+    private:
+        std::vector<VkBufferCopy> Copies;
+        std::vector<Resources::Buffer*> Destinations;
+        std::unordered_map<Resources::Buffer*, uint32_t> LastCopy; // index of the most recent copy to each buffer
+
+        // results of Resolve(), and its scratch. Kept between flushes so resolving doesn't allocate.
+        std::vector<Group> Groups;
+        std::vector<VkBufferCopy> Regions;
+        std::vector<uint32_t> CopyOrder; // indices into Copies, by destination then offset
+        std::vector<uint32_t> CopyHeap; // copies covering the sweep position, newest on top
+};
+
+/*! \brief A piece of an image upload, a box of whole rows (or whole slices for 3d images). */
+struct ImageChunk
+{
+    VkDeviceSize SrcOffset; //! > Offset of the chunk's texels in the uploaded data.
+    VkDeviceSize Size;
+    VkOffset3D Offset; //! > The chunk's box in the image.
+    VkExtent3D Extent;
+};
+
+/*! \brief Split an upload of (Extent) texels at (Offset) into chunks of at most (MaxChunkSize) bytes. The uploaded data is tightly packed.
+    @param TexelSize The size of a texel in bytes.
+    @param Chunks Receives the chunks, in the order of the uploaded data.
+    @return false if a single row (or slice) is bigger than (MaxChunkSize).
+*/
+bool SplitImageUpload(VkDeviceSize TexelSize, VkExtent3D Extent, VkOffset3D Offset, VkDeviceSize MaxChunkSize, std::vector<ImageChunk>& Chunks);
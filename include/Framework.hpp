@@ -1,12 +1,26 @@
+#pragma once
+
 #include <stdexcept>
-#pragma onc/e
 
 #include "Wrappers.hpp"
+#include "JobSystem.hpp"
+#include "MemoryType.hpp"
+#include "CopyList.hpp"
 
 #include <atomic>
+#include <deque>
 #include <thread>
+#include <unordered_map>
 
 #define PAGE_SIZE 16777216
+#define DEDICATED_ALLOC_SIZE (PAGE_SIZE/2) // allocations at least this big get a VkDeviceMemory of their own
+#define DEFRAG_BYTES_PER_FRAME 4194304 // how many bytes Defragment() moves per call by default
+#define DEFRAG_MAX_USAGE 0.5f // heaps more full than this are left alone by Defragment()
+#define TRANSIT_FRAME_SIZE 16000000 // staging bytes a frame is expected to upload, also the largest single staging copy (bigger uploads are split)
+#define TRANSIT_FRAME_SLACK 3 // frames worth of uploads the staging ring holds before Transfer() has to wait for the gpu
+#define TRANSFER_CMD_BUFFER_COUNT 3 // command buffers the transfer agent cycles through, so a flush never waits for the one before it
+#define FRAMES_IN_FLIGHT 2 // frames the cpu can record ahead of the gpu (2 or 3)
+#define JOB_THREAD_COUNT 0 // threads the job system runs on (including the thread dispatching jobs), 0 uses one per hardware thread
 
 bool InitWrapperFW(uint32_t Width = 1280, uint32_t Height = 720);
 void CloseWrapperFW();
@@ -19,9 +33,18 @@ Window* GetWindow();
     /*! \brief Create a semaphore */
     VkSemaphore CreateVulkanSemaphore();
 
+    /*! \brief Create a timeline semaphore starting at (InitialValue) */
+    VkSemaphore CreateTimelineSemaphore(uint64_t InitialValue = 0);
+
     /*! \brief Create a Fence */
     Resources::Fence* CreateFence(std::string Name = "Fence");
 
+    /*! \brief Allocate a Buffer
+        @param Buffer The addres of the buffer to allocate
+        @param Usage How the buffer's memory is accessed.
+    */
+    void Allocate(Resources::Buffer& Buffer, MemoryUsage Usage);
+
     /*! \brief Allocate a Buffer
         @param Buffer The addres of the buffer to allocate
         @param bVisible Determines whether the buffer should be allocated on host visible memory
@@ -29,16 +52,33 @@ Window* GetWindow();
     void Allocate(Resources::Buffer& Buffer, bool bVisible = true);
     
     /*! \brief Allocate Image
-        @param Buffer The addres of the buffer to allocate
-        @param bVisible Determines whether the buffer should be allocated on host visible memory
+        @param Image The image to allocate
+        @param Usage How the image's memory is accessed.
+    */
+    void Allocate(Resources::Image& Image, MemoryUsage Usage);
+
+    /*! \brief Allocate Image
+        @param Image The image to allocate
+        @param bVisible Determines whether the image should be allocated on host visible memory
     */
     void Allocate(Resources::Image& Image, bool bVisible = true);
 
-    /*! \brief Free an allocation
+    /*! \brief Allocate and bind memory for a raw image handle (i.e. framebuffer attachments)
+        @param Image The image to allocate
+        @param Alloc The allocation to fill out, free it with Free() once the image is destroyed.
+        @param Usage How the image's memory is accessed.
+        @param Tiling The tiling the image was created with.
+    */
+    void Allocate(VkImage Image, Resources::Allocation& Alloc, MemoryUsage Usage, VkImageTiling Tiling = VK_IMAGE_TILING_OPTIMAL);
+
+    /*! \brief Free an allocation, returning its range to the heap it was allocated from.
         @param Alloc The allocation to free.
      */
     void Free(Resources::Allocation& Alloc);
 
+    /*! \brief Fill in a buffer's sharing mode. Buffers are shared concurrently between the graphics, compute and transfer families, so they never need queue family ownership transfers. */
+    void SetBufferSharing(VkBufferCreateInfo& BuffCI);
+
     /*! \brief Create buffer
         @param Buffer The buffer object to output to.
         @param Size The size of the buffer object to create.
@@ -57,19 +97,133 @@ Window* GetWindow();
 
     VkResult CreateView(VkImageView& View, VkImage& Image, VkFormat Format, VkImageAspectFlagBits Aspect = VK_IMAGE_ASPECT_COLOR_BIT);
 
+    /*! \brief The size of one texel of an uncompressed format in bytes, as laid out in buffer to image copies.
+        @return 0 for formats a texel size doesn't describe (block-compressed, multi-planar and combined depth/stencil formats).
+    */
+    VkDeviceSize GetTexelSize(VkFormat Format);
+
     // virtual void CreateTexture(Resources::Image& Texture, VkFormat Format, VkExtent2D Size) = 0;
 
+    /*! \brief Point (pBuffer->pData) at the buffer's memory. Host visible heaps are mapped for their whole lifetime, so this never calls into the driver. */
     void Map(Resources::Buffer* pBuffer);
+
+    /*! \brief Drop the buffer's pointer to its memory (the heap itself stays mapped). */
     void Unmap(Resources::Buffer* pBuffer);
 
+    /*! \brief Make cpu writes to a mapped buffer visible to the gpu. Only does work for non-coherent memory.
+        @param pBuffer The mapped buffer.
+        @param Offset The offset of the written range, relative to the buffer.
+        @param Size The size of the written range.
+    */
+    void FlushMapped(Resources::Buffer* pBuffer, VkDeviceSize Offset = 0, VkDeviceSize Size = VK_WHOLE_SIZE);
+
+    /*! \brief Make gpu writes to a mapped buffer visible to the cpu (call after the gpu work has completed). Only does work for non-coherent memory.
+        @param pBuffer The mapped buffer.
+        @param Offset The offset of the range to read, relative to the buffer.
+        @param Size The size of the range to read.
+    */
+    void InvalidateMapped(Resources::Buffer* pBuffer, VkDeviceSize Offset = 0, VkDeviceSize Size = VK_WHOLE_SIZE);
+
+    /*! \brief Incrementally compact device local memory.
+     *
+     *  Picks the least used heap (below DEFRAG_MAX_USAGE) and moves up to (ByteBudget) bytes of buffers out of it into the other heaps of its memory type, copying the contents through the transfer agent and re-writing every descriptor set that references a moved buffer.
+     *  A heap is released once its last buffer has moved out. The moves are flushed before returning, moved-from buffers are destroyed by a later call once every queue is done with them (see MarkUsed()).
+     *  Descriptor sets can't be re-written while a submission that uses them is pending, so this must only be called once the gpu has finished every frame in flight (i.e. after waiting for the last render submission).
+     *  Images are never moved.
+     *
+     *  @param ByteBudget The number of bytes to move this call.
+     *  @return The number of bytes moved.
+     */
+    VkDeviceSize Defragment(VkDeviceSize ByteBudget = DEFRAG_BYTES_PER_FRAME);
+
+    /*! \brief Whether Defragment() has anything to do (a heap worth emptying, or moved-from buffers to release). Cheap enough to check every frame, so callers only wait for the gpu when a call would do something. */
+    bool NeedsDefragment();
+
+/* synchronization */
+    /*! \brief The timeline semaphore of (Queue), every submission to the queue signals it with the next value. */
+    VkSemaphore GetQueueTimeline(CommandType Queue);
+
+    /*! \brief The value the most recent submission to (Queue) signals (0 before the first submission). */
+    uint64_t GetQueueSubmitValue(CommandType Queue);
+
+    /*! \brief The highest value (Queue)'s timeline has reached on the gpu. */
+    uint64_t GetQueueCompletedValue(CommandType Queue);
+
+    /*! \brief Check whether the gpu has reached (Point), only asks the driver when the cached completed value is behind. */
+    bool IsReached(SyncPoint Point);
+
+    /*! \brief Block until the gpu has reached (Point), flushing the pending submissions first if (Point) is among them. */
+    void WaitSync(SyncPoint Point);
+
+    /*! \brief Hand every pending submission to the driver, with one vkQueueSubmit per queue.
+    *   Queues are flushed in the order they were first submitted to. Waits across queues should use the queue timelines, a binary semaphore is only safe to wait on if it was signaled by an earlier flush or a queue flushed before the waiting one.
+    */
+    void FlushSubmits();
+
+    /*! \brief Record that the submission at (Point) uses (Alloc), so the memory isn't released or reused before it completes. */
+    void MarkUsed(Resources::Allocation& Alloc, SyncPoint Point);
+
+    /*! \brief Check whether every queue is done with (Alloc). */
+    bool IsIdle(Resources::Allocation& Alloc);
+
+    /*! \brief Block until every queue is done with (Alloc). */
+    void WaitIdle(Resources::Allocation& Alloc);
+
+/* memory statistics */
+    /*! \brief Usage of a single VkDeviceMemory heap owned by the framework. */
+    struct HeapStats
+    {
+        uint32_t MemIdx; //! > The memory type the heap was allocated from.
+        bool bDedicated; //! > The heap holds a single dedicated allocation.
+
+        VkDeviceSize Reserved; //! > Size of the VkDeviceMemory.
+        VkDeviceSize Used; //! > Bytes handed out to allocations.
+        VkDeviceSize LargestFree; //! > The largest contiguous free range.
+        uint32_t AllocationCount; //! > Number of live allocations.
+        float Fragmentation; //! > 0 when all free memory is contiguous, approaching 1 as it gets split into small pieces.
+    };
+
+    /*! \brief Usage of one of the device's memory heaps (VkMemoryHeap, not MemoryHeap). */
+    struct DeviceHeapStats
+    {
+        VkDeviceSize Size; //! > The size of the device heap.
+        VkMemoryHeapFlags Flags;
+
+        VkDeviceSize Reserved; //! > Bytes the framework has allocated from this heap.
+        VkDeviceSize Used; //! > Bytes of (Reserved) that are in use.
+
+        bool bHasBudget; //! > Budget and Usage are only valid when VK_EXT_memory_budget is available.
+        VkDeviceSize Budget; //! > How much the driver thinks the process can allocate from this heap before allocations start failing or evicting.
+        VkDeviceSize Usage; //! > How much the process has allocated from this heap, as seen by the driver.
+    };
+
+    /*! \brief Totals of every Defragment() call since InitWrapperFW(). */
+    struct DefragStats
+    {
+        uint64_t Passes = 0; //! > Calls that moved at least one buffer.
+        uint64_t MovedBuffers = 0;
+        VkDeviceSize MovedBytes = 0;
+        uint64_t ReleasedBuffers = 0; //! > Moved-from buffers destroyed once the gpu was done with them.
+    };
+
+    struct MemoryStats
+    {
+        std::vector<HeapStats> Heaps;
+        std::vector<DeviceHeapStats> DeviceHeaps; //! > indexed by VkMemoryType::heapIndex
+        DefragStats Defrag;
+    };
+
+    /*! \brief Gather statistics for every heap of application memory, and driver budgets when VK_EXT_memory_budget is supported. */
+    MemoryStats GetMemoryStats();
+
+    /*! \brief Write GetMemoryStats() to (Path) as json. */
+    void DumpMemoryStats(std::string Path);
+
 class TransferAgent
 {
     public:
         TransferAgent(Allocators::CommandPool* pCmdPool) : cmdAllocator{pCmdPool}
         {
-            BufferCopies = {};
-            TransferBuffers = {};
-
             BuffImageCopies = {};
             TransferBuffImages = {};
             BufferImageLayouts = {};
@@ -78,58 +232,149 @@ class TransferAgent
             TransferImages= {};
             ImageLayouts = {};
 
-            bFlushing = false;
-
             pTransitBuffer = new Resources::Buffer("Transfer Agent Transit Buffer");
-            TransitTail = 0;
+            TransitSize = (VkDeviceSize)TRANSIT_FRAME_SIZE*TRANSIT_FRAME_SLACK;
+            TransitHead = 0;
+            TransitUsed = 0;
+            TransitPending = 0;
+            SubmitValue = 0;
 
-            if(CreateBuffer(*pTransitBuffer, 16000000, VK_BUFFER_USAGE_TRANSFER_SRC_BIT) != VK_SUCCESS)
+            if(CreateBuffer(*pTransitBuffer, TransitSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT) != VK_SUCCESS)
             {
                 throw std::runtime_error("Failed to create transit buffer.");
             }
 
-            Allocate(*pTransitBuffer, true);
+            Allocate(*pTransitBuffer, MemoryUsage::eStaging);
             Map(pTransitBuffer);
 
-            pCmdBuff = cmdAllocator->CreateBuffer();
+            for(uint32_t i = 0; i < TRANSFER_CMD_BUFFER_COUNT; i++)
+            {
+                CmdBuffs[i] = cmdAllocator->CreateBuffer();
+            }
+
+            CmdIdx = 0;
         }
         ~TransferAgent()
         {
-            delete pCmdBuff;
+            AwaitFlush();
+
+            for(uint32_t i = 0; i < TRANSFER_CMD_BUFFER_COUNT; i++)
+            {
+                CmdBuffs[i]->Wait();
+                delete CmdBuffs[i];
+            }
+
+            delete pTransitBuffer;
             delete cmdAllocator;
         }
 
         void Transfer(void* srcData, size_t srcSize, Resources::Buffer* dstBuff, size_t dstOffset = 0);
+
+        /*! \brief Upload to an image. The image is moved to the transfer queue, copied to, then released to the graphics family in (Layout).
+            Images owned by another family are taken without an ownership transfer (discarding their contents), so only whole image uploads are accepted for them, partial updates throw.
+            @param Layout The layout the image is left in for the graphics queue.
+        */
         void Transfer(void* srcData, size_t srcSize, Resources::Image* dstImg, VkExtent3D Extent, VkOffset3D ImgOffset, VkImageSubresourceLayers SubResource, VkImageLayout Layout);
         void Transfer(Resources::Image* srcImg, Resources::Image*dstImg, VkImageLayout srcLayout, VkImageLayout dstLayout, VkOffset3D srcOffset, VkOffset3D dstOffset, VkImageSubresourceLayers srcSubResource, VkImageSubresourceLayers dstSubResource, VkExtent3D Size);
 
-        /*! \brief Submit all transfer commands */
+        /*! \brief Copy (Size) bytes between raw buffer handles, recorded before every other copy in the flush. (used by Defragment() to move buffers) */
+        void Transfer(VkBuffer srcBuff, VkBuffer dstBuff, VkDeviceSize Size);
+
+        /*! \brief Submit all transfer commands without waiting for them. The submission signals GetTimeline() with GetSubmitValue(). */
         void Flush();
+
+        /*! \brief Block until every submitted flush has completed. */
         void AwaitFlush();
 
+        /*! \brief Make every following flush wait for (Semaphore) to reach (Value) before it copies anything. (i.e. until the gpu is done reading what the flush overwrites)
+            @param Semaphore A timeline semaphore, VK_NULL_HANDLE to flush without waiting.
+        */
+        void SetFlushDependency(VkSemaphore Semaphore, uint64_t Value) { DependencySemaphore = Semaphore; DependencyValue = Value; }
+
+        /*! \brief Whether the queued uploads write anything other than (pBuffer) (other buffers, images or buffer moves). Lets callers skip the flush dependency when a flush only writes memory they know is idle. */
+        bool WritesOutside(Resources::Buffer* pBuffer) const;
+
+        /*! \brief Record the acquire half of the ownership transfers released to (Family) by submitted flushes.
+            Must be recorded into a submission that waits on GetTimeline() with GetSubmitValue().
+        */
+        void RecordAcquires(Resources::CommandBuffer* pCmdBuff, uint32_t Family);
+
+        /*! \brief The timeline semaphore flushes signal (the timeline of the queue the agent submits to), work that reads uploaded data waits on it with GetSubmitValue(). */
+        VkSemaphore GetTimeline() { return GetQueueTimeline(cmdAllocator->PoolType); }
+
+        /*! \brief The value the most recent flush signals (0 before the first flush). */
+        uint64_t GetSubmitValue() { return SubmitValue; }
+
+        /*! \brief The value of the most recent flush that has completed on the gpu. */
+        uint64_t GetCompletedValue();
+
     private:
 
-        void FlushImpl();
+        /*! \brief Reserve (Size) bytes of the transit ring. Flushes (and waits for the gpu) when the ring is full instead of overflowing it.
+            @return The offset of the reserved range in the transit buffer.
+        */
+        VkDeviceSize AllocTransit(VkDeviceSize Size, VkDeviceSize Alignment);
 
-        std::atomic_bool bFlushing;
+        /*! \brief Record the queued buffer copies, one vkCmdCopyBuffer per destination with overlapping regions clipped (the last write wins) and adjacent regions merged. */
+        void RecordBufferCopies(Resources::CommandBuffer* pCmdBuff);
 
-        std::thread* pWaitThread;
-        Resources::Buffer* pTransitBuffer;
-        size_t TransitTail;
+        /*! \brief Record the queued buffer to image copies, with the layout transitions before them and the release barriers after. */
+        void RecordImageUploads(Resources::CommandBuffer* pCmdBuff);
+
+        /*! \brief Hand back the transit ranges of every flush up to and including (Value). */
+        void RetireTransit(uint64_t Value);
+
+        /* Transit ring, ranges are handed out at the head and given back in submission order once the flush that read them has completed. */
+            struct TransitRegion
+            {
+                VkDeviceSize Bytes; //! > Ring bytes the flush used (including padding and bytes skipped when wrapping).
+                uint64_t Value; //! > The flush the region belongs to.
+            };
+
+            Resources::Buffer* pTransitBuffer;
+            VkDeviceSize TransitSize; //! > Size of the ring.
+            VkDeviceSize TransitHead; //! > Offset of the next reservation.
+            VkDeviceSize TransitUsed; //! > Bytes reserved and not yet retired.
+            VkDeviceSize TransitPending; //! > Bytes reserved since the last flush.
+            std::deque<TransitRegion> TransitInFlight;
+            uint64_t SubmitValue; //! > The timeline value of the most recent flush.
 
         Allocators::CommandPool* cmdAllocator;
-        Resources::CommandBuffer* pCmdBuff;
+        Resources::CommandBuffer* CmdBuffs[TRANSFER_CMD_BUFFER_COUNT]; //! > Recycled in order, a buffer is reused once the flush it recorded has completed.
+        uint32_t CmdIdx; //! > The buffer the next flush records into.
 
-        std::vector<VkBufferCopy> BufferCopies;
-        std::vector<Resources::Buffer*> TransferBuffers;
+        VkSemaphore DependencySemaphore = VK_NULL_HANDLE; //! > Flushes wait for this to reach (DependencyValue), see SetFlushDependency().
+        uint64_t DependencyValue = 0;
+
+        BufferCopyList BufferCopies;
 
         std::vector<VkBufferImageCopy> BuffImageCopies;
         std::vector<Resources::Image*> TransferBuffImages;
-        std::vector<VkImageLayout> BufferImageLayouts;
+        std::vector<VkImageLayout> BufferImageLayouts; //! > The layout each image is released in.
+        std::vector<ImageChunk> ImageChunks; //! > Scratch for splitting image uploads.
+
+        // scratch for RecordImageUploads(), the distinct images of a flush.
+        struct UploadImage
+        {
+            Resources::Image* pImage;
+            VkImageLayout Layout; //! > The layout the image is released in.
+            VkImageAspectFlags AspectMask;
+        };
+
+        std::vector<UploadImage> UploadImages;
+        std::unordered_map<Resources::Image*, uint32_t> UploadImageSlots; //! > Index of each image in UploadImages.
+
+        Resources::Image* pPartialImage = nullptr; //! > Image whose chunks are still being queued, a flush in the middle of its upload keeps it on the transfer queue.
+        std::vector<VkImageMemoryBarrier> PendingAcquires; //! > Acquire barriers for images released by submitted flushes (dstQueueFamilyIndex is the family that has to record them).
 
         std::vector<VkImageCopy> ImageCopies;
         std::vector<std::pair<Resources::Image*, Resources::Image*>> TransferImages;
         std::vector<std::pair<VkImageLayout, VkImageLayout>> ImageLayouts;
+
+        std::vector<VkBufferCopy> MoveCopies;
+        std::vector<std::pair<VkBuffer, VkBuffer>> MoveBuffers;
 };
 
 TransferAgent* GetTransferAgent();
+
+JobSystem* GetJobSystem();
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Allocators
+{
+    /*! \brief Two-level segregated fit (TLSF) offset allocator.
+    *   Hands out offsets into a fixed size range (i.e. a VkDeviceMemory heap) without ever touching the memory itself.
+    *   Free() is O(1), and free neighbours are coalesced when a block is freed.
+    *   Allocate() is O(1) whenever a free list of the request's size rounded up to the next size class has a block. When none does it falls back to walking the free blocks from the request's own size class up for one that fits once aligned, which is O(n) in the number of free blocks.
+    *   This class has no Vulkan dependency so it can be used (and tested) on the CPU alone.
+    */
+    class HeapAllocator
+    {
+    public:
+        static constexpr uint32_t InvalidBlock = UINT32_MAX;
+
+        HeapAllocator(uint64_t Size = 0);
+
+        /*! \brief Drop every allocation and start managing a new range of (Size) bytes. */
+        void Reset(uint64_t Size);
+
+        /*! \brief Allocate a range from the heap
+            @param Size The size of the range in bytes.
+            @param Alignment The alignment of the range's offset (must be a power of two).
+            @param Offset Receives the offset of the range.
+            @return A handle to the allocated block, or InvalidBlock if the heap can't fit the request.
+        */
+        uint32_t Allocate(uint64_t Size, uint64_t Alignment, uint64_t& Offset);
+
+        /*! \brief Release a block returned by Allocate(), merging it with any free neighbours. */
+        void Free(uint32_t Block);
+
+        uint64_t GetSize() const { return HeapSize; }
+        uint64_t GetUsed() const { return UsedBytes; }
+        uint64_t GetFree() const { return HeapSize - UsedBytes; }
+        uint32_t GetAllocationCount() const { return AllocCount; }
+
+        /*! \brief The size of the largest contiguous free range. */
+        uint64_t GetLargestFreeBlock() const;
+
+        /*! \brief 0 when all free memory is one contiguous range, approaching 1 as free memory gets split into small pieces. */
+        float GetFragmentation() const;
+
+    private:
+        static constexpr uint32_t SlLog2 = 4; // second level subdivisions (as a power of two)
+        static constexpr uint32_t SlCount = 1 << SlLog2;
+        static constexpr uint32_t FlCount = 64;
+        static constexpr uint64_t MinBlockSize = 16; // the remainder of a block is only split off if it's at least this big.
+
+        struct Block
+        {
+            uint64_t Offset;
+            uint64_t Size;
+
+            uint32_t PrevPhys; // physical neighbours (by offset)
+            uint32_t NextPhys;
+
+            uint32_t PrevFree; // neighbours in the free list this block is stored in
+            uint32_t NextFree;
+
+            bool bFree;
+        };
+
+        uint32_t CreateNode();
+        void ReleaseNode(uint32_t Node);
+
+        void InsertFree(uint32_t Node);
+        void RemoveFree(uint32_t Node);
+
+        uint32_t FindFree(uint64_t Size, uint64_t Alignment);
+
+        static void Mapping(uint64_t Size, uint32_t& Fl, uint32_t& Sl);
+        static uint64_t AlignUp(uint64_t Value, uint64_t Alignment) { return (Value + Alignment - 1) & ~(Alignment - 1); }
+
+        uint64_t HeapSize;
+        uint64_t UsedBytes;
+        uint32_t AllocCount;
+
+        uint64_t FlBitmap; // bit (fl) is set when any list in FreeHeads[fl] is non-empty
+        uint32_t SlBitmap[FlCount]; // bit (sl) is set when FreeHeads[fl][sl] is non-empty
+        uint32_t FreeHeads[FlCount][SlCount];
+
+        std::vector<Block> Blocks;
+        std::vector<uint32_t> UnusedNodes; // recycled indices into Blocks
+    };
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobCounter;
+
+/*! \brief A unit of work queued on the job system. */
+struct JobTask
+{
+    std::function<void(uint32_t ThreadIdx)> Func;
+    JobCounter* pSignal = nullptr; //! > Decremented once (Func) has returned.
+};
+
+/*! \brief Counts unfinished tasks. Tasks can wait on it (JobSystem::Wait()) or be queued as continuations that start once it reaches zero. */
+class JobCounter
+{
+public:
+    uint32_t GetPending() const { return Pending.load(); }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<uint32_t> Pending{0};
+
+    std::mutex Lock; // guards Continuations
+    std::vector<JobTask> Continuations; // queued once Pending reaches zero
+};
+
+/*! \brief Task statistics, summed over every thread. */
+struct JobStats
+{
+    uint64_t Executed; //! > Tasks run.
+    uint64_t Stolen; //! > Tasks run by a thread other than the one that queued them.
+};
+
+/*! \brief Work-stealing job system.
+*   Every thread has a deque of tasks. Threads push and pop their own tasks at the back (newest first, while their data is still in cache), and idle threads steal from the front of the others' deques (oldest first, those tend to be the biggest pieces of work).
+*   The thread that creates the job system is thread 0 and takes part whenever it waits, tasks can only be queued and waited on from it or from inside tasks.
+*   This class has no Vulkan dependency.
+*/
+class JobSystem
+{
+public:
+    typedef std::function<void(uint32_t ThreadIdx)> Task;
+    typedef std::function<void(uint32_t JobIdx, uint32_t ThreadIdx)> Job;
+
+    /*! \brief Start (ThreadCount-1) workers, the creating thread makes up the last one. */
+    JobSystem(uint32_t ThreadCount);
+    ~JobSystem();
+
+    /*! \brief Queue (Func) on the calling thread's deque.
+        @param pSignal Incremented now and decremented once the task has run, nullptr if nothing waits on the task.
+        @param pAfter The task is held back until this counter reaches zero (a continuation), nullptr to queue it right away.
+    */
+    void Run(Task Func, JobCounter* pSignal = nullptr, JobCounter* pAfter = nullptr);
+
+    /*! \brief Run queued tasks (or steal them) until (pCounter) reaches zero. */
+    void Wait(JobCounter* pCounter);
+
+    /*! \brief Run (Func) once for every job index in [0, JobCount), blocking until all of them have returned.
+        @param Func Called with the job index and the index of the thread running it, jobs on the same thread never overlap unless a job waits on the job system itself.
+    */
+    void Dispatch(uint32_t JobCount, const Job& Func);
+
+    /*! \brief Number of threads tasks can run on, including the creating thread. (ThreadIdx is always below this) */
+    uint32_t GetThreadCount() const { return ThreadCount; }
+
+    JobStats GetStats() const;
+    void ResetStats();
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex Lock;
+        std::deque<JobTask> Tasks;
+
+        std::atomic<uint64_t> Executed{0};
+        std::atomic<uint64_t> Stolen{0};
+    };
+
+    void WorkerLoop(uint32_t ThreadIdx);
+
+    void Push(JobTask&& Entry);
+
+    /*! \brief Pop the newest task of (ThreadIdx)'s deque, or steal the oldest task of another deque. */
+    bool TakeTask(uint32_t ThreadIdx, JobTask& Entry);
+
+    void Execute(JobTask& Entry, uint32_t ThreadIdx);
+
+    /*! \brief Decrement (pCounter), queueing its continuations when it reaches zero. */
+    void Signal(JobCounter* pCounter);
+
+    uint32_t ThreadCount;
+    std::unique_ptr<WorkerQueue[]> Queues; // one per thread
+    std::vector<std::thread> Workers;
+
+    std::atomic<uint32_t> QueuedTasks{0}; // tasks sitting in any deque
+
+    std::mutex SleepLock; // idle workers sleep on WakeCond until a task is queued
+    std::condition_variable WakeCond;
+    bool bQuit = false;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "HeapAllocator.hpp"
+
+/* Heap bookkeeping for sub-allocation and Defragment(). Nothing here calls into the driver (heaps are created and freed by the framework), so it can be tested with fake heaps and buffers. */
+
+namespace Resources
+{
+    struct Buffer;
+}
+
+/*! \brief A heap of application memory.*/
+struct MemoryHeap
+{
+    MemoryHeap() : Size(0), MemIdx(UINT32_MAX), bDedicated(false), Memory(VK_NULL_HANDLE), pMapped(nullptr) {}
+    ~MemoryHeap() {}
+
+    size_t Size; // the size of the memory heap
+    uint32_t MemIdx; // the memory type this heap was allocated from
+    bool bDedicated; // the heap holds exactly one resource (VK_KHR_dedicated_allocation) and is never sub-allocated from
+
+    Allocators::HeapAllocator SubAllocator; // hands out (and takes back) ranges of the heap
+
+    std::vector<Resources::Buffer*> Buffers; // buffers bound to this heap, these are the allocations Defragment() can move
+
+    VkDeviceMemory Memory; // the memory heap's memory handle
+    void* pMapped; // pointer to the heap's memory, host visible heaps are mapped for their whole lifetime
+};
+
+/*! \brief Sub-allocate (MemReq) from the first heap in (Heaps) with a large enough free range. Dedicated heaps are never sub-allocated from.
+    @param pSkip A heap not to allocate from (the heap being emptied by Defragment())
+    @param pHeap Receives the heap the range was allocated from.
+    @param Offset Receives the offset of the range in (pHeap).
+    @param Block Receives the range's handle in (pHeap)'s sub-allocator.
+    @return false if none of the heaps could fit the allocation.
+*/
+bool SubAllocate(const std::vector<MemoryHeap*>& Heaps, VkMemoryRequirements MemReq, MemoryHeap* pSkip, MemoryHeap*& pHeap, uint64_t& Offset, uint32_t& Block);
+
+/*! \brief Pick the heap Defragment() empties, the least used one below (MaxUsage).
+    Only device local heaps are compacted (host visible buffers hand out pointers to their memory), only memory types with another shared heap to move into, and only heaps that hold nothing but buffers, since those are the only heaps that can be emptied completely.
+    @param pHeaps The application's heaps, indexed by memory type (MemProps.memoryTypeCount vectors).
+    @return nullptr if no heap is worth emptying.
+*/
+MemoryHeap* PickDefragSource(const std::vector<MemoryHeap*>* pHeaps, const VkPhysicalDeviceMemoryProperties& MemProps, float MaxUsage);
+
+/*! \brief A buffer's new place, planned by PlanDefragMoves(). */
+struct DefragMove
+{
+    Resources::Buffer* pBuffer;
+    MemoryHeap* pHeap; // the heap the buffer moves to
+    uint64_t Offset;
+    uint32_t Block;
+    uint64_t Size;
+};
+
+/*! \brief Allocate new ranges for the buffers of (pSource), starting from the back of its buffer list, in the other shared heaps of (Heaps).
+    Each planned buffer is moved from (pSource->Buffers) to its new heap's list, the buffer's old range is left allocated for the caller to free once the buffer's contents have been copied.
+    Planning stops once (ByteBudget) bytes are planned, or at the first buffer none of the other heaps can fit (heaps are never created to make room).
+    @param GetRequirements Returns the memory requirements of a buffer (the same for the buffer's replacement, which is created with the same parameters).
+    @return The planned moves, in the order the buffers were taken.
+*/
+std::vector<DefragMove> PlanDefragMoves(const std::vector<MemoryHeap*>& Heaps, MemoryHeap* pSource, uint64_t ByteBudget, const std::function<VkMemoryRequirements(Resources::Buffer*)>& GetRequirements);
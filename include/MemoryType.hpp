@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+#include "vulkan/vulkan.h"
+
+/* Memory type selection. These are pure functions of the device's memory properties, kept apart from the rest of the framework so they can be tested against a fake memory properties table. */
+
+/*! \brief How an allocation is accessed, used to pick the memory type it is allocated from. */
+enum class MemoryUsage
+{
+    eGpuOnly, //! > Only accessed by the gpu (device local).
+    eCpuToGpu, //! > Written by the cpu, read by the gpu every frame (host visible + coherent, device local when available).
+    eStaging, //! > Written by the cpu, only read by transfers (host visible + coherent, kept out of device local memory).
+    eReadback, //! > Written by the gpu, read by the cpu (host visible, cached when available).
+    eTransient //! > Attachments that never leave tile memory (lazily allocated when available).
+};
+
+/*! \brief Pick the memory type best suited to an allocation.
+    @param MemProps The memory properties of the device.
+    @param TypeBits The memory types the resource can be bound to (VkMemoryRequirements::memoryTypeBits).
+    @param Required Property flags the memory type must have.
+    @param Preferred Property flags the memory type should have, the type with the most of these wins.
+    @param Avoided Property flags the memory type should not have.
+    @return The index of the memory type, UINT32_MAX if no allowed type has all the required flags.
+*/
+uint32_t FindMemoryType(const VkPhysicalDeviceMemoryProperties& MemProps, uint32_t TypeBits, VkMemoryPropertyFlags Required, VkMemoryPropertyFlags Preferred = 0, VkMemoryPropertyFlags Avoided = 0);
+
+/*! \brief Translate a memory usage into the property flags FindMemoryType() picks a memory type with. */
+void GetUsageFlags(MemoryUsage Usage, VkMemoryPropertyFlags& Required, VkMemoryPropertyFlags& Preferred, VkMemoryPropertyFlags& Avoided);
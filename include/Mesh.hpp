@@ -2,11 +2,12 @@
 
 #include "Framework.hpp"
 #include "Texture.hpp"
+#include "VertexPacking.hpp"
 
 #include "glm/gtc/matrix_transform.hpp"
 
-// if this is changed, change the define with the same name in Shaders/Draw.comp
-#define MAX_RENDERABLE_INSTANCES 600
+// set on instance indices that point into the dynamic scene buffer rather than the static one, if this is changed, change the define with the same name in Shaders/Draw.comp, Shaders/Vert.glsl and Shaders/Depth.glsl
+#define DYNAMIC_INSTANCE_BIT 0x80000000u
 
 // seperate drawables and meshes.
 
@@ -23,17 +24,6 @@ public:
     Texture::Texture2D Normal;
 };
 
-/*! Vertex structure containing all needed attributes */
-struct Vertex
-{
-public:
-    Vertex() {};
-
-    alignas(16) glm::vec3 Position; //! > Position of the vertex in 3D-space
-    alignas(16) glm::vec3 Normal; //! > Facing normal of the vertex.
-    alignas(8) glm::vec2 UV; //! > UV coordinates of the vertex, for mapping to textures.
-};
-
 /*
 struct pbrMeshDescriptors
 {
@@ -58,23 +48,16 @@ class Cullable
 class Instanced
 {
 public:
-    Instanced();
-    ~Instanced();
-
-    static Resources::DescriptorLayout* pMeshPassLayout; // This should never be changed, this is the layout for a buffer that handles proper indexing and instancing with the renderer. (i.e. It should not change stride, size, or offsets).
+    virtual ~Instanced() {};
 
-    virtual void GenDraws(VkCommandBuffer* pCmdBuffer, VkPipelineLayout Layout) = 0;
-    virtual void DrawInstances(VkCommandBuffer* pCmdBuffer, VkPipelineLayout Layout) = 0;
     virtual void AddInstance(uint32_t InstanceIndex) = 0;
-    void Update();
 
-    Resources::DescriptorSet* pMeshPassSet; //! > The Mesh pass Descriptor. This is provided by the renderer through the AddMesh() method. P.S. the descriptor layout used to create this descriptor set is the static pMeshPassLayout variable. Also contains a list of all instances, this is used to map raw indices to scene indices (instance 0,1,2 is mapped to an object index in the scene like 24,58,91)
+    const std::vector<uint32_t>& GetInstances() const { return Instances; }
 
-protected:
-    bool bInstanceDataDirty; //! > Dirty flag. Raised when a new instance is attached to the mesh.
+    uint32_t MeshIdx = 0; //! > Index of the mesh in the scene, assigned by AddMesh(). Indexes the mesh's bounding sphere, draw command template and batch.
 
+protected:
     std::vector<uint32_t> Instances; //! > List of managed instances. They are represented here as indices in the scene buffer.
-    Resources::Buffer MeshPassBuffer; //! > The Mesh pass buffer. This buffer contains (in this order) a VkDrawIndexedIndirectCommand, two uint32(s) a mesh bound index for frustum culling and an instance count indicating the number of instances managed by the mesh, and finally an array of MAX_RENDERABLE_INSTANCES uint32(s) representing the instances (as indices in the Scene buffer) to render. And finally, a list of all instance indices, this is used to map render indices to scene indices (instance 0,1,2 is mapped to an object index in the scene like 24,58,91) In debug builds, this will exist on host visible memory.
 };
 
 class Mesh : public Instanced
@@ -82,7 +65,7 @@ class Mesh : public Instanced
 public:
     CullingBox CullBound;
     
-    Mesh() : Instanced(), MeshBuffer("Mesh Buffer") {};
+    Mesh() : Instanced() {};
     ~Mesh()
     {
 #ifdef DEBUG_MODE
@@ -103,9 +86,22 @@ public:
     uint32_t IndexCount;
     uint32_t* pIndices;
 
-    uint32_t IndexOffset; //! The offset in bytes of the Indices in the mesh buffer, used during draw calls.
+    uint32_t VertexOffset; //! Index of the mesh's first vertex in the renderer's vertex arena, set by SceneRenderer::AddMesh().
+    uint32_t FirstIndex; //! Index of the mesh's first index in the renderer's index arena, set by SceneRenderer::AddMesh().
+
+    glm::vec4 BoundingSphere; //! Model space sphere around every vertex, the center is in xyz and the radius in w.
+    glm::vec4 BoundingExtent; //! Half the size of the model space bounding box in xyz, the box is centered on the sphere's center.
+
+    /*! \brief Fit BoundingSphere and BoundingExtent around pVertices, see VertexPacking::FitBounds(). */
+    void GenBounds();
+
+    /*! \brief Reorder pIndices for the post-transform vertex cache and then for overdraw, and renumber pVertices in the order they're first used (dropping unused ones). Debug builds print the cache statistics before and after.
+        pIndices must be a triangle list. Meshes with an index past VertCount are left as they are.
+    */
+    void Optimize();
 
-    Resources::Buffer MeshBuffer; //! Contains all the mesh's vertices and indices on the GPU for use during rendering.
+    /*! \brief Quantize pVertices into (pOut), which has room for VertCount vertices, see VertexPacking::Pack(). The bounds have to be generated first. */
+    void PackVertices(PackedVertex* pOut);
 
     std::string Name;
 };
@@ -124,15 +120,7 @@ public:
         #endif
     }
 
-    void Bake();
-
     /* Inherited from instance */
-        /*! \brief Generates the draw commands (and performs occlusion and frustum culling) for the instances*/
-        void GenDraws(VkCommandBuffer* pCmdBuffer, VkPipelineLayout Layout);
-
-        /*! \brief Renders all visible instances of this mesh. */
-        void DrawInstances(VkCommandBuffer* pCmdBuff, VkPipelineLayout Layout);
-
         void AddInstance(uint32_t InstanceIndex);
 
 private:
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+/*! \brief Import time index and vertex reordering for triangle lists.
+*   Like the heap allocator, this has no Vulkan dependency so it can be run (and tested) on the CPU alone.
+*   Every function expects a triangle list whose indices are all smaller than (VertexCount).
+*/
+namespace MeshOptimizer
+{
+    static constexpr uint32_t InvalidIndex = UINT32_MAX;
+    static constexpr uint32_t DefaultCacheSize = 16; // post-transform cache entries assumed by the optimizations (and simulated by the statistics)
+
+    /*! \brief Post-transform vertex cache efficiency of an index buffer, simulated with a FIFO cache. */
+    struct CacheStats
+    {
+        float Acmr; //! > Average cache miss ratio, transformed vertices per triangle (3 is the worst, around 0.5 the best a regular grid can reach).
+        float Atvr; //! > Average transformed vertex ratio, transformed vertices per referenced vertex (1 is optimal).
+    };
+
+    CacheStats AnalyzeVertexCache(const uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount, uint32_t CacheSize = DefaultCacheSize);
+
+    /*! \brief Reorder the triangles for the post-transform vertex cache (Tipsify, Sander et al. 2007).
+        Triangles are emitted in fans around a vertex, the next fan is picked among the vertices just emitted that will still be cached once their remaining triangles are drawn.
+    */
+    void OptimizeVertexCache(uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount, uint32_t CacheSize = DefaultCacheSize);
+
+    /*! \brief Reorder clusters of a cache optimized index buffer so triangles likely to occlude the rest of the mesh are drawn first.
+        The buffer is split into clusters where the vertex cache restarts, and where a cluster's miss ratio so far is within (Threshold) of the whole cluster's. The triangle order inside a cluster is kept, so the cache efficiency only drops by about (Threshold).
+        @param pPositions The (VertexCount) vertex positions.
+    */
+    void OptimizeOverdraw(uint32_t* pIndices, uint32_t IndexCount, const glm::vec3* pPositions, uint32_t VertexCount, uint32_t CacheSize = DefaultCacheSize, float Threshold = 1.05f);
+
+    /*! \brief Renumber the vertices in the order the index buffer first uses them, so vertex fetches walk memory linearly.
+        @param Remap Receives the new index of every vertex, InvalidIndex for vertices no triangle uses. The caller moves its vertices accordingly.
+        @return The number of vertices the index buffer uses (the size of the remapped vertex array).
+    */
+    uint32_t OptimizeVertexFetch(uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount, std::vector<uint32_t>& Remap);
+}
@@ -9,30 +9,33 @@
 
 #define MAX_STATIC_SCENE_SIZE 10000
 #define MAX_DYNAMIC_SCENE_SIZE 5000
+#define MEMORY_STATS_INTERVAL 600 // frames between memory statistic dumps (debug builds only)
+#define DEFRAG_FRAME_INTERVAL 120 // frames between Defragment() calls, each call first waits for the frames in flight to finish
+#define DRAW_GROUP_SIZE 64 // draw generation invocations per workgroup (local_size_x in Draw.comp)
+#define MAX_SCENE_MESHES 1000 // meshes the scene can hold (each one gets a bounding sphere and a draw command, so this also bounds the pipe stages that draw)
+#define MAX_SCENE_VERTICES 2000000 // vertices the scene's vertex arena can hold
+#define MAX_SCENE_INDICES 6000000 // indices the scene's index arena can hold
+#define MAX_SCENE_INSTANCES (MAX_STATIC_SCENE_SIZE+MAX_DYNAMIC_SCENE_SIZE) // mesh instances draw generation can cull in one dispatch
 
 typedef uint32_t PointLight;
 
 //! Pipeline stage in a renderpass.
 /*!
  Contains all drawables assigned to the wrapped pipeline. Also contains the index of the subpass this pipeline was built against.
+ Every mesh lives in the renderer's geometry arenas, so all of the stage's meshes are drawn with a single indirect count draw (its batch).
 */
 struct PipeStage
 {
-    /*! \brief Call to update all owned meshes. (called every frame to reset draw information, this function must be called before UpdateDraws())
+    /*! \brief Draw the stage's meshes with this pipeline, the geometry arenas have to be bound.
+        @param DrawBuffer The buffer holding the draw commands and counts generated for the frame.
+        @param CompactOffset Offset of the frame's compacted draw commands in (DrawBuffer).
+        @param CountOffset Offset of the frame's batch draw counts in (DrawBuffer).
     */
-    void Update();
-
-    /*! \brief Call to regenerate draw lists (called every frame so that culling can be performed).
-     
-        Exclusively for internal use by the renderer. The compute layout should only point to the 
-     
-        @param pCmdBuffer A pointer to the Resources::CommandBuffer object to hold this command.
-        @param ComputeLayout The pipeline layout of the compute pipeline to use.
-    */
-    void UpdateDraws(Resources::CommandBuffer* pCmdBuffer, VkPipelineLayout ComputeLayout);
+    void Draw(Resources::CommandBuffer* pCmdBuffer, VkBuffer DrawBuffer, VkDeviceSize CompactOffset, VkDeviceSize CountOffset);
 
-    // Call to Draw all owned meshes with this pipeline.
-    void Draw(Resources::CommandBuffer* pCmdBuffer);
+    bool bPositionStream = false; //! > Taken from the pipeline's profile, the stage draws from the position stream instead of the vertex arena.
+    uint32_t BatchIdx = 0; //! > Index of the stage's draw count, written by draw generation. Assigned by the renderer whenever a mesh is added.
+    uint32_t FirstDraw = 0; //! > Index of the stage's first compacted draw command, the stage has room for one per mesh.
 
     Pipeline* Pipe = nullptr;
     uint32_t PassIdx;
@@ -45,8 +48,6 @@ struct PipeStage
 */
 struct PassStage
 {
-    void Update();
-
     std::vector<PipeStage*> PipeStages;
 };
 
@@ -56,22 +57,25 @@ class Camera
 public:
     Camera();
 
-    void Update();
+    /*! \brief Write the view matrix, the projection-view matrix and the frustum planes into the (FrameSlot) slice of WvpBuffer. */
+    void Update(uint32_t FrameSlot);
 
     void Move();
 
     void Rotate();
 
-    void GenPlanes();
+    /*! \brief Extract the six world space frustum planes from (ProjView), normalized so a plane's distance to a point is dot(Plane.xyz, Point) + Plane.w. */
+    void GenPlanes(const glm::mat4& ProjView);
 
-    Resources::Buffer WvpBuffer;
+    Resources::Buffer WvpBuffer; //! > One slice per frame in flight, holding the world, view, projection and projection-view matrices followed by the frustum planes (Cam_t in the shaders).
+    VkDeviceSize SliceSize; //! > Size of a frame's slice of WvpBuffer (a multiple of the uniform buffer offset alignment).
 
     glm::mat4 CamMat;
 
 private:
     glm::vec3 Position, Rotation;
-    glm::mat4* pWvp;
-    glm::vec4 Planes[6];
+    glm::mat4 Proj;
+    glm::vec4 Planes[6]; //! > Left, right, bottom, top, near, far.
     float MoveSpeed;
     glm::vec2 PrevMouse;
 };
@@ -114,6 +118,7 @@ public:
      */
     Pipeline* CreatePipeline(std::string PipeName, uint32_t SubpassIdx, const char* VtxPath, const char* FragPath, uint32_t BlendAttCount = 0, VkPipelineColorBlendAttachmentState* BlendAttachments = nullptr, uint32_t DescriptorCount = 0, Resources::DescriptorLayout* pDescriptors = nullptr, PipelineProfile* pProfile = nullptr);
 
+    /*! \brief Upload (Mesh)'s vertices and indices into the geometry arenas and draw it with the pipeline named (PipeName). */
     void AddMesh(pbrMesh* Mesh, std::string PipeName);
     Drawable* CreateDrawable(pbrMesh* pMesh, bool bDynamic);
     
@@ -152,6 +157,7 @@ public:
 
     void Bake();
     
+    /*! \brief Upload the instance lists for the frame the next call to Render() records, if meshes or instances were added. */
     void Update();
 
     void Render();
@@ -166,6 +172,7 @@ public:
 
     /* Scene Render Information */
         PipelineProfile SceneProfile; //! > Scene-wide pipeline profile.
+        PipelineProfile PositionProfile; //! > The scene profile, reading only positions from the position stream. For pipelines that don't shade (depth prepass, shadows, occlusion), see Shaders/Depth.glsl.
         Camera* SceneCam; //! > Scene camera structure.
 
 private:
@@ -173,11 +180,40 @@ private:
         std::vector<PointLight> SceneLights;
     
     /* Scene Pass */
-        struct
+        /* A job system thread's command buffer recyclers. Recording jobs take their secondary command buffers from the recyclers of the thread they run on, so no pool is ever used by two threads. */
+        struct ThreadRecorder
+        {
+            Allocators::CommandRecycler Graphics;
+        };
+
+        /* A pipe stage's draw, recorded by one job into a secondary buffer. */
+        struct RecordJob
         {
-            VkSemaphore DrawGenSem;
-            Resources::Fence* pFrameFence;
-        } SceneSync; //! > Contains the semaphore and fence used to synchronise draw call generation.
+            PipeStage* pStage;
+            uint32_t PassIdx; //! > The subpass the stage draws in.
+
+            Resources::CommandBuffer* pGraphicsBuffer; //! > Filled in by the job.
+        };
+
+        /* Everything a frame in flight writes to or waits on, the cpu records frame N+1 into one slot while the gpu renders frame N from another. */
+        struct FrameSlot
+        {
+            Resources::CommandBuffer* pCmdComputeBuffer = nullptr; //! > Compute render buffer (mostly used for command generation), recycled every frame.
+            Resources::CommandBuffer* pCmdRenderBuffer = nullptr; //! > Render buffer, recycled every frame.
+
+            VkSemaphore ImageAvailableSem; //! > Signaled when the acquired swapchain image can be rendered to.
+
+            Resources::DescriptorSet* pSceneDescriptorSet = nullptr; //! > Points at the frame's slices of the camera and dynamic scene buffers.
+            Resources::DescriptorSet* pDrawDescriptorSet = nullptr; //! > Points at the frame's slice of the draw buffer.
+        } Frames[FRAMES_IN_FLIGHT];
+
+        std::vector<ThreadRecorder*> Recorders; //! > One per job system thread, keyed by frame slot. The calling thread's (0) also hands out the render buffers.
+        Allocators::CommandRecycler* pComputeRecycler = nullptr; //! > Hands out the draw generation buffers, keyed by frame slot.
+
+        std::vector<RecordJob> RecordJobs; //! > Rebuilt every frame, in subpass order.
+        std::vector<uint32_t> PassJobOffsets; //! > Index of the first job of each subpass (plus one past the last job).
+
+        SyncPoint LastRender; //! > The most recent frame's render submission, on the graphics queue's timeline.
 
         std::vector<VkSemaphore> RenderSemaphores; //! > Contains all the semaphores needed for rendering. The size of the vector is equal to the number of framebuffers
 
@@ -188,20 +224,55 @@ private:
 
     /* Scene Descriptor layout can be found in Draw.comp */
         Resources::DescriptorLayout* pSceneDescriptorLayout;
-        Resources::DescriptorSet* pSceneDescriptorSet;
 
         /* SSBO for static scene objects */
             Resources::Buffer StaticSceneBuffer; //! > Static scene object positions (10000).
             uint32_t StaticIter = 0; //! > Index Iterator
 
         /* SSBO for dynamic scene objects */
-            Resources::Buffer DynamicSceneBuffer; //! > Dynamic scene object positions (5000).
+            Resources::Buffer DynamicSceneBuffer; //! > Dynamic scene object positions (5000), one slice per frame in flight.
+            VkDeviceSize DynamicSliceSize; //! > Size of a frame's slice of the dynamic scene buffer.
             uint32_t DynamicIter = 0; //! > Index Iterator
+            std::vector<Drawable*> DynamicDrawables; //! > Their transforms are written into the frame's slice every frame.
     
         /* SSBO for scene lights */
             Resources::Buffer SceneLightBuffer; //! > Contains all the lights in the current scene.
             uint32_t LightIter = 0; //! > Index Iterator
 
+        /* Geometry arenas, every mesh's vertices and indices are sub-allocated from these so the whole scene draws with one vertex and index buffer binding */
+        Resources::Buffer VertexArena; //! > Packed vertices of every mesh (MAX_SCENE_VERTICES), the draw commands' vertexOffset points at a mesh's range.
+        uint32_t VertexIter = 0; //! > Index Iterator
+        Resources::Buffer PositionArena; //! > The positions of the vertex arena again, tightly packed, for pipelines that only need positions. Shares the vertex arena's offsets.
+        Resources::Buffer IndexArena; //! > Indices of every mesh (MAX_SCENE_INDICES), relative to the mesh's first vertex.
+        uint32_t IndexIter = 0; //! > Index Iterator
+
+    /* SSBO for mesh bounds */
+            Resources::Buffer MeshBoundsBuffer; //! > A model space bounding sphere and bounding box extent per mesh (MAX_SCENE_MESHES), indexed by Instanced::MeshIdx.
+
+    /* Draw generation, the layout of set 1 can be found in Draw.comp */
+        Resources::DescriptorLayout* pDrawDescriptorLayout;
+
+        /* One slice per frame in flight. A slice holds (in this order, each range aligned to the storage buffer offset alignment) the generated draw commands, the templates they are reset from, the instance list, the visible instance list, the batch table, the batch draw counts and the compacted draw commands. */
+            Resources::Buffer DrawBuffer;
+            VkDeviceSize DrawSliceSize; //! > Size of a frame's slice of the draw buffer.
+            VkDeviceSize DrawTemplateOffset; //! > Offsets of the ranges in a slice (the draw commands start at 0).
+            VkDeviceSize InstanceListOffset;
+            VkDeviceSize VisibleListOffset;
+            VkDeviceSize BatchTableOffset;
+            VkDeviceSize DrawCountOffset;
+            VkDeviceSize CompactDrawOffset;
+
+        std::vector<pbrMesh*> SceneMeshes; //! > Every mesh in the scene, indexed by Instanced::MeshIdx.
+        std::vector<VkDrawIndexedIndirectCommand> DrawTemplates; //! > A draw command per mesh with no instances, firstInstance points at the mesh's range of the visible list.
+        std::vector<uint32_t> InstanceList; //! > A (scene index, mesh index) pair per instance, grouped by mesh in MeshIdx order.
+        std::vector<uint32_t> BatchTable; //! > A (batch index, first compacted draw of the batch) pair per mesh, in MeshIdx order.
+        uint32_t BatchCount = 0; //! > Pipe stages that draw at least one mesh.
+        bool bInstancesChanged = false; //! > Raised when a mesh or instance is added, the lists above are rebuilt before the next upload.
+        uint32_t DrawDirtySlots = 0; //! > Bit (i) is raised while slot (i) of the draw buffer holds outdated lists.
+
+        /*! \brief Rebuild the instance lists and batch table if they changed and upload them into (FrameSlot)'s slice of the draw buffer if it's outdated. */
+        void UpdateDrawLists(uint32_t FrameSlot);
+
     /* Drawing/Rendering */
         std::unordered_map<std::string, PipeStage*> PipeStages; //! > Pipeline stages (Pipeline+Drawables) mapped to string names (the names of the pipeline.)
 
@@ -211,12 +282,12 @@ private:
         std::vector<PassStage> PassStages; //! > Pipeline stages sorted by subpass.
 
         ComputePipeline DrawPipeline; //! > The pipeline used by the renderer to perform culling and generate indirect draw commands
+        ComputePipeline CompactPipeline; //! > Packs the draw commands of meshes with visible instances into their batch's range and counts them.
 
     /* Command buffers */
         Resources::CommandBuffer* pCmdOpsBuffer = nullptr; //! > General purpose spare command buffer.
-        Resources::CommandBuffer* pCmdComputeBuffer = nullptr; //! > Compute render buffer (mostly used for command generation).
 
-        Resources::CommandBuffer* pCmdRenderBuffer = nullptr; //! > Render buffer.
+        uint64_t FrameCount = 0; //! > Number of frames rendered.
 };
 
 class AssetManager
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+/*! \brief Vertex quantization for the renderer's vertex arenas, decoded by Shaders/Vert.glsl and Shaders/Depth.glsl.
+*   Like the mesh optimizer, this has no Vulkan dependency so it can be run (and tested) on the CPU alone.
+*/
+
+/*! Vertex structure containing all needed attributes, at full precision. Only kept on the CPU, meshes are uploaded as PackedVertex. */
+struct Vertex
+{
+public:
+    Vertex() {};
+
+    glm::vec3 Position; //! > Position of the vertex in 3D-space
+    glm::vec3 Normal; //! > Facing normal of the vertex.
+    glm::vec2 UV; //! > UV coordinates of the vertex, for mapping to textures.
+};
+
+/*! The vertex layout in the renderer's vertex arena (16 bytes instead of the 48 a padded Vertex took). Decoded in Shaders/Vert.glsl. */
+struct PackedVertex
+{
+    uint32_t PositionXY; //! > Position relative to the mesh's bounding box (-1 is the min corner, 1 the max corner), snorm16 per component. Read as R16G16B16A16_SNORM together with PositionZ.
+    uint32_t PositionZ; //! > z in the low half, the high half is padding (w reads as 0).
+    uint32_t Normal; //! > Octahedral encoded normal, snorm16 per component (R16G16_SNORM).
+    uint32_t UV; //! > Half floats (R16G16_SFLOAT).
+};
+
+/*! A vertex of the position-only stream, the position half of a PackedVertex. Decoded in Shaders/Depth.glsl. */
+struct PackedPosition
+{
+    uint32_t XY;
+    uint32_t Z;
+};
+
+namespace VertexPacking
+{
+    /*! \brief Fit a sphere around the (Count) vertices, centered on their bounding box, and the box's half size (in xyz of (Extent)). Both are zero when there are no vertices. */
+    void FitBounds(const Vertex* pVertices, uint32_t Count, glm::vec4& Sphere, glm::vec4& Extent);
+
+    /*! \brief Project a normal onto an octahedron and unfold the lower half over the upper one, so any direction fits in two components in [-1, 1]. A zero normal encodes to (0, 0). */
+    glm::vec2 OctEncode(glm::vec3 Normal);
+
+    /*! \brief The inverse of OctEncode(), the same as OctDecode() in Shaders/Vert.glsl. */
+    glm::vec3 OctDecode(glm::vec2 Oct);
+
+    /*! \brief Quantize (Count) vertices into (pOut), positions relative to the box (Center +- Extent) FitBounds() returned for them. */
+    void Pack(const Vertex* pVertices, uint32_t Count, glm::vec3 Center, glm::vec3 Extent, PackedVertex* pOut);
+
+    /*! \brief Decode a packed vertex the way the vertex shader does. */
+    Vertex Unpack(const PackedVertex& Packed, glm::vec3 Center, glm::vec3 Extent);
+
+    /*! \brief The vertex's entry in the position-only stream. */
+    inline PackedPosition GetPosition(const PackedVertex& Packed)
+    {
+        return { Packed.PositionXY, Packed.PositionZ };
+    }
+}
@@ -24,14 +24,25 @@ enum class CommandType
     eCmdTransfer
 };
 
+/*! \brief A point on a queue's timeline, reached once the queue has finished every submission up to and including (Value). */
+struct SyncPoint
+{
+    CommandType Queue = CommandType::eCmdGraphics;
+    uint64_t Value = 0; //! > 0 is reached as soon as the timeline exists.
+};
+
 struct PipeLocation
 {
     VkAccessFlagBits Access;
     VkPipelineStageFlagBits Stage;
 };
 
+struct MemoryHeap; // defined in MemoryHeap.hpp
+
 namespace Resources
 {
+    struct Buffer;
+
     class Fence
     {
         public:
@@ -57,12 +68,19 @@ namespace Resources
     class Allocation
     {
     public:
-        uint32_t Size;
-        uint32_t Offset;
+        VkDeviceSize Size = 0;
+        VkDeviceSize Offset = 0;
         
-        bool bHostVisible;
+        bool bHostVisible = false;
+        bool bHostCoherent = false; //! > Host writes are visible without FlushMapped() / InvalidateMapped()
+
+        VkDeviceMemory* pMemory = nullptr;
 
-        VkDeviceMemory* pMemory;
+        MemoryHeap* pHeap = nullptr; //! > The heap this allocation was sub-allocated from, nullptr if the allocation hasn't been made (or was freed).
+        uint32_t Block = 0; //! > The allocation's handle in the heap's sub-allocator.
+        Buffer* pOwner = nullptr; //! > The buffer bound to this allocation, if it can be moved by Defragment().
+
+        uint64_t LastUse[3] = {}; //! > The timeline value of the last submission to each queue (indexed by CommandType) that used the memory, see MarkUsed().
     };
 
     /*! \brief A wrapper around Vulkan Images.
@@ -76,10 +94,12 @@ namespace Resources
 
         VkImage Img;
         VkImageView View;
-        VkImageLayout Layout;
+        VkImageLayout Layout = VK_IMAGE_LAYOUT_UNDEFINED; //! > The layout the transfer agent last left the image in.
+        uint32_t OwnerFamily = VK_QUEUE_FAMILY_IGNORED; //! > The queue family that owns the (exclusive) image, ignored until its first upload.
 
-        VkFormat Format;
+        VkFormat Format = VK_FORMAT_UNDEFINED;
         VkExtent2D Resolution;
+        VkImageTiling Tiling = VK_IMAGE_TILING_OPTIMAL; //! > Linear and optimal images are kept bufferImageGranularity apart in memory.
 
         Allocation Alloc;
     };
@@ -100,13 +120,21 @@ namespace Resources
 
         void* pData = nullptr;
 
+        /*! \brief Typed view of the mapped buffer (the buffer must be mapped).
+            @param Offset The byte offset into the buffer the view starts at.
+        */
+        template<typename T> T* As(size_t Offset = 0) { return (T*)(((uint8_t*)pData)+Offset); }
+
+        VkDeviceSize Size = 0; //! > The size the buffer was created with.
+        VkBufferUsageFlags Usage = 0; //! > The usage flags the buffer was created with.
+
     private:
         std::string Name;
-        VkBuffer Buff;
+        VkBuffer Buff = VK_NULL_HANDLE;
     };
 
     /*! \brief A wrapper around command buffers.
-    *   contains the command buffer, a fence, and a pointer to the command pool. Also contains methods for recording.
+    *   contains the command buffer, the point its last submission signals, and a pointer to the command pool. Also contains methods for recording.
     */
     class CommandBuffer
     {
@@ -114,11 +142,20 @@ namespace Resources
         CommandBuffer();
         ~CommandBuffer();
 
-        void Bake(VkCommandPool* pCmdPool);
+        void Bake(VkCommandPool* pCmdPool, VkCommandBufferLevel Level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+        /*! \brief Reset just this buffer, only allowed when its pool was created with VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT. */
         void Reset();
-        void Start();
+
+        /*! \brief Begin recording.
+            @param pInheritance Required for secondary command buffers, the buffer continues a render pass when (pInheritance->renderPass) is set.
+        */
+        void Start(const VkCommandBufferInheritanceInfo* pInheritance = nullptr);
         void Stop();
 
+        /*! \brief Block until the buffer's last submission has completed, after which it can be reset. */
+        void Wait();
+
         operator VkCommandBuffer()
         {
             return cmdBuffer;
@@ -128,7 +165,7 @@ namespace Resources
             return &cmdBuffer;
         }
 
-        Fence* cmdFence;
+        SyncPoint LastSubmit; //! > Set by CommandPool::Submit().
 
     private:
         VkCommandPool* pPool;
@@ -168,6 +205,7 @@ namespace Resources
     class DescriptorSet
     {
     public:
+        DescriptorSet();
         ~DescriptorSet();
 
         VkDescriptorSet DescSet = VK_NULL_HANDLE; //! > The vulkan api handle to the allocated descriptor set.
@@ -176,7 +214,13 @@ namespace Resources
         //! \brief Wraps descriptor writes using a custom struct.
         void Update(DescUpdate* pUpdateInfos, size_t Count);
 
+        //! \brief Re-write every descriptor (in every descriptor set) that points at (pBuffer), used after the buffer's handle changes.
+        static void Refresh(Buffer* pBuffer);
+
         VkDescriptorPool* pPool = nullptr;
+
+    private:
+        std::vector<DescUpdate> Writes; //! > The most recent write to each binding/array element, kept so they can be replayed by Refresh().
     };
 
     // Wraps FrameBuffer Information and creation
@@ -196,7 +240,7 @@ namespace Resources
         std::vector<VkImageCreateInfo> AttachmentInfos;
 
         std::vector<VkImage> Attachments;
-        std::vector<VkDeviceMemory> AttachmentAllocations;
+        std::vector<Allocation> AttachmentAllocations;
         std::vector<VkImageView> AttachmentViews;
         std::vector<VkImageLayout> AttachmentLayouts;
     };
@@ -229,13 +273,59 @@ namespace Allocators
     public:
         ~CommandPool();
 
-        void Bake(CommandType cmdType);
-        void Submit(Resources::CommandBuffer* pCmdBuffer, uint32_t SignalSemCount = 0, VkSemaphore* SignalSemaphores = nullptr, uint32_t WaitSemCount = 0, VkSemaphore* WaitSemaphores = nullptr, VkPipelineStageFlagBits WaitStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
-        Resources::CommandBuffer* CreateBuffer();
+        /*! \brief Create the pool for (cmdType)'s queue family.
+            @param Flags Defaults to letting buffers be reset one by one, pools that are only ever reset as a whole don't need that.
+        */
+        void Bake(CommandType cmdType, VkCommandPoolCreateFlags Flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+        /*! \brief Submit a command buffer to the pool's queue. The submission also signals the queue's timeline with its next value.
+        *   Submissions are batched, the driver only gets them on the next FlushSubmits() (or a WaitSync() that needs them).
+            @param WaitStages The stage each of the (WaitSemCount) wait semaphores blocks, all top of pipe if null.
+            @param SignalValues Values to signal timeline semaphores in (SignalSemaphores) with (entries for binary semaphores are ignored), null if none are timelines.
+            @param WaitValues Values to wait for on timeline semaphores in (WaitSemaphores) (entries for binary semaphores are ignored), null if none are timelines.
+            @return The point on the queue's timeline the submission signals (also stored in the command buffer's LastSubmit).
+        */
+        SyncPoint Submit(Resources::CommandBuffer* pCmdBuffer, uint32_t SignalSemCount = 0, VkSemaphore* SignalSemaphores = nullptr, uint32_t WaitSemCount = 0, VkSemaphore* WaitSemaphores = nullptr, const VkPipelineStageFlags* WaitStages = nullptr, const uint64_t* SignalValues = nullptr, const uint64_t* WaitValues = nullptr);
+        Resources::CommandBuffer* CreateBuffer(VkCommandBufferLevel Level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+        /*! \brief Reset every command buffer allocated from the pool at once (none of them may be pending). */
+        void Reset();
 
         VkCommandPool cmdPool;
         CommandType PoolType;
     };
+
+    /*! \brief Hands out transient command buffers for one queue type from a free list per frame slot, instead of allocating a buffer for every recording.
+    *   Buffers are never reset one by one, BeginFrame() resets the slot's whole pool and hands its buffers out again.
+    *   Like a command pool it's externally synchronized, so threads that record in parallel need a recycler each.
+    */
+    class CommandRecycler
+    {
+    public:
+        ~CommandRecycler();
+
+        void Bake(CommandType cmdType, uint32_t FrameCount);
+
+        /*! \brief Reset slot (FrameIdx)'s pool and hand out its buffers from the start of its free list.
+            Waits for the primary buffers the slot handed out last time, the secondary ones must only have been executed by work that has completed too.
+        */
+        void BeginFrame(uint32_t FrameIdx);
+
+        /*! \brief The current slot's next free buffer, a new one is only allocated when every buffer of (Level) is in use. Valid until the slot's next BeginFrame(). */
+        Resources::CommandBuffer* Acquire(VkCommandBufferLevel Level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+        CommandType PoolType;
+
+    private:
+        struct FramePool
+        {
+            CommandPool Pool;
+            std::vector<Resources::CommandBuffer*> Buffers[2]; //! > Indexed by VkCommandBufferLevel.
+            uint32_t Used[2] = {}; //! > Buffers of each level handed out since the last reset.
+        };
+
+        std::vector<FramePool*> Frames;
+        uint32_t CurrentFrame = 0;
+    };
 }
 
 struct Subpass
@@ -270,7 +360,10 @@ public:
 
     void Bake();
 
-    void Begin(Resources::CommandBuffer& cmdBuffer, Resources::FrameBuffer& FrameBuffer);
+    /*! \brief Begin the render pass.
+        @param Contents Whether the first subpass is recorded inline or executed from secondary command buffers.
+    */
+    void Begin(Resources::CommandBuffer& cmdBuffer, Resources::FrameBuffer& FrameBuffer, VkSubpassContents Contents = VK_SUBPASS_CONTENTS_INLINE);
     void End(Resources::CommandBuffer& cmdBuffer);
     void NextPass();
 
@@ -291,7 +384,7 @@ struct VertDesc
 class PipelineProfile
 {
 public:
-    PipelineProfile() : Topo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST), MsaaSamples(VK_SAMPLE_COUNT_1_BIT), RenderSize({0, 0}), RenderOffset({0, 0}), DepthRange({0.f, 0.f}), bStencilTesting(true), bDepthTesting(true), DepthCompareOp(VK_COMPARE_OP_LESS)
+    PipelineProfile() : Topo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST), MsaaSamples(VK_SAMPLE_COUNT_1_BIT), RenderSize({0, 0}), RenderOffset({0, 0}), DepthRange({0.f, 0.f}), bStencilTesting(true), bDepthTesting(true), DepthCompareOp(VK_COMPARE_OP_LESS), bPositionStream(false)
     {}
     
     VkPrimitiveTopology Topo;
@@ -306,6 +399,8 @@ public:
     bool bDepthTesting;
     VkCompareOp DepthCompareOp;
 
+    bool bPositionStream; //! > Draw from the renderer's position-only vertex stream instead of the full vertices (depth prepass, shadow and occlusion passes). The attributes have to describe the position stream.
+
     void AddBinding(uint32_t Binding, size_t Stride, VkVertexInputRate InRate)
     {
         VkVertexInputBindingDescription tmp{};
@@ -327,6 +422,13 @@ public:
         Attributes.push_back(tmp);
     }
 
+    /*! \brief Drop every vertex binding and attribute, so a copied profile can describe another vertex layout. */
+    void ClearVertexInput()
+    {
+        Bindings.clear();
+        Attributes.clear();
+    }
+
     VkPipelineMultisampleStateCreateInfo* GetMsaa();
     VkPipelineViewportStateCreateInfo* GetViewport();
     VkPipelineDepthStencilStateCreateInfo* GetDepthStencil();
@@ -399,6 +501,19 @@ class ComputePipeline
         std::vector<VkDescriptorSetLayout> Descriptors;
 };
 
+/*! \brief A submission handed to CommandPool::Submit() but not to the driver yet, one entry of a batched vkQueueSubmit. */
+struct PendingSubmit
+{
+    VkCommandBuffer CmdBuffer;
+
+    std::vector<VkSemaphore> WaitSemaphores;
+    std::vector<VkPipelineStageFlags> WaitStages;
+    std::vector<uint64_t> WaitValues; //! > Ignored for binary semaphores.
+
+    std::vector<VkSemaphore> SignalSemaphores; //! > Always ends with the queue's timeline.
+    std::vector<uint64_t> SignalValues;
+};
+
 struct Context
 {
     VkInstance Instance;
@@ -412,8 +527,13 @@ struct Context
 
     VkDevice Device;
 
-    uint32_t Local;
-    uint32_t Host;
+    VkPhysicalDeviceMemoryProperties MemProps; //! > The device's memory types and heaps.
+    bool bMemoryBudget = false; //! > VK_EXT_memory_budget is enabled.
+
+    VkDeviceSize BufferImageGranularity; //! > Granularity at which linear and non-linear resources must be separated in a VkDeviceMemory.
+    VkDeviceSize NonCoherentAtomSize; //! > Alignment of flushed/invalidated ranges of non-coherent memory.
+    VkDeviceSize MinUniformAlignment; //! > Alignment of uniform buffer descriptor offsets.
+    VkDeviceSize MinStorageAlignment; //! > Alignment of storage buffer descriptor offsets.
 
     uint32_t GraphicsFamily;
     VkQueue GraphicsQueue;
@@ -423,6 +543,19 @@ struct Context
 
     uint32_t TransferFamily;
     VkQueue TransferQueue;
+
+    uint32_t QueueFamilies[3]; //! > The distinct families among the graphics, compute and transfer families.
+    uint32_t QueueFamilyCount;
+
+    /* Queue timelines, indexed by CommandType. Every submission to a queue signals its timeline with the next value. */
+        VkSemaphore Timelines[3];
+        uint64_t SubmittedValues[3]; //! > The value the most recent submission to each queue signals.
+        uint64_t CompletedValues[3]; //! > The highest value each timeline was last seen at (only ever grows, so it can be checked without asking the driver).
+
+    /* Submission batches, see FlushSubmits() */
+        std::vector<PendingSubmit> PendingSubmits[3]; //! > Submissions to each queue that haven't been handed to the driver, in submission order.
+        std::vector<CommandType> PendingQueues; //! > Queues with pending submissions, in the order they were first submitted to.
+        uint64_t FlushedValues[3]; //! > The value the most recent submission handed to the driver signals.
 };
 
 struct Window
@@ -0,0 +1,204 @@
+#include "CopyList.hpp"
+
+#include <algorithm>
+#include <functional>
+
+void BufferCopyList::Add(Resources::Buffer* pDst, VkDeviceSize SrcOffset, VkDeviceSize DstOffset, VkDeviceSize Size)
+{
+    VkBufferCopy Copy;
+    Copy.srcOffset = SrcOffset;
+    Copy.dstOffset = DstOffset;
+    Copy.size = Size;
+
+    LastCopy[pDst] = (uint32_t)Copies.size();
+
+    Copies.push_back(Copy);
+    Destinations.push_back(pDst);
+}
+
+bool BufferCopyList::FindInLast(Resources::Buffer* pDst, VkDeviceSize DstOffset, VkDeviceSize Size, VkDeviceSize& SrcOffset) const
+{
+    std::unordered_map<Resources::Buffer*, uint32_t>::const_iterator Last = LastCopy.find(pDst);
+
+    if(Last == LastCopy.end())
+    {
+        return false;
+    }
+
+    const VkBufferCopy& Prev = Copies[Last->second];
+
+    if(DstOffset < Prev.dstOffset || DstOffset+Size > Prev.dstOffset+Prev.size)
+    {
+        return false;
+    }
+
+    SrcOffset = Prev.srcOffset + (DstOffset - Prev.dstOffset);
+
+    return true;
+}
+
+void BufferCopyList::Resolve()
+{
+    Groups.clear();
+    Regions.clear();
+
+    // one sort groups the copies by destination and orders each group by offset.
+    CopyOrder.resize(Copies.size());
+
+    for(uint32_t i = 0; i < CopyOrder.size(); i++)
+    {
+        CopyOrder[i] = i;
+    }
+
+    std::sort(CopyOrder.begin(), CopyOrder.end(), [this](uint32_t A, uint32_t B)
+    {
+        if(Destinations[A] != Destinations[B]) return std::less<Resources::Buffer*>()(Destinations[A], Destinations[B]);
+        if(Copies[A].dstOffset != Copies[B].dstOffset) return Copies[A].dstOffset < Copies[B].dstOffset;
+        return A < B;
+    });
+
+    // the active copy queued last wins, so the top of the heap is always the newest copy covering the sweep position.
+    auto Older = [](uint32_t A, uint32_t B) { return A < B; };
+
+    for(uint32_t GroupStart = 0; GroupStart < CopyOrder.size();)
+    {
+        Resources::Buffer* pDst = Destinations[CopyOrder[GroupStart]];
+
+        uint32_t GroupEnd = GroupStart+1;
+
+        while(GroupEnd < CopyOrder.size() && Destinations[CopyOrder[GroupEnd]] == pDst)
+        {
+            GroupEnd++;
+        }
+
+        /* Regions of one vkCmdCopyBuffer must not overlap, and the last write to a byte has to win.
+           Sweep the group by offset, every byte is copied from the newest copy covering it, so overlapping copies are clipped instead of needing barriers between them. */
+        uint32_t FirstRegion = (uint32_t)Regions.size();
+        CopyHeap.clear();
+
+        uint32_t Next = GroupStart;
+        VkDeviceSize Pos = Copies[CopyOrder[GroupStart]].dstOffset;
+
+        while(Next < GroupEnd || CopyHeap.size() != 0)
+        {
+            if(CopyHeap.size() == 0)
+            {
+                Pos = std::max(Pos, Copies[CopyOrder[Next]].dstOffset);
+            }
+
+            for(; Next < GroupEnd && Copies[CopyOrder[Next]].dstOffset <= Pos; Next++)
+            {
+                CopyHeap.push_back(CopyOrder[Next]);
+                std::push_heap(CopyHeap.begin(), CopyHeap.end(), Older);
+            }
+
+            // copies that ended are only dropped once they reach the top, the ones below it don't matter until then.
+            while(CopyHeap.size() != 0 && Copies[CopyHeap.front()].dstOffset + Copies[CopyHeap.front()].size <= Pos)
+            {
+                std::pop_heap(CopyHeap.begin(), CopyHeap.end(), Older);
+                CopyHeap.pop_back();
+            }
+
+            if(CopyHeap.size() == 0)
+            {
+                continue;
+            }
+
+            const VkBufferCopy& Top = Copies[CopyHeap.front()];
+
+            // the newest copy covers everything up to its end, or until a copy starts that might be newer.
+            VkDeviceSize End = Top.dstOffset + Top.size;
+
+            if(Next < GroupEnd)
+            {
+                End = std::min(End, Copies[CopyOrder[Next]].dstOffset);
+            }
+
+            VkBufferCopy Region;
+            Region.srcOffset = Top.srcOffset + (Pos - Top.dstOffset);
+            Region.dstOffset = Pos;
+            Region.size = End - Pos;
+
+            // merge regions that are contiguous in both the transit buffer and the destination.
+            if(Regions.size() != FirstRegion && Regions.back().dstOffset+Regions.back().size == Region.dstOffset && Regions.back().srcOffset+Regions.back().size == Region.srcOffset)
+            {
+                Regions.back().size += Region.size;
+            }
+            else
+            {
+                Regions.push_back(Region);
+            }
+
+            Pos = End;
+        }
+
+        if(Regions.size() != FirstRegion)
+        {
+            Groups.push_back({pDst, FirstRegion, (uint32_t)Regions.size() - FirstRegion});
+        }
+
+        GroupStart = GroupEnd;
+    }
+}
+
+void BufferCopyList::Clear()
+{
+    Copies.clear();
+    Destinations.clear();
+    LastCopy.clear();
+    Groups.clear();
+    Regions.clear();
+}
+
+bool SplitImageUpload(VkDeviceSize TexelSize, VkExtent3D Extent, VkOffset3D Offset, VkDeviceSize MaxChunkSize, std::vector<ImageChunk>& Chunks)
+{
+    Chunks.clear();
+
+    Extent.depth = std::max(Extent.depth, 1u);
+
+    // images are chunked by whole rows (or whole slices for 3d images), so every chunk is a box of its own.
+    VkDeviceSize RowSize = TexelSize*Extent.width;
+    VkDeviceSize SliceSize = RowSize*Extent.height;
+
+    bool bSlices = Extent.depth > 1;
+    VkDeviceSize LineSize = bSlices ? SliceSize : RowSize;
+    uint32_t LineCount = bSlices ? Extent.depth : Extent.height;
+
+    if(LineSize > MaxChunkSize)
+    {
+        return false;
+    }
+
+    if(LineSize == 0)
+    {
+        return true;
+    }
+
+    uint32_t LinesPerChunk = (uint32_t)(MaxChunkSize / LineSize);
+
+    for(uint32_t Line = 0; Line < LineCount; Line += LinesPerChunk)
+    {
+        uint32_t ChunkLines = std::min(LineCount - Line, LinesPerChunk);
+
+        ImageChunk Chunk;
+        Chunk.SrcOffset = Line*LineSize;
+        Chunk.Size = ChunkLines*LineSize;
+        Chunk.Offset = Offset;
+        Chunk.Extent = Extent;
+
+        if(bSlices)
+        {
+            Chunk.Extent.depth = ChunkLines;
+            Chunk.Offset.z += Line;
+        }
+        else
+        {
+            Chunk.Extent.height = ChunkLines;
+            Chunk.Offset.y += Line;
+        }
+
+        Chunks.push_back(Chunk);
+    }
+
+    return true;
+}
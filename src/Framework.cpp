@@ -1,11 +1,17 @@
 #include "Framework.hpp"
+#include "HeapAllocator.hpp"
+#include "MemoryHeap.hpp"
 
 #include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <fstream>
+#include <numeric>
 #include <stdexcept>
 #include <string>
 
+#include "tgltf/json.hpp"
+
 #include "OpenImageIO/imageio.h"
 
 Window* gWindow; // The Framework's global window state.
@@ -14,52 +20,46 @@ Context* gContext; // The framework's global context.
 
 TransferAgent* gTransferAgent;
 
-/*! \brief A heap of application memory.*/
-struct MemoryHeap
-{
-    MemoryHeap() : AllocTail(0), Memory(VK_NULL_HANDLE), pMapped(nullptr) {}
-    ~MemoryHeap() {}
-
-    void Destroy() { vkFreeMemory(gContext->Device, Memory, nullptr); }
-
-    size_t Size; // the size of the memory heap
-    size_t Available; // the amount of available memory in bytes
+JobSystem* gJobSystem;
 
-    uint32_t AllocTail; // The allocation "tail" (First byte of unallocated memory)
-
-    VkDeviceMemory Memory; // the memory heap's memory handle
-    void* pMapped; // pointer to mapped host visible memory
-};
+/*! \brief Give a heap's memory back to the driver and delete the heap. */
+static void DestroyHeap(MemoryHeap* pHeap)
+{
+    vkFreeMemory(gContext->Device, pHeap->Memory, nullptr);
+    delete pHeap;
+}
 
 /*! \brief All the application's memory */
 struct Memory
 {
 public:
-    Memory()
-    {
-        HostHeaps = {};
-        LocalHeaps = {};
-    }
+    Memory() {}
 
     ~Memory()
     {
-        for(auto Mem : HostHeaps)
+        for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
         {
-            Mem.Destroy();
-        }
-        
-        HostHeaps.clear();
+            for(MemoryHeap* pMem : Heaps[i])
+            {
+                DestroyHeap(pMem);
+            }
 
-        for(auto Mem : LocalHeaps)
-        {
-            Mem.Destroy();
+            Heaps[i].clear();
         }
-        
-        LocalHeaps.clear();
     }
     
-    std::vector<MemoryHeap> HostHeaps; // host visible memory heaps
-    std::vector<MemoryHeap> LocalHeaps; // device local memory heaps
+    // Heaps are stored by pointer so allocations can keep a pointer to their heap (and its VkDeviceMemory) while the vectors grow.
+    std::vector<MemoryHeap*> Heaps[VK_MAX_MEMORY_TYPES]; // memory heaps, by memory type index
+
+    struct RetiredBuffer
+    {
+        VkBuffer Buffer;
+        Resources::Allocation Alloc; // also records the move out of the buffer (see MarkUsed())
+    };
+
+    std::vector<RetiredBuffer> RetiredBuffers; // buffers Defragment() moved away from, released once every queue is done with them
+
+    DefragStats Defrag; // what Defragment() has done so far
 }* gApplicationMemory;
 
 bool InitWrapperFW(uint32_t Width, uint32_t Height)
@@ -102,9 +102,17 @@ bool InitWrapperFW(uint32_t Width, uint32_t Height)
     // validation layers to enable for the vulkan instance
     std::vector<const char*> Layers = { "VK_LAYER_KHRONOS_validation"/*, "VK_LAYER_LUNARG_crash_diagnostic"*/};  // TODO use a runtime flag to set a define which will set the vulkan layers and extensions to run.
 
+    // application info (1.1 for core vkGet*MemoryRequirements2 and dedicated allocations, 1.2 for timeline semaphores)
+    VkApplicationInfo AppInfo{};
+    AppInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    AppInfo.pApplicationName = "Framework Renderer";
+    AppInfo.pEngineName = "Framework Renderer";
+    AppInfo.apiVersion = VK_API_VERSION_1_2;
+
     // instance creation info
     VkInstanceCreateInfo InstCI{};
     InstCI.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    InstCI.pApplicationInfo = &AppInfo;
     #ifdef __APPLE__
         InstCI.flags = VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
     #endif
@@ -143,6 +151,14 @@ bool InitWrapperFW(uint32_t Width, uint32_t Height)
 
     if(gContext->PhysDevice == VK_NULL_HANDLE) { gContext->PhysDevice = PhysDevices[0]; }
 
+    VkPhysicalDeviceProperties PhysDevProps;
+    vkGetPhysicalDeviceProperties(gContext->PhysDevice, &PhysDevProps);
+
+    gContext->BufferImageGranularity = PhysDevProps.limits.bufferImageGranularity;
+    gContext->NonCoherentAtomSize = PhysDevProps.limits.nonCoherentAtomSize;
+    gContext->MinUniformAlignment = PhysDevProps.limits.minUniformBufferOffsetAlignment;
+    gContext->MinStorageAlignment = PhysDevProps.limits.minStorageBufferOffsetAlignment;
+
     #ifdef RENDERDOC
         vkGetPhysicalDeviceFeatures(gContext->PhysDevice, &gContext->PhysDeviceFeatures);
     #else
@@ -151,24 +167,8 @@ bool InitWrapperFW(uint32_t Width, uint32_t Height)
         vkGetPhysicalDeviceFeatures2(gContext->PhysDevice, &gContext->PhysDeviceFeatures);
     #endif
 
-    /* retrieve and store local and host memory in globals */
-    VkPhysicalDeviceMemoryProperties MemProps;
-    vkGetPhysicalDeviceMemoryProperties(gContext->PhysDevice, &MemProps);
-
-    gContext->Local = UINT32_MAX;
-    gContext->Host = UINT32_MAX;
-
-    for(uint32_t i = 0; i < MemProps.memoryTypeCount; i++)
-    {
-        if(MemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT && gContext->Local == UINT32_MAX)
-        {
-            gContext->Local = i;
-        }
-        else if(MemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT && gContext->Host == UINT32_MAX)
-        {
-            gContext->Host = i;
-        }
-    }
+    /* retrieve and store the device's memory types, allocations pick from these with FindMemoryType() */
+    vkGetPhysicalDeviceMemoryProperties(gContext->PhysDevice, &gContext->MemProps);
 
     /* retrieve and store queue family information */
     uint32_t FamilyCount;
@@ -264,9 +264,55 @@ bool InitWrapperFW(uint32_t Width, uint32_t Height)
             DevExt.push_back("VK_KHR_portability_subset");
         #endif
 
+        // optional extensions
+        uint32_t DevExtCount;
+        vkEnumerateDeviceExtensionProperties(gContext->PhysDevice, nullptr, &DevExtCount, nullptr);
+        std::vector<VkExtensionProperties> DevExtProps(DevExtCount);
+        vkEnumerateDeviceExtensionProperties(gContext->PhysDevice, nullptr, &DevExtCount, DevExtProps.data());
+
+        for(VkExtensionProperties& Ext : DevExtProps)
+        {
+            if(strcmp(Ext.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+            {
+                DevExt.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+                gContext->bMemoryBudget = true;
+            }
+        }
+
+        // Vulkan 1.2 features
+        VkPhysicalDeviceVulkan12Features Supported12{};
+        Supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+        VkPhysicalDeviceFeatures2 SupportedFeatures{};
+        SupportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        SupportedFeatures.pNext = &Supported12;
+
+        vkGetPhysicalDeviceFeatures2(gContext->PhysDevice, &SupportedFeatures);
+
+        if(Supported12.timelineSemaphore != VK_TRUE)
+        {
+            throw std::runtime_error("Device doesn't support timeline semaphores");
+        }
+
+        if(Supported12.drawIndirectCount != VK_TRUE || SupportedFeatures.features.multiDrawIndirect != VK_TRUE || SupportedFeatures.features.drawIndirectFirstInstance != VK_TRUE)
+        {
+            throw std::runtime_error("Device doesn't support GPU driven indirect draws");
+        }
+
+        VkPhysicalDeviceVulkan12Features Features12{};
+        Features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        Features12.timelineSemaphore = VK_TRUE; // the transfer agent signals a timeline per flush
+        Features12.drawIndirectCount = VK_TRUE; // draw generation writes the number of draws per batch
+
+        VkPhysicalDeviceFeatures Features{};
+        Features.multiDrawIndirect = VK_TRUE; // a batch's draws are read from one indirect buffer range
+        Features.drawIndirectFirstInstance = VK_TRUE; // each draw's firstInstance points at its mesh's range of the visible list
+
         // Device Creation info
         VkDeviceCreateInfo DevCI{};
         DevCI.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        DevCI.pNext = &Features12;
+        DevCI.pEnabledFeatures = &Features;
         DevCI.enabledExtensionCount = (uint32_t)DevExt.size();
         DevCI.ppEnabledExtensionNames = DevExt.data();
         DevCI.queueCreateInfoCount = bTransferFamilyFound ? 3 : 2;
@@ -294,7 +340,18 @@ bool InitWrapperFW(uint32_t Width, uint32_t Height)
 
         gContext->GraphicsFamily = GraphicsFamily;
         gContext->ComputeFamily = ComputeFamily;
-        gContext->TransferFamily = TransferFamily;
+        gContext->TransferFamily = bTransferFamilyFound ? TransferFamily : ComputeFamily; // without a transfer family the transfer queue is the compute family's second queue
+
+        // the distinct families, buffers are shared between them concurrently
+        gContext->QueueFamilyCount = 0;
+
+        for(uint32_t Family : { gContext->GraphicsFamily, gContext->ComputeFamily, gContext->TransferFamily })
+        {
+            if(std::find(gContext->QueueFamilies, gContext->QueueFamilies+gContext->QueueFamilyCount, Family) == gContext->QueueFamilies+gContext->QueueFamilyCount)
+            {
+                gContext->QueueFamilies[gContext->QueueFamilyCount++] = Family;
+            }
+        }
 
     /* Swapchain creation*/
 
@@ -396,11 +453,23 @@ bool InitWrapperFW(uint32_t Width, uint32_t Height)
             gWindow->SwapchainAttachments.push_back(TmpView);
         }
 
+    /* Queue timelines */
+        for(uint32_t i = 0; i < 3; i++)
+        {
+            gContext->Timelines[i] = CreateTimelineSemaphore();
+            gContext->SubmittedValues[i] = 0;
+            gContext->CompletedValues[i] = 0;
+            gContext->FlushedValues[i] = 0;
+        }
+
     Allocators::CommandPool* pTransferAgentPool = new Allocators::CommandPool();
     pTransferAgentPool->Bake(CommandType::eCmdTransfer);
 
     gTransferAgent = new TransferAgent(pTransferAgentPool);
 
+    uint32_t ThreadCount = (JOB_THREAD_COUNT != 0) ? JOB_THREAD_COUNT : std::max(std::thread::hardware_concurrency(), 1u);
+    gJobSystem = new JobSystem(ThreadCount);
+
     return true;
 }
 
@@ -415,61 +484,121 @@ void CloseWrapperFW()
     }
 
     delete gTransferAgent;
+    delete gJobSystem;
+
+    for(Memory::RetiredBuffer& Retired : gApplicationMemory->RetiredBuffers)
+    {
+        vkDestroyBuffer(gContext->Device, Retired.Buffer, nullptr);
+    }
+
+    delete gApplicationMemory;
+    gApplicationMemory = nullptr;
+
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        vkDestroySemaphore(gContext->Device, gContext->Timelines[i], nullptr);
+    }
 
     vkDestroySwapchainKHR(gContext->Device, gWindow->Swapchain, nullptr);
     vkDestroyDevice(gContext->Device, nullptr);
     vkDestroyInstance(gContext->Instance, nullptr);
 
-    delete gApplicationMemory;
     delete gContext;
     delete gWindow;
 }
 
     void TransferAgent::Transfer(void* srcData, size_t srcSize, Resources::Buffer* dstBuff, size_t dstOffset)
     {
-        if(dstBuff->Alloc.bHostVisible)
+        // mapped buffers are written directly, everything else (including device local memory that happens to be host visible) goes through the transit buffer.
+        if(dstBuff->Alloc.bHostVisible && dstBuff->pData != nullptr)
         {
-            if(dstBuff->pData == nullptr) throw std::runtime_error("tried to transfer to a host-visible buffer without calling map() on it first. (The buffer MUST be mapped prior to transfer).");
-           
             uint8_t* pDst = (uint8_t*)dstBuff->pData;
             memcpy(pDst+dstOffset, srcData, srcSize);
 
+            FlushMapped(dstBuff, dstOffset, srcSize);
+
             return;
         }
 
-        VkBufferCopy tmp;
-        tmp.srcOffset = TransitTail;
-        tmp.dstOffset = dstOffset;
-        tmp.size = srcSize;
+        // a write that lands inside the last queued copy to the same buffer overwrites that copy's staged bytes instead of queuing another one.
+        VkDeviceSize InPlace;
+
+        if(BufferCopies.FindInLast(dstBuff, dstOffset, srcSize, InPlace))
+        {
+            memcpy(((uint8_t*)pTransitBuffer->pData)+InPlace, srcData, srcSize);
+            return;
+        }
 
-        BufferCopies.push_back(tmp);
+        // uploads bigger than a frame's worth of staging memory are split into chunks, each staged and copied on its own.
+        for(size_t Done = 0; Done < srcSize; Done += TRANSIT_FRAME_SIZE)
+        {
+            size_t ChunkSize = std::min<size_t>(srcSize - Done, TRANSIT_FRAME_SIZE);
 
-        TransferBuffers.push_back(dstBuff);
+            VkDeviceSize TransitOffset = AllocTransit(ChunkSize, 4);
 
-        uint8_t* pDst = (uint8_t*)pTransitBuffer->pData;
-        memcpy(pDst+TransitTail, srcData, srcSize);
+            BufferCopies.Add(dstBuff, TransitOffset, dstOffset + Done, ChunkSize);
 
-        TransitTail += srcSize;
+            uint8_t* pDst = (uint8_t*)pTransitBuffer->pData;
+            memcpy(pDst+TransitOffset, ((uint8_t*)srcData)+Done, ChunkSize);
+        }
 
         return;
     }
 
     void TransferAgent::Transfer(void* srcData, size_t srcSize, Resources::Image* dstImg, VkExtent3D Extent, VkOffset3D ImgOffset, VkImageSubresourceLayers SubResource, VkImageLayout Layout)
     {
-        VkBufferImageCopy tmp;
-        tmp.bufferOffset = TransitTail;
-        tmp.imageExtent = Extent;
-        tmp.imageOffset = ImgOffset;
-        tmp.imageSubresource = SubResource;
+        Extent.depth = std::max(Extent.depth, 1u);
+
+        // the transfer queue takes images owned by another family without an ownership transfer, which discards their contents. That's only safe when the upload replaces all of it.
+        Context* pCtx = GetContext();
+
+        if(dstImg->OwnerFamily != VK_QUEUE_FAMILY_IGNORED && dstImg->OwnerFamily != pCtx->TransferFamily)
+        {
+            bool bWholeImage = ImgOffset.x == 0 && ImgOffset.y == 0 && ImgOffset.z == 0 && Extent.width == dstImg->Resolution.width && Extent.height == dstImg->Resolution.height && Extent.depth == 1 && SubResource.mipLevel == 0 && SubResource.baseArrayLayer == 0;
+
+            if(!bWholeImage)
+            {
+                throw std::runtime_error("TransferAgent : partial updates of an image owned by another queue family aren't supported, upload the whole image.");
+            }
+        }
 
-        BuffImageCopies.push_back(tmp);
+        VkDeviceSize TexelSize = GetTexelSize(dstImg->Format);
 
-        TransferBuffImages.push_back(dstImg);
-        BufferImageLayouts.push_back(Layout);
+        if(TexelSize == 0)
+        {
+            throw std::runtime_error("TransferAgent : image uploads only support uncompressed color, depth or stencil formats.");
+        }
+
+        if(srcSize < TexelSize*Extent.width*Extent.height*Extent.depth)
+        {
+            throw std::runtime_error("TransferAgent : the source data is smaller than the image region it is uploaded to.");
+        }
+
+        // images are chunked by whole rows (or whole slices for 3d images), so every chunk is a box of its own.
+        if(!SplitImageUpload(TexelSize, Extent, ImgOffset, TRANSIT_FRAME_SIZE, ImageChunks))
+        {
+            throw std::runtime_error("TransferAgent : an image row (or slice) is too large for the transit buffer.");
+        }
 
-        memcpy(((uint8_t*)pTransitBuffer->pData)+TransitTail, srcData, srcSize);
+        pPartialImage = dstImg;
 
-        TransitTail += srcSize;
+        for(ImageChunk& Chunk : ImageChunks)
+        {
+            VkBufferImageCopy tmp{};
+            tmp.bufferOffset = AllocTransit(Chunk.Size, std::lcm<VkDeviceSize>(TexelSize, 4)); // buffer offsets of image copies must be a multiple of 4 and of the texel size
+            tmp.imageExtent = Chunk.Extent;
+            tmp.imageOffset = Chunk.Offset;
+            tmp.imageSubresource = SubResource;
+
+            BuffImageCopies.push_back(tmp);
+
+            TransferBuffImages.push_back(dstImg);
+            BufferImageLayouts.push_back(Layout);
+
+            memcpy(((uint8_t*)pTransitBuffer->pData)+tmp.bufferOffset, ((uint8_t*)srcData)+Chunk.SrcOffset, Chunk.Size);
+        }
+
+        pPartialImage = nullptr;
     }
 
     void TransferAgent::Transfer(Resources::Image* srcImg, Resources::Image* dstImg, VkImageLayout srcLayout, VkImageLayout dstLayout, VkOffset3D srcOffset, VkOffset3D dstOffset, VkImageSubresourceLayers srcSubResource, VkImageSubresourceLayers dstSubResource, VkExtent3D Size)
@@ -487,291 +616,1064 @@ void CloseWrapperFW()
         ImageLayouts.push_back(std::make_pair(srcLayout, dstLayout));
     }
 
+    void TransferAgent::Transfer(VkBuffer srcBuff, VkBuffer dstBuff, VkDeviceSize Size)
+    {
+        VkBufferCopy tmp;
+        tmp.srcOffset = 0;
+        tmp.dstOffset = 0;
+        tmp.size = Size;
+
+        MoveCopies.push_back(tmp);
+        MoveBuffers.push_back(std::make_pair(srcBuff, dstBuff));
+    }
+
     void TransferAgent::Flush()
     {
-        /*
-        if(bFlushing)
+        if(BufferCopies.GetCopyCount() == 0 && BuffImageCopies.size() == 0 && ImageCopies.size() == 0 && MoveCopies.size() == 0)
         {
-            AwaitFlush();
+            return;
         }
 
-        bFlushing = true;
+        // reuse the oldest command buffer, this only blocks if all of them are still executing.
+        Resources::CommandBuffer* pCmdBuff = CmdBuffs[CmdIdx];
+        CmdIdx = (CmdIdx+1) % TRANSFER_CMD_BUFFER_COUNT;
 
-        pWaitThread = new std::thread([this] { FlushImpl(); });
-        */
+        pCmdBuff->Wait();
+        pCmdBuff->Reset();
 
-        FlushImpl();
+        pCmdBuff->Start();
 
-        return;
-    }
+            // moves go first, uploads queued this frame may target the buffers they move into.
+            for(uint32_t i = 0; i < MoveCopies.size(); i++)
+            {
+                vkCmdCopyBuffer(*pCmdBuff, MoveBuffers[i].first, MoveBuffers[i].second, 1, &MoveCopies[i]);
+            }
 
-    void TransferAgent::AwaitFlush()
-    {
-        if(pWaitThread->joinable())
+            if(MoveCopies.size() != 0)
+            {
+                VkMemoryBarrier MoveBarrier{};
+                MoveBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                MoveBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                MoveBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+                vkCmdPipelineBarrier(*pCmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &MoveBarrier, 0, nullptr, 0, nullptr);
+            }
+
+            RecordBufferCopies(pCmdBuff);
+            RecordImageUploads(pCmdBuff);
+
+            for(uint32_t i = 0; i < ImageCopies.size(); i++)
+            {
+                vkCmdCopyImage(*pCmdBuff, TransferImages[i].first->Img, ImageLayouts[i].first, TransferImages[i].second->Img, ImageLayouts[i].second, 1, &ImageCopies[i]);
+            }
+
+        pCmdBuff->Stop();
+
+        VkPipelineStageFlags DependencyStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        uint32_t DependencyCount = (DependencySemaphore != VK_NULL_HANDLE) ? 1 : 0;
+
+        // flushes complete in submission order on the transfer queue, so its timeline covers the command buffers and the transit ring.
+        SyncPoint Point = cmdAllocator->Submit(pCmdBuff, 0, nullptr, DependencyCount, &DependencySemaphore, &DependencyStage, nullptr, &DependencyValue);
+        SubmitValue = Point.Value;
+
+        for(Resources::Buffer* pBuffer : BufferCopies.GetDestinations())
+        {
+            MarkUsed(pBuffer->Alloc, Point);
+        }
+
+        for(Resources::Image* pImage : TransferBuffImages)
         {
-            pWaitThread->join();
+            MarkUsed(pImage->Alloc, Point);
         }
 
-        delete pWaitThread;
-        pWaitThread = nullptr;
+        for(std::pair<Resources::Image*, Resources::Image*>& Images : TransferImages)
+        {
+            MarkUsed(Images.first->Alloc, Point);
+            MarkUsed(Images.second->Alloc, Point);
+        }
+
+        // the transit ranges staged for this flush can be reused once it completes.
+        TransitInFlight.push_back({TransitPending, SubmitValue});
+        TransitPending = 0;
+
+        BufferCopies.Clear();
+        BuffImageCopies.clear();
+        TransferBuffImages.clear();
+        BufferImageLayouts.clear();
+        ImageCopies.clear();
+        TransferImages.clear();
+        ImageLayouts.clear();
+        MoveCopies.clear();
+        MoveBuffers.clear();
+
+        RetireTransit(GetCompletedValue());
 
         return;
     }
 
-    void TransferAgent::FlushImpl()
+    void TransferAgent::RecordBufferCopies(Resources::CommandBuffer* pCmdBuff)
     {
-        if(pCmdBuff == nullptr)
+        if(BufferCopies.GetCopyCount() == 0)
         {
-            pCmdBuff = cmdAllocator->CreateBuffer();
+            return;
         }
 
-        if(BufferCopies.size() != 0 || BuffImageCopies.size() != 0 || ImageCopies.size() != 0)
-        {
-            pCmdBuff->Start();
+        BufferCopies.Resolve();
 
-                for(uint32_t i = 0; i < BufferCopies.size(); i++) {
-                    vkCmdCopyBuffer(*pCmdBuff, *pTransitBuffer, *TransferBuffers[i], 1, &BufferCopies[i]);
-                }
-                for(uint32_t i = 0; i < BuffImageCopies.size(); i++)
-                {
-                    vkCmdCopyBufferToImage(*pCmdBuff, *pTransitBuffer, TransferBuffImages[i]->Img, BufferImageLayouts[i], 1, &BuffImageCopies[i]);
-                }
-                for(uint32_t i = 0; i < ImageCopies.size(); i++)
-                {
-                    vkCmdCopyImage(*pCmdBuff, TransferImages[i].first->Img, ImageLayouts[i].first, TransferImages[i].second->Img, ImageLayouts[i].second, 1, &ImageCopies[i]);
-                }
+        const std::vector<VkBufferCopy>& Regions = BufferCopies.GetRegions();
 
-            pCmdBuff->Stop();
+        for(const BufferCopyList::Group& Group : BufferCopies.GetGroups())
+        {
+            vkCmdCopyBuffer(*pCmdBuff, *pTransitBuffer, *Group.pDst, Group.RegionCount, &Regions[Group.FirstRegion]);
+        }
+    }
 
-            cmdAllocator->Submit(pCmdBuff);
+    void TransferAgent::RecordImageUploads(Resources::CommandBuffer* pCmdBuff)
+    {
+        if(BuffImageCopies.size() == 0)
+        {
+            return;
+        }
 
-            pCmdBuff->cmdFence->Wait();
-            pCmdBuff->Reset();
+        Context* pCtx = GetContext();
 
-            BufferCopies.clear();
-            TransferBuffers.clear();
-            BuffImageCopies.clear();
-            TransferBuffImages.clear();
-            BufferImageLayouts.clear();
-            ImageCopies.clear();
-            TransferImages.clear();
-            ImageLayouts.clear();
-        }
+        // the distinct images, the layout each is released in (the last one queued for it wins) and the aspect it's written through.
+        UploadImages.clear();
+        UploadImageSlots.clear();
 
-        TransitTail = 0;
-        bFlushing = false;
-        return;
-    }
+        for(uint32_t i = 0; i < TransferBuffImages.size(); i++)
+        {
+            auto Slot = UploadImageSlots.try_emplace(TransferBuffImages[i], (uint32_t)UploadImages.size());
 
-Context* GetContext()
-{
-    return gContext;
-}
+            if(Slot.second)
+            {
+                UploadImages.push_back({TransferBuffImages[i], BufferImageLayouts[i], BuffImageCopies[i].imageSubresource.aspectMask});
+            }
+            else
+            {
+                UploadImages[Slot.first->second].Layout = BufferImageLayouts[i];
+            }
+        }
 
-Window* GetWindow()
-{
-    return gWindow;
-}
+        VkImageMemoryBarrier Barrier{};
+        Barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        Barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        Barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        Barrier.subresourceRange.baseMipLevel = 0;
+        Barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        Barrier.subresourceRange.baseArrayLayer = 0;
+        Barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 
-TransferAgent* GetTransferAgent()
-{
-    return gTransferAgent;
-}
+        /* move every image to TRANSFER_DST. Only images left here by an earlier flush (partial uploads) are still owned by the transfer queue,
+           anything owned by another family is taken without an ownership transfer (from UNDEFINED). Transfer() only lets whole image uploads through for those, so the discarded contents are all overwritten. */
+        std::vector<VkImageMemoryBarrier> ToTransfer;
 
-VkSemaphore CreateVulkanSemaphore()
-{
-    VkSemaphore Ret;
+        for(UploadImage& Img : UploadImages)
+        {
+            Resources::Image* pImg = Img.pImage;
 
-    VkSemaphoreCreateInfo SemCI{};
-    SemCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            if(pImg->OwnerFamily == pCtx->TransferFamily && pImg->Layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+            {
+                continue;
+            }
 
-    vkCreateSemaphore(GetContext()->Device, &SemCI, nullptr, &Ret);
+            Barrier.image = pImg->Img;
+            Barrier.subresourceRange.aspectMask = Img.AspectMask;
+            Barrier.srcAccessMask = 0;
+            Barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            Barrier.oldLayout = (pImg->OwnerFamily == pCtx->TransferFamily || pImg->OwnerFamily == VK_QUEUE_FAMILY_IGNORED) ? pImg->Layout : VK_IMAGE_LAYOUT_UNDEFINED;
+            Barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 
-    return Ret;
-}
+            ToTransfer.push_back(Barrier);
 
-Resources::Fence* CreateFence(std::string Name)
-{
-    Resources::Fence* pRet = new Resources::Fence(Name);
+            // an acquire that was never recorded is dropped with the image's contents
+            PendingAcquires.erase(std::remove_if(PendingAcquires.begin(), PendingAcquires.end(), [&](VkImageMemoryBarrier& Acquire) { return Acquire.image == pImg->Img; }), PendingAcquires.end());
 
-    VkFenceCreateInfo FenceCI{};
-    FenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            pImg->OwnerFamily = pCtx->TransferFamily;
+            pImg->Layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        }
 
-    if(vkCreateFence(GetContext()->Device, &FenceCI, nullptr, *pRet) != VK_SUCCESS)
-    {
-        throw std::runtime_error("Failed to create fence " + Name);
-    }
+        // the source stage is TRANSFER so the transition is chained after the flush's dependency wait (and earlier flushes), which both happen at the transfer stage.
+        if(ToTransfer.size() != 0)
+        {
+            vkCmdPipelineBarrier(*pCmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)ToTransfer.size(), ToTransfer.data());
+        }
 
-    return pRet;
-}
+        for(uint32_t i = 0; i < BuffImageCopies.size(); i++)
+        {
+            vkCmdCopyBufferToImage(*pCmdBuff, *pTransitBuffer, TransferBuffImages[i]->Img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &BuffImageCopies[i]);
+        }
 
-VkResult AllocBuff(Resources::Buffer& Buffer, VkMemoryRequirements& MemReq, std::vector<MemoryHeap>& MemoryHeaps, uint32_t MemIdx)
-{
-    VkResult Ret = VK_SUCCESS;
-    
-    bool bBound = false;
+        /* release the images to the graphics family. When it's the transfer family as well, a plain layout transition does the job. */
+        bool bSameFamily = pCtx->GraphicsFamily == pCtx->TransferFamily;
+        std::vector<VkImageMemoryBarrier> Releases;
 
-    // bind to existing heap with enough space
-        for(uint32_t i = 0; i < MemoryHeaps.size(); i++)
+        for(UploadImage& Img : UploadImages)
         {
-            MemoryHeap& MemHeap = MemoryHeaps[i];
-            
-            size_t AlignmentOffset = MemReq.alignment - (MemHeap.AllocTail % MemReq.alignment);
-            size_t MemLoc = MemHeap.AllocTail + AlignmentOffset; // align the alloc tail to the alignment requirements of our buffer.
-            size_t Size = MemHeap.Size - MemLoc;
+            Resources::Image* pImg = Img.pImage;
 
-            if(Size >= MemReq.size)
+            if(pImg == pPartialImage)
             {
-                Buffer.Alloc.Offset = (uint32_t)MemLoc;
-                Buffer.Alloc.Size = (uint32_t)MemReq.size;
-                Buffer.Alloc.pMemory = &MemHeap.Memory;
+                continue;
+            }
 
-                MemHeap.AllocTail += MemReq.size + AlignmentOffset;
-                MemHeap.Available -= MemReq.size + AlignmentOffset;
+            Barrier.image = pImg->Img;
+            Barrier.subresourceRange.aspectMask = Img.AspectMask;
+            Barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            Barrier.newLayout = Img.Layout;
+            Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            Barrier.dstAccessMask = 0; // the timeline semaphore makes the writes available to the consumer
+            Barrier.srcQueueFamilyIndex = bSameFamily ? VK_QUEUE_FAMILY_IGNORED : pCtx->TransferFamily;
+            Barrier.dstQueueFamilyIndex = bSameFamily ? VK_QUEUE_FAMILY_IGNORED : pCtx->GraphicsFamily;
 
-                Ret = vkBindBufferMemory(gContext->Device, Buffer, MemHeap.Memory, MemLoc);
+            Releases.push_back(Barrier);
 
-                bBound = true;
-                break;
+            if(!bSameFamily)
+            {
+                // the acquire repeats the release's layouts and families
+                VkImageMemoryBarrier Acquire = Barrier;
+                Acquire.srcAccessMask = 0;
+                Acquire.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+                PendingAcquires.push_back(Acquire);
             }
+
+            pImg->OwnerFamily = pCtx->GraphicsFamily;
+            pImg->Layout = Img.Layout;
         }
-    
-    // if a large enough heap could not be found
-        if(!bBound)
-        {
-            MemoryHeaps.push_back(MemoryHeap());
-            MemoryHeap& MemHeap = MemoryHeaps[MemoryHeaps.size()-1];
-            
-        // bind to new custom sized heap (the required allocation is too big for a standard sized heap)
-            if(MemReq.size > PAGE_SIZE)
+
+        if(Releases.size() != 0)
+        {
+            vkCmdPipelineBarrier(*pCmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)Releases.size(), Releases.data());
+        }
+    }
+
+    void TransferAgent::RecordAcquires(Resources::CommandBuffer* pCmdBuff, uint32_t Family)
+    {
+        std::vector<VkImageMemoryBarrier> Acquires;
+
+        for(uint32_t i = 0; i < PendingAcquires.size();)
+        {
+            if(PendingAcquires[i].dstQueueFamilyIndex == Family)
             {
-                VkMemoryAllocateInfo AllocInf{};
-                AllocInf.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-                AllocInf.memoryTypeIndex = MemIdx;
-                AllocInf.allocationSize = MemReq.size;
-                
-                if(vkAllocateMemory(gContext->Device, &AllocInf, nullptr, &MemHeap.Memory) != VK_SUCCESS)
-                {
-                    throw std::runtime_error("Failed to allocate memory, ran out of space");
-                }
-                
-                MemHeap.Size = MemReq.size;
-                MemHeap.AllocTail = 0;
-                MemHeap.Available = 0;
-
-                Buffer.Alloc.Offset = 0;
-                Buffer.Alloc.Size = (uint32_t)MemReq.size;
-                Buffer.Alloc.pMemory = &MemHeap.Memory;
-
-                Ret = vkBindBufferMemory(gContext->Device, Buffer, MemHeap.Memory, 0);
-                
-                MemHeap.AllocTail += MemReq.size + (MemHeap.AllocTail % MemReq.alignment);
+                Acquires.push_back(PendingAcquires[i]);
+
+                PendingAcquires[i] = PendingAcquires.back();
+                PendingAcquires.pop_back();
             }
-            
-        // bind to new standard sized heap.
             else
             {
-                VkMemoryAllocateInfo AllocInf{};
-                AllocInf.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-                AllocInf.memoryTypeIndex = MemIdx;
-                AllocInf.allocationSize = PAGE_SIZE;
-                
-                if(vkAllocateMemory(gContext->Device, &AllocInf, nullptr, &MemHeap.Memory))
-                {
-                    throw std::runtime_error("Failed to allocate a heap for an allocation");
-                }
-                
-                MemHeap.Size = PAGE_SIZE;
-                MemHeap.AllocTail = 0;
-                MemHeap.Available = AllocInf.allocationSize - MemReq.size;
-                
-                Buffer.Alloc.Offset = 0;
-                Buffer.Alloc.Size = (uint32_t)MemReq.size;
-                Buffer.Alloc.pMemory = &MemHeap.Memory;
-                
-                Ret = vkBindBufferMemory(gContext->Device, Buffer, MemHeap.Memory, 0);
-                
-                MemHeap.AllocTail += MemReq.size + (MemHeap.AllocTail % MemReq.alignment);
-                MemHeap.Available = MemHeap.Size - MemHeap.AllocTail;
+                i++;
             }
         }
 
-    return Ret;
-}
-
-void Allocate(Resources::Buffer& Buffer, bool bVisible)
-{
-    VkResult Err;
-    VkMemoryRequirements MemReq;
-
-    vkGetBufferMemoryRequirements(gContext->Device, Buffer, &MemReq);
+        // ALL_COMMANDS covers whatever stage the consumer waits for the transfer timeline at, so the acquire's layout transition is chained after the release.
+        if(Acquires.size() != 0)
+        {
+            vkCmdPipelineBarrier(*pCmdBuff, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)Acquires.size(), Acquires.data());
+        }
+    }
 
-    Buffer.pData = nullptr;
-    Buffer.Alloc.bHostVisible = bVisible;
+    bool TransferAgent::WritesOutside(Resources::Buffer* pBuffer) const
+    {
+        if(BuffImageCopies.size() != 0 || ImageCopies.size() != 0 || MoveCopies.size() != 0)
+        {
+            return true;
+        }
 
-    if(bVisible)
-        Err = AllocBuff(Buffer, MemReq, gApplicationMemory->HostHeaps, gContext->Host);
-    else
-        Err = AllocBuff(Buffer, MemReq, gApplicationMemory->LocalHeaps, gContext->Local);
+        const std::vector<Resources::Buffer*>& Destinations = BufferCopies.GetDestinations();
 
-    if(Err != VK_SUCCESS)
-        throw std::runtime_error("Failed to bind a buffer.");
+        return std::any_of(Destinations.begin(), Destinations.end(), [pBuffer](Resources::Buffer* pDst) { return pDst != pBuffer; });
+    }
 
-    return;
-}
+    void TransferAgent::AwaitFlush()
+    {
+        WaitSync({cmdAllocator->PoolType, SubmitValue});
 
-void Allocate(Resources::Image& Image, bool bVisible)
-{
-    VkMemoryRequirements MemReq;
+        RetireTransit(SubmitValue);
 
-    Image.Alloc.bHostVisible = bVisible;
+        return;
+    }
 
-    vkGetImageMemoryRequirements(gContext->Device, Image.Img, &MemReq);
+    uint64_t TransferAgent::GetCompletedValue()
+    {
+        return GetQueueCompletedValue(cmdAllocator->PoolType);
+    }
 
-    if(bVisible)
+    VkDeviceSize TransferAgent::AllocTransit(VkDeviceSize Size, VkDeviceSize Alignment)
     {
-        for(uint32_t i = 0; i < gApplicationMemory->HostHeaps.size(); i++)
+        if(Size > TransitSize)
+        {
+            throw std::runtime_error("TransferAgent : tried to stage more than the transit buffer can hold.");
+        }
+
+        while(true)
         {
-            size_t MemLoc = gApplicationMemory->HostHeaps[i].AllocTail + (gApplicationMemory->HostHeaps[i].AllocTail % MemReq.alignment); // align the alloc tail to the alignment requirements of our buffer.
-            size_t Size = gApplicationMemory->HostHeaps[i].Size - MemLoc;
+            VkDeviceSize Offset = ((TransitHead + Alignment - 1) / Alignment) * Alignment; // texel sizes aren't always powers of two
+            VkDeviceSize Skipped = Offset - TransitHead;
+
+            // wrap around, the bytes left at the end of the ring are skipped.
+            if(Offset + Size > TransitSize)
+            {
+                Offset = 0;
+                Skipped = TransitSize - TransitHead;
+            }
+
+            if(TransitUsed + Skipped + Size <= TransitSize)
+            {
+                TransitUsed += Skipped + Size;
+                TransitPending += Skipped + Size;
+                TransitHead = Offset + Size;
+
+                return Offset;
+            }
 
-            if(Size >= MemReq.size)
+            // back-pressure, the ring is full. Submit what is already staged so it can retire, then wait for the gpu to free up space.
+            if(TransitPending != 0)
+            {
+                Flush();
+            }
+            else if(TransitInFlight.size() != 0)
             {
-                Image.Alloc.Offset = (uint32_t)MemLoc;
-                Image.Alloc.Size = (uint32_t)MemReq.size;
-                Image.Alloc.pMemory = &gApplicationMemory->HostHeaps[i].Memory;
+                WaitSync({cmdAllocator->PoolType, TransitInFlight.front().Value});
 
-                vkBindImageMemory(gContext->Device, Image.Img, gApplicationMemory->HostHeaps[i].Memory, MemLoc);
-                
-                gApplicationMemory->HostHeaps[i].AllocTail += MemReq.size + (gApplicationMemory->HostHeaps[i].AllocTail % MemReq.alignment);
+                RetireTransit(TransitInFlight.front().Value);
+            }
+            else
+            {
+                throw std::runtime_error("TransferAgent : the transit ring is full but nothing is using it.");
             }
         }
     }
-    else
+
+    void TransferAgent::RetireTransit(uint64_t Value)
     {
-        for(uint32_t i = 0; i < gApplicationMemory->LocalHeaps.size(); i++)
+        while(TransitInFlight.size() != 0 && TransitInFlight.front().Value <= Value)
         {
-            size_t MemLoc = gApplicationMemory->LocalHeaps[i].AllocTail + (gApplicationMemory->LocalHeaps[i].AllocTail % MemReq.alignment); // align the alloc tail to the alignment requirements of our buffer.
-            size_t Size = gApplicationMemory->LocalHeaps[i].Size - MemLoc;
-
-            if(Size >= MemReq.size)
-            {
-                Image.Alloc.Offset = (uint32_t)MemLoc;
-                Image.Alloc.Size = (uint32_t)MemReq.size;
-                Image.Alloc.pMemory = &gApplicationMemory->LocalHeaps[i].Memory;
-
-                vkBindImageMemory(gContext->Device, Image.Img, gApplicationMemory->LocalHeaps[i].Memory, MemLoc);
+            TransitUsed -= TransitInFlight.front().Bytes;
+            TransitInFlight.pop_front();
+        }
 
-                gApplicationMemory->LocalHeaps[i].AllocTail += MemReq.size + (gApplicationMemory->LocalHeaps[i].AllocTail % MemReq.alignment);
-            }
+        // nothing is in use, start from the front of the ring again so the next uploads don't have to wrap.
+        if(TransitUsed == 0)
+        {
+            TransitHead = 0;
         }
     }
 
-    return;
+Context* GetContext()
+{
+    return gContext;
 }
 
-void Free(Resources::Allocation* pAlloc)
+Window* GetWindow()
 {
+    return gWindow;
+}
+
+TransferAgent* GetTransferAgent()
+{
+    return gTransferAgent;
+}
+
+JobSystem* GetJobSystem()
+{
+    return gJobSystem;
+}
+
+VkSemaphore CreateVulkanSemaphore()
+{
+    VkSemaphore Ret;
+
+    VkSemaphoreCreateInfo SemCI{};
+    SemCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    vkCreateSemaphore(GetContext()->Device, &SemCI, nullptr, &Ret);
+
+    return Ret;
+}
+
+VkSemaphore CreateTimelineSemaphore(uint64_t InitialValue)
+{
+    VkSemaphore Ret;
+
+    VkSemaphoreTypeCreateInfo TimelineCI{};
+    TimelineCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    TimelineCI.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    TimelineCI.initialValue = InitialValue;
+
+    VkSemaphoreCreateInfo SemCI{};
+    SemCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    SemCI.pNext = &TimelineCI;
+
+    if(vkCreateSemaphore(GetContext()->Device, &SemCI, nullptr, &Ret) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create a timeline semaphore");
+    }
+
+    return Ret;
+}
+
+Resources::Fence* CreateFence(std::string Name)
+{
+    Resources::Fence* pRet = new Resources::Fence(Name);
+
+    VkFenceCreateInfo FenceCI{};
+    FenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if(vkCreateFence(GetContext()->Device, &FenceCI, nullptr, *pRet) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create fence " + Name);
+    }
+
+    return pRet;
+}
+
+VkSemaphore GetQueueTimeline(CommandType Queue)
+{
+    return gContext->Timelines[(uint32_t)Queue];
+}
+
+uint64_t GetQueueSubmitValue(CommandType Queue)
+{
+    return gContext->SubmittedValues[(uint32_t)Queue];
+}
+
+uint64_t GetQueueCompletedValue(CommandType Queue)
+{
+    uint32_t QueueIdx = (uint32_t)Queue;
+
+    uint64_t Value = 0;
+    vkGetSemaphoreCounterValue(gContext->Device, gContext->Timelines[QueueIdx], &Value);
+
+    gContext->CompletedValues[QueueIdx] = std::max(gContext->CompletedValues[QueueIdx], Value);
+
+    return gContext->CompletedValues[QueueIdx];
+}
+
+bool IsReached(SyncPoint Point)
+{
+    if(Point.Value <= gContext->CompletedValues[(uint32_t)Point.Queue])
+    {
+        return true;
+    }
+
+    return Point.Value <= GetQueueCompletedValue(Point.Queue);
+}
+
+void WaitSync(SyncPoint Point)
+{
+    if(IsReached(Point))
+    {
+        return;
+    }
+
+    uint32_t QueueIdx = (uint32_t)Point.Queue;
+
+    // the submission may wait on pending submissions to other queues, so everything is flushed.
+    if(Point.Value > gContext->FlushedValues[QueueIdx])
+    {
+        FlushSubmits();
+    }
+
+    VkSemaphoreWaitInfo WaitInf{};
+    WaitInf.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    WaitInf.semaphoreCount = 1;
+    WaitInf.pSemaphores = &gContext->Timelines[QueueIdx];
+    WaitInf.pValues = &Point.Value;
+
+    if(vkWaitSemaphores(gContext->Device, &WaitInf, UINT64_MAX) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to wait for a queue timeline");
+    }
+
+    gContext->CompletedValues[QueueIdx] = std::max(gContext->CompletedValues[QueueIdx], Point.Value);
+}
+
+void FlushSubmits()
+{
+    std::vector<VkSubmitInfo> SubInfs;
+    std::vector<VkTimelineSemaphoreSubmitInfo> TimelineInfs;
+
+    for(CommandType Queue : gContext->PendingQueues)
+    {
+        uint32_t QueueIdx = (uint32_t)Queue;
+        std::vector<PendingSubmit>& Pending = gContext->PendingSubmits[QueueIdx];
+
+        SubInfs.assign(Pending.size(), {});
+        TimelineInfs.assign(Pending.size(), {}); // sized up front, the submit infos point into it
+
+        for(uint32_t i = 0; i < Pending.size(); i++)
+        {
+            PendingSubmit& Sub = Pending[i];
+
+            TimelineInfs[i].sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            TimelineInfs[i].waitSemaphoreValueCount = (uint32_t)Sub.WaitValues.size();
+            TimelineInfs[i].pWaitSemaphoreValues = Sub.WaitValues.data();
+            TimelineInfs[i].signalSemaphoreValueCount = (uint32_t)Sub.SignalValues.size();
+            TimelineInfs[i].pSignalSemaphoreValues = Sub.SignalValues.data();
+
+            SubInfs[i].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            SubInfs[i].pNext = &TimelineInfs[i];
+            SubInfs[i].commandBufferCount = 1;
+            SubInfs[i].pCommandBuffers = &Sub.CmdBuffer;
+            SubInfs[i].waitSemaphoreCount = (uint32_t)Sub.WaitSemaphores.size();
+            SubInfs[i].pWaitSemaphores = Sub.WaitSemaphores.data();
+            SubInfs[i].pWaitDstStageMask = Sub.WaitStages.data();
+            SubInfs[i].signalSemaphoreCount = (uint32_t)Sub.SignalSemaphores.size();
+            SubInfs[i].pSignalSemaphores = Sub.SignalSemaphores.data();
+        }
+
+        VkQueue Queues[] = { gContext->GraphicsQueue, gContext->ComputeQueue, gContext->TransferQueue };
+
+        VkResult Err;
+
+        if((Err = vkQueueSubmit(Queues[QueueIdx], (uint32_t)SubInfs.size(), SubInfs.data(), VK_NULL_HANDLE)) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to submit a command buffer batch with error " + std::to_string(Err));
+        }
+
+        gContext->FlushedValues[QueueIdx] = Pending.back().SignalValues.back();
+        Pending.clear();
+    }
+
+    gContext->PendingQueues.clear();
+}
+
+void MarkUsed(Resources::Allocation& Alloc, SyncPoint Point)
+{
+    uint64_t& LastUse = Alloc.LastUse[(uint32_t)Point.Queue];
+    LastUse = std::max(LastUse, Point.Value);
+}
+
+bool IsIdle(Resources::Allocation& Alloc)
+{
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        if(!IsReached({(CommandType)i, Alloc.LastUse[i]}))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void WaitIdle(Resources::Allocation& Alloc)
+{
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        WaitSync({(CommandType)i, Alloc.LastUse[i]});
+    }
+}
+
+/*! \brief Allocate a new VkDeviceMemory heap.
+    @param MemIdx The memory type to allocate from.
+    @param Size The size of the heap.
+    @param pNext Extension structures for the allocation (i.e. VkMemoryDedicatedAllocateInfo)
+*/
+MemoryHeap* CreateHeap(uint32_t MemIdx, VkDeviceSize Size, const void* pNext = nullptr)
+{
+    MemoryHeap* pHeap = new MemoryHeap();
+
+    VkMemoryAllocateInfo AllocInf{};
+    AllocInf.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    AllocInf.pNext = pNext;
+    AllocInf.memoryTypeIndex = MemIdx;
+    AllocInf.allocationSize = Size;
+
+    if(vkAllocateMemory(gContext->Device, &AllocInf, nullptr, &pHeap->Memory) != VK_SUCCESS)
+    {
+        delete pHeap;
+        throw std::runtime_error("Failed to allocate a heap for an allocation, ran out of space");
+    }
+
+    pHeap->Size = Size;
+    pHeap->MemIdx = MemIdx;
+    pHeap->SubAllocator.Reset(Size);
+
+    // host visible heaps are mapped once, here, and stay mapped until they're freed. (vkFreeMemory implicitly unmaps)
+    if(gContext->MemProps.memoryTypes[MemIdx].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        if(vkMapMemory(gContext->Device, pHeap->Memory, 0, VK_WHOLE_SIZE, 0, &pHeap->pMapped) != VK_SUCCESS)
+        {
+            DestroyHeap(pHeap);
+            throw std::runtime_error("Failed to map a host visible heap");
+        }
+    }
+
+    gApplicationMemory->Heaps[MemIdx].push_back(pHeap);
+
+    return pHeap;
+}
+
+/*! \brief Sub-allocate (MemReq) from the first existing heap of memory type (MemIdx) with a large enough free range.
+    @param Alloc The allocation to fill out.
+    @param MemReq The size and alignment requirements of the allocation.
+    @param MemIdx The memory type to allocate from.
+    @param pSkip A heap not to allocate from (the heap being emptied by Defragment())
+    @return false if none of the heaps could fit the allocation.
+*/
+bool SubAllocate(Resources::Allocation& Alloc, VkMemoryRequirements MemReq, uint32_t MemIdx, MemoryHeap* pSkip = nullptr)
+{
+    MemoryHeap* pHeap;
+    uint64_t Offset;
+    uint32_t Block;
+
+    if(!SubAllocate(gApplicationMemory->Heaps[MemIdx], MemReq, pSkip, pHeap, Offset, Block))
+    {
+        return false;
+    }
+
+    Alloc.Offset = Offset;
+    Alloc.Size = MemReq.size;
+    Alloc.pMemory = &pHeap->Memory;
+    Alloc.pHeap = pHeap;
+    Alloc.Block = Block;
+
+    return true;
+}
+
+/*! \brief Sub-allocate (MemReq) from the first heap of memory type (MemIdx) with a large enough free range, opening a new heap when none of them can fit it.
+    @param Alloc The allocation to fill out.
+    @param MemReq The size and alignment requirements of the allocation.
+    @param MemIdx The memory type to allocate from.
+    @param bLinear Whether the resource is linear (buffers and linear images) or non-linear (optimal tiling images).
+*/
+void AllocFromHeaps(Resources::Allocation& Alloc, VkMemoryRequirements MemReq, uint32_t MemIdx, bool bLinear)
+{
+    // linear and non-linear resources can't share a bufferImageGranularity sized page. Non-linear allocations are padded out to whole pages so linear allocations next to them never end up on the same page.
+        if(!bLinear && gContext->BufferImageGranularity > 1)
+        {
+            VkDeviceSize Granularity = gContext->BufferImageGranularity;
+
+            MemReq.alignment = std::max(MemReq.alignment, Granularity);
+            MemReq.size = (MemReq.size + Granularity - 1) & ~(Granularity - 1);
+        }
+
+    // place in an existing heap with enough space
+        if(SubAllocate(Alloc, MemReq, MemIdx))
+        {
+            return;
+        }
+
+    // if a large enough heap could not be found, open a new one. (allocations bigger than a standard heap get a custom sized heap of their own)
+        MemoryHeap* pHeap = CreateHeap(MemIdx, std::max<VkDeviceSize>(MemReq.size, PAGE_SIZE));
+
+        uint64_t Offset;
+
+        Alloc.Block = pHeap->SubAllocator.Allocate(MemReq.size, MemReq.alignment, Offset);
+        Alloc.Offset = Offset;
+        Alloc.Size = MemReq.size;
+        Alloc.pMemory = &pHeap->Memory;
+        Alloc.pHeap = pHeap;
+}
+
+/*! \brief Allocate memory for a buffer or image (exactly one of (Buffer) and (Image) is set).
+    Resources the driver asks a dedicated allocation for (or that are at least DEDICATED_ALLOC_SIZE bytes) get a VkDeviceMemory of their own, everything else is sub-allocated.
+*/
+void AllocateMemory(Resources::Allocation& Alloc, VkBuffer Buffer, VkImage Image, MemoryUsage Usage, bool bLinear)
+{
+    VkMemoryDedicatedRequirements DedicatedReq{};
+    DedicatedReq.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 MemReq{};
+    MemReq.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    MemReq.pNext = &DedicatedReq;
+
+    if(Buffer != VK_NULL_HANDLE)
+    {
+        VkBufferMemoryRequirementsInfo2 ReqInfo{};
+        ReqInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+        ReqInfo.buffer = Buffer;
+
+        vkGetBufferMemoryRequirements2(gContext->Device, &ReqInfo, &MemReq);
+    }
+    else
+    {
+        VkImageMemoryRequirementsInfo2 ReqInfo{};
+        ReqInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+        ReqInfo.image = Image;
+
+        vkGetImageMemoryRequirements2(gContext->Device, &ReqInfo, &MemReq);
+    }
+
+    VkMemoryPropertyFlags Required, Preferred, Avoided;
+    GetUsageFlags(Usage, Required, Preferred, Avoided);
+
+    uint32_t MemIdx = FindMemoryType(gContext->MemProps, MemReq.memoryRequirements.memoryTypeBits, Required, Preferred, Avoided);
+
+    if(MemIdx == UINT32_MAX)
+    {
+        throw std::runtime_error("Failed to find a memory type that suits the allocation");
+    }
+
+    VkMemoryPropertyFlags TypeFlags = gContext->MemProps.memoryTypes[MemIdx].propertyFlags;
+
+    Alloc.bHostVisible = (TypeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+    Alloc.bHostCoherent = (TypeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+    // flushes and invalidates of non-coherent memory work on whole nonCoherentAtomSize blocks, so keep allocations from sharing a block with their neighbours.
+    if(Alloc.bHostVisible && !Alloc.bHostCoherent)
+    {
+        VkDeviceSize AtomSize = gContext->NonCoherentAtomSize;
+
+        MemReq.memoryRequirements.alignment = std::max(MemReq.memoryRequirements.alignment, AtomSize);
+        MemReq.memoryRequirements.size = (MemReq.memoryRequirements.size + AtomSize - 1) & ~(AtomSize - 1);
+    }
+
+    if(DedicatedReq.requiresDedicatedAllocation || DedicatedReq.prefersDedicatedAllocation || MemReq.memoryRequirements.size >= DEDICATED_ALLOC_SIZE)
+    {
+        VkMemoryDedicatedAllocateInfo DedicatedInfo{};
+        DedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+        DedicatedInfo.buffer = Buffer;
+        DedicatedInfo.image = Image;
+
+        MemoryHeap* pHeap = CreateHeap(MemIdx, MemReq.memoryRequirements.size, &DedicatedInfo);
+        pHeap->bDedicated = true;
+
+        uint64_t Offset;
+
+        Alloc.Block = pHeap->SubAllocator.Allocate(MemReq.memoryRequirements.size, 1, Offset);
+        Alloc.Offset = Offset;
+        Alloc.Size = MemReq.memoryRequirements.size;
+        Alloc.pMemory = &pHeap->Memory;
+        Alloc.pHeap = pHeap;
+
+        return;
+    }
+
+    AllocFromHeaps(Alloc, MemReq.memoryRequirements, MemIdx, bLinear);
+}
+
+void Allocate(Resources::Buffer& Buffer, MemoryUsage Usage)
+{
+    Buffer.pData = nullptr;
+
+    AllocateMemory(Buffer.Alloc, Buffer, VK_NULL_HANDLE, Usage, true);
+
+    if(vkBindBufferMemory(gContext->Device, Buffer, *Buffer.Alloc.pMemory, Buffer.Alloc.Offset) != VK_SUCCESS)
+        throw std::runtime_error("Failed to bind a buffer.");
+
+    Buffer.Alloc.pOwner = &Buffer;
+    Buffer.Alloc.pHeap->Buffers.push_back(&Buffer);
+
+    return;
+}
+
+void Allocate(Resources::Buffer& Buffer, bool bVisible)
+{
+    Allocate(Buffer, bVisible ? MemoryUsage::eCpuToGpu : MemoryUsage::eGpuOnly);
+}
+
+void Allocate(VkImage Image, Resources::Allocation& Alloc, MemoryUsage Usage, VkImageTiling Tiling)
+{
+    AllocateMemory(Alloc, VK_NULL_HANDLE, Image, Usage, Tiling == VK_IMAGE_TILING_LINEAR);
+
+    if(vkBindImageMemory(gContext->Device, Image, *Alloc.pMemory, Alloc.Offset) != VK_SUCCESS)
+        throw std::runtime_error("Failed to bind an image.");
+
+    return;
+}
+
+void Allocate(Resources::Image& Image, MemoryUsage Usage)
+{
+    Allocate(Image.Img, Image.Alloc, Usage, Image.Tiling);
+}
+
+void Allocate(Resources::Image& Image, bool bVisible)
+{
+    Allocate(Image, bVisible ? MemoryUsage::eCpuToGpu : MemoryUsage::eGpuOnly);
+}
+
+void Free(Resources::Allocation& Alloc)
+{
+    // nothing to free, or the framework (and all of its memory) has already been closed.
+    if(Alloc.pHeap == nullptr || gApplicationMemory == nullptr)
+    {
+        return;
+    }
+
+    MemoryHeap* pHeap = Alloc.pHeap;
+    pHeap->SubAllocator.Free(Alloc.Block);
+
+    if(Alloc.pOwner != nullptr)
+    {
+        auto Owner = std::find(pHeap->Buffers.begin(), pHeap->Buffers.end(), Alloc.pOwner);
+
+        if(Owner != pHeap->Buffers.end())
+        {
+            *Owner = pHeap->Buffers.back();
+            pHeap->Buffers.pop_back();
+        }
+    }
+
+    Alloc.pHeap = nullptr;
+    Alloc.pMemory = nullptr;
+    Alloc.pOwner = nullptr;
+
+    // give empty heaps back to the driver, keeping the last shared heap of each memory type around for the next allocation. (oversized allocations are always dedicated, so every shared heap is a standard PAGE_SIZE heap worth keeping)
+    if(pHeap->SubAllocator.GetAllocationCount() == 0)
+    {
+        std::vector<MemoryHeap*>& Heaps = gApplicationMemory->Heaps[pHeap->MemIdx];
+
+        auto Iter = std::find(Heaps.begin(), Heaps.end(), pHeap);
+
+        // dedicated heaps can't be sub-allocated from, so they don't count towards the shared heap that is kept.
+        uint32_t SharedHeaps = (uint32_t)std::count_if(Heaps.begin(), Heaps.end(), [](MemoryHeap* pOther) { return !pOther->bDedicated; });
+
+        if(Iter != Heaps.end() && (pHeap->bDedicated || SharedHeaps > 1))
+        {
+            Heaps.erase(Iter);
+
+            DestroyHeap(pHeap);
+        }
+    }
+}
+
+bool NeedsDefragment()
+{
+    return gApplicationMemory->RetiredBuffers.size() != 0 || PickDefragSource(gApplicationMemory->Heaps, gContext->MemProps, DEFRAG_MAX_USAGE) != nullptr;
+}
+
+VkDeviceSize Defragment(VkDeviceSize ByteBudget)
+{
+    // release the buffers moved by earlier calls once their copies (and any work still reading them) have completed.
+        std::vector<Memory::RetiredBuffer>& Retired = gApplicationMemory->RetiredBuffers;
+
+        for(uint32_t i = 0; i < Retired.size();)
+        {
+            if(IsIdle(Retired[i].Alloc))
+            {
+                vkDestroyBuffer(gContext->Device, Retired[i].Buffer, nullptr);
+                Free(Retired[i].Alloc);
+
+                Retired[i] = Retired.back();
+                Retired.pop_back();
+
+                gApplicationMemory->Defrag.ReleasedBuffers++;
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        MemoryHeap* pSource = PickDefragSource(gApplicationMemory->Heaps, gContext->MemProps, DEFRAG_MAX_USAGE);
+
+        if(pSource == nullptr)
+        {
+            return 0;
+        }
+
+    /* move buffers out of the heap until the budget runs out, only into heaps that already exist (compaction should never grow the application's memory). The heap is released by Free() once its last buffer has been retired. */
+        std::vector<DefragMove> Moves = PlanDefragMoves(gApplicationMemory->Heaps[pSource->MemIdx], pSource, ByteBudget, [](Resources::Buffer* pBuffer)
+        {
+            // a buffer created with the same parameters has the same requirements, so the new buffer's are the old one's.
+            VkMemoryRequirements MemReq;
+            vkGetBufferMemoryRequirements(gContext->Device, *pBuffer, &MemReq);
+            return MemReq;
+        });
+
+        VkDeviceSize Moved = 0;
+        size_t FirstRetired = Retired.size();
+
+        for(DefragMove& Move : Moves)
+        {
+            Resources::Buffer* pBuffer = Move.pBuffer;
+
+            VkBuffer NewBuff;
+
+            VkBufferCreateInfo BuffCI{};
+            BuffCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            SetBufferSharing(BuffCI);
+            BuffCI.size = pBuffer->Size;
+            BuffCI.usage = pBuffer->Usage;
+
+            if(vkCreateBuffer(gContext->Device, &BuffCI, nullptr, &NewBuff) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Defragment : Failed to create a buffer to move an allocation to.");
+            }
+
+            Resources::Allocation NewAlloc = pBuffer->Alloc;
+            NewAlloc.Offset = Move.Offset;
+            NewAlloc.Size = Move.Size;
+            NewAlloc.pMemory = &Move.pHeap->Memory;
+            NewAlloc.pHeap = Move.pHeap;
+            NewAlloc.Block = Move.Block;
+
+            if(vkBindBufferMemory(gContext->Device, NewBuff, *NewAlloc.pMemory, NewAlloc.Offset) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Defragment : Failed to bind a moved buffer.");
+            }
+
+            GetTransferAgent()->Transfer(*pBuffer, NewBuff, pBuffer->Size);
+
+            // the old buffer and its memory stay alive until the copy has completed.
+            Resources::Allocation OldAlloc = pBuffer->Alloc;
+            OldAlloc.pOwner = nullptr;
+
+            Retired.push_back({(VkBuffer)*pBuffer, OldAlloc});
+
+            *(VkBuffer*)*pBuffer = NewBuff;
+            pBuffer->Alloc = NewAlloc;
+
+            Resources::DescriptorSet::Refresh(pBuffer);
+
+            Moved += pBuffer->Size;
+        }
+
+    /* submit the moves, both ends of a move are in use until it completes. */
+        if(Moves.size() == 0)
+        {
+            return 0;
+        }
+
+        TransferAgent* pTransfer = GetTransferAgent();
+        pTransfer->Flush();
+
+        SyncPoint MovePoint = { CommandType::eCmdTransfer, pTransfer->GetSubmitValue() };
+
+        for(size_t i = 0; i < Moves.size(); i++)
+        {
+            MarkUsed(Retired[FirstRetired+i].Alloc, MovePoint);
+            MarkUsed(Moves[i].pBuffer->Alloc, MovePoint);
+        }
+
+        gApplicationMemory->Defrag.Passes++;
+        gApplicationMemory->Defrag.MovedBuffers += Moves.size();
+        gApplicationMemory->Defrag.MovedBytes += Moved;
+
+        return Moved;
+}
+
+MemoryStats GetMemoryStats()
+{
+    MemoryStats Ret;
+
+    const VkPhysicalDeviceMemoryProperties& MemProps = gContext->MemProps;
+
+    Ret.DeviceHeaps.resize(MemProps.memoryHeapCount);
+
+    for(uint32_t i = 0; i < MemProps.memoryHeapCount; i++)
+    {
+        Ret.DeviceHeaps[i] = {};
+        Ret.DeviceHeaps[i].Size = MemProps.memoryHeaps[i].size;
+        Ret.DeviceHeaps[i].Flags = MemProps.memoryHeaps[i].flags;
+    }
+
+    for(uint32_t MemIdx = 0; MemIdx < MemProps.memoryTypeCount; MemIdx++)
+    {
+        for(MemoryHeap* pHeap : gApplicationMemory->Heaps[MemIdx])
+        {
+            HeapStats Stats;
+            Stats.MemIdx = MemIdx;
+            Stats.bDedicated = pHeap->bDedicated;
+            Stats.Reserved = pHeap->Size;
+            Stats.Used = pHeap->SubAllocator.GetUsed();
+            Stats.LargestFree = pHeap->SubAllocator.GetLargestFreeBlock();
+            Stats.AllocationCount = pHeap->SubAllocator.GetAllocationCount();
+            Stats.Fragmentation = pHeap->SubAllocator.GetFragmentation();
+
+            Ret.Heaps.push_back(Stats);
+
+            DeviceHeapStats& DevHeap = Ret.DeviceHeaps[MemProps.memoryTypes[MemIdx].heapIndex];
+            DevHeap.Reserved += Stats.Reserved;
+            DevHeap.Used += Stats.Used;
+        }
+    }
+
+    Ret.Defrag = gApplicationMemory->Defrag;
+
+    if(gContext->bMemoryBudget)
+    {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT Budget{};
+        Budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+        VkPhysicalDeviceMemoryProperties2 MemProps2{};
+        MemProps2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        MemProps2.pNext = &Budget;
+
+        vkGetPhysicalDeviceMemoryProperties2(gContext->PhysDevice, &MemProps2);
+
+        for(uint32_t i = 0; i < MemProps.memoryHeapCount; i++)
+        {
+            Ret.DeviceHeaps[i].bHasBudget = true;
+            Ret.DeviceHeaps[i].Budget = Budget.heapBudget[i];
+            Ret.DeviceHeaps[i].Usage = Budget.heapUsage[i];
+        }
+    }
+
+    return Ret;
+}
+
+void DumpMemoryStats(std::string Path)
+{
+    MemoryStats Stats = GetMemoryStats();
+
+    nlohmann::json Json;
+    Json["Heaps"] = nlohmann::json::array();
+    Json["DeviceHeaps"] = nlohmann::json::array();
+
+    for(HeapStats& Heap : Stats.Heaps)
+    {
+        nlohmann::json Entry;
+        Entry["MemoryType"] = Heap.MemIdx;
+        Entry["Dedicated"] = Heap.bDedicated;
+        Entry["Reserved"] = Heap.Reserved;
+        Entry["Used"] = Heap.Used;
+        Entry["LargestFree"] = Heap.LargestFree;
+        Entry["AllocationCount"] = Heap.AllocationCount;
+        Entry["Fragmentation"] = Heap.Fragmentation;
+
+        Json["Heaps"].push_back(Entry);
+    }
+
+    for(DeviceHeapStats& Heap : Stats.DeviceHeaps)
+    {
+        nlohmann::json Entry;
+        Entry["Size"] = Heap.Size;
+        Entry["DeviceLocal"] = (Heap.Flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        Entry["Reserved"] = Heap.Reserved;
+        Entry["Used"] = Heap.Used;
+
+        if(Heap.bHasBudget)
+        {
+            Entry["Budget"] = Heap.Budget;
+            Entry["Usage"] = Heap.Usage;
+        }
+
+        Json["DeviceHeaps"].push_back(Entry);
+    }
+
+    Json["Defragment"]["Passes"] = Stats.Defrag.Passes;
+    Json["Defragment"]["MovedBuffers"] = Stats.Defrag.MovedBuffers;
+    Json["Defragment"]["MovedBytes"] = Stats.Defrag.MovedBytes;
+    Json["Defragment"]["ReleasedBuffers"] = Stats.Defrag.ReleasedBuffers;
+
+    std::ofstream File(Path);
+
+    if(!File.is_open())
+    {
+        std::cout << "Failed to open " << Path << " to dump memory statistics\n";
+        return;
+    }
+
+    File << Json.dump(4);
+}
+
+void SetBufferSharing(VkBufferCreateInfo& BuffCI)
+{
+    if(gContext->QueueFamilyCount > 1)
+    {
+        BuffCI.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        BuffCI.queueFamilyIndexCount = gContext->QueueFamilyCount;
+        BuffCI.pQueueFamilyIndices = gContext->QueueFamilies;
+    }
+    else
+    {
+        BuffCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
 }
 
 VkResult CreateBuffer(Resources::Buffer& Buffer, size_t Size, VkBufferUsageFlags Usage)
@@ -780,12 +1682,15 @@ VkResult CreateBuffer(Resources::Buffer& Buffer, size_t Size, VkBufferUsageFlags
 
     VkBufferCreateInfo BuffCI{};
     BuffCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    BuffCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    SetBufferSharing(BuffCI);
     BuffCI.size = Size;
-    BuffCI.usage = Usage;
+    BuffCI.usage = Usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT; // every buffer can be copied so Defragment() can move it
 
     Ret = vkCreateBuffer(gContext->Device, &BuffCI, nullptr, Buffer);
 
+    Buffer.Size = BuffCI.size;
+    Buffer.Usage = BuffCI.usage;
+
     return Ret;
 }
 
@@ -818,6 +1723,35 @@ VkResult CreateView(VkImageView& View, VkImage& Image, VkFormat Format, VkImageA
 
     return Ret;
 }
+VkDeviceSize GetTexelSize(VkFormat Format)
+{
+    // core formats are numbered in groups of the same size, so ranges cover them.
+    if(Format == VK_FORMAT_R4G4_UNORM_PACK8) return 1;
+    if(Format >= VK_FORMAT_R4G4B4A4_UNORM_PACK16 && Format <= VK_FORMAT_A1R5G5B5_UNORM_PACK16) return 2;
+    if(Format >= VK_FORMAT_R8_UNORM && Format <= VK_FORMAT_R8_SRGB) return 1;
+    if(Format >= VK_FORMAT_R8G8_UNORM && Format <= VK_FORMAT_R8G8_SRGB) return 2;
+    if(Format >= VK_FORMAT_R8G8B8_UNORM && Format <= VK_FORMAT_B8G8R8_SRGB) return 3;
+    if(Format >= VK_FORMAT_R8G8B8A8_UNORM && Format <= VK_FORMAT_A2B10G10R10_SINT_PACK32) return 4;
+    if(Format >= VK_FORMAT_R16_UNORM && Format <= VK_FORMAT_R16_SFLOAT) return 2;
+    if(Format >= VK_FORMAT_R16G16_UNORM && Format <= VK_FORMAT_R16G16_SFLOAT) return 4;
+    if(Format >= VK_FORMAT_R16G16B16_UNORM && Format <= VK_FORMAT_R16G16B16_SFLOAT) return 6;
+    if(Format >= VK_FORMAT_R16G16B16A16_UNORM && Format <= VK_FORMAT_R16G16B16A16_SFLOAT) return 8;
+    if(Format >= VK_FORMAT_R32_UINT && Format <= VK_FORMAT_R32_SFLOAT) return 4;
+    if(Format >= VK_FORMAT_R32G32_UINT && Format <= VK_FORMAT_R32G32_SFLOAT) return 8;
+    if(Format >= VK_FORMAT_R32G32B32_UINT && Format <= VK_FORMAT_R32G32B32_SFLOAT) return 12;
+    if(Format >= VK_FORMAT_R32G32B32A32_UINT && Format <= VK_FORMAT_R32G32B32A32_SFLOAT) return 16;
+    if(Format >= VK_FORMAT_R64_UINT && Format <= VK_FORMAT_R64_SFLOAT) return 8;
+    if(Format >= VK_FORMAT_R64G64_UINT && Format <= VK_FORMAT_R64G64_SFLOAT) return 16;
+    if(Format >= VK_FORMAT_R64G64B64_UINT && Format <= VK_FORMAT_R64G64B64_SFLOAT) return 24;
+    if(Format >= VK_FORMAT_R64G64B64A64_UINT && Format <= VK_FORMAT_R64G64B64A64_SFLOAT) return 32;
+    if(Format == VK_FORMAT_B10G11R11_UFLOAT_PACK32 || Format == VK_FORMAT_E5B9G9R9_UFLOAT_PACK32) return 4;
+    if(Format == VK_FORMAT_D16_UNORM) return 2;
+    if(Format == VK_FORMAT_X8_D24_UNORM_PACK32 || Format == VK_FORMAT_D32_SFLOAT) return 4;
+    if(Format == VK_FORMAT_S8_UINT) return 1;
+
+    return 0;
+}
+
 VkResult CreateImage(Resources::Image& Image, VkFormat Format, VkExtent2D Size, VkImageUsageFlags Usage, VkSampleCountFlagBits SampleCount)
 {
     VkResult Ret;
@@ -836,6 +1770,10 @@ VkResult CreateImage(Resources::Image& Image, VkFormat Format, VkExtent2D Size,
     ImageCI.samples = SampleCount;
 
     Ret = vkCreateImage(gContext->Device, &ImageCI, nullptr, &Image.Img);
+
+    Image.Format = Format;
+    Image.Resolution = Size;
+    Image.Tiling = ImageCI.tiling;
     
     CreateView(Image.View, Image.Img, Format);
 
@@ -855,22 +1793,12 @@ void Map(Resources::Buffer* pBuffer)
         return;
     }
 
-    for(uint32_t i = 0; i < gApplicationMemory->HostHeaps.size(); i++)
+    // the heap is persistently mapped, mapping a buffer just hands out a pointer into it.
+    MemoryHeap* pHeap = pBuffer->Alloc.pHeap;
+
+    if(pHeap != nullptr && pHeap->pMapped != nullptr)
     {
-        if(&(gApplicationMemory->HostHeaps[i].Memory) == pBuffer->Alloc.pMemory) // P.S. We're comparing the ADDRESS of the handle rather than the actual value of the handle, since you can't compare vulkan handles (accurately)
-        {
-            if(gApplicationMemory->HostHeaps[i].pMapped != nullptr)
-            {
-                pBuffer->pData = ((uint8_t*)gApplicationMemory->HostHeaps[i].pMapped)+pBuffer->Alloc.Offset;
-                break;
-            }
-            else
-            {
-                vkMapMemory(gContext->Device, gApplicationMemory->HostHeaps[i].Memory, 0, gApplicationMemory->HostHeaps[i].Size, 0, &gApplicationMemory->HostHeaps[i].pMapped);
-                pBuffer->pData = ((uint8_t*)gApplicationMemory->HostHeaps[i].pMapped)+pBuffer->Alloc.Offset;
-                break;
-            }
-        }
+        pBuffer->pData = ((uint8_t*)pHeap->pMapped)+pBuffer->Alloc.Offset;
     }
     
     if(pBuffer->pData == nullptr)
@@ -883,5 +1811,51 @@ void Map(Resources::Buffer* pBuffer)
 
 void Unmap(Resources::Buffer* pBuffer)
 {
-    vkUnmapMemory(gContext->Device, *pBuffer->Alloc.pMemory);
+    // the heap stays mapped for other buffers (and later calls to Map()), only the buffer's view is dropped.
+    pBuffer->pData = nullptr;
+}
+
+/*! \brief Build the nonCoherentAtomSize aligned range of a buffer's memory covering (Offset, Size) */
+VkMappedMemoryRange GetMappedRange(Resources::Buffer* pBuffer, VkDeviceSize Offset, VkDeviceSize Size)
+{
+    VkDeviceSize AtomSize = gContext->NonCoherentAtomSize;
+
+    if(Size == VK_WHOLE_SIZE)
+    {
+        Size = pBuffer->Alloc.Size - Offset;
+    }
+
+    // the allocation itself is atom aligned (see AllocateMemory), so rounding outwards never leaves it.
+    VkDeviceSize Begin = (pBuffer->Alloc.Offset + Offset) & ~(AtomSize - 1);
+    VkDeviceSize End = (pBuffer->Alloc.Offset + Offset + Size + AtomSize - 1) & ~(AtomSize - 1);
+
+    VkMappedMemoryRange Range{};
+    Range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    Range.memory = *pBuffer->Alloc.pMemory;
+    Range.offset = Begin;
+    Range.size = std::min<VkDeviceSize>(End, pBuffer->Alloc.pHeap->Size) - Begin;
+
+    return Range;
+}
+
+void FlushMapped(Resources::Buffer* pBuffer, VkDeviceSize Offset, VkDeviceSize Size)
+{
+    if(pBuffer->Alloc.bHostCoherent || pBuffer->Alloc.pHeap == nullptr)
+    {
+        return;
+    }
+
+    VkMappedMemoryRange Range = GetMappedRange(pBuffer, Offset, Size);
+    vkFlushMappedMemoryRanges(gContext->Device, 1, &Range);
+}
+
+void InvalidateMapped(Resources::Buffer* pBuffer, VkDeviceSize Offset, VkDeviceSize Size)
+{
+    if(pBuffer->Alloc.bHostCoherent || pBuffer->Alloc.pHeap == nullptr)
+    {
+        return;
+    }
+
+    VkMappedMemoryRange Range = GetMappedRange(pBuffer, Offset, Size);
+    vkInvalidateMappedMemoryRanges(gContext->Device, 1, &Range);
 }
@@ -0,0 +1,365 @@
+#include "HeapAllocator.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+static uint32_t FindLsb(uint64_t Value)
+{
+    #ifdef _MSC_VER
+        unsigned long Idx;
+        _BitScanForward64(&Idx, Value);
+        return (uint32_t)Idx;
+    #else
+        return (uint32_t)__builtin_ctzll(Value);
+    #endif
+}
+
+static uint32_t FindMsb(uint64_t Value)
+{
+    #ifdef _MSC_VER
+        unsigned long Idx;
+        _BitScanReverse64(&Idx, Value);
+        return (uint32_t)Idx;
+    #else
+        return 63 - (uint32_t)__builtin_clzll(Value);
+    #endif
+}
+
+namespace Allocators
+{
+    HeapAllocator::HeapAllocator(uint64_t Size)
+    {
+        Reset(Size);
+    }
+
+    void HeapAllocator::Reset(uint64_t Size)
+    {
+        HeapSize = Size;
+        UsedBytes = 0;
+        AllocCount = 0;
+
+        FlBitmap = 0;
+
+        for(uint32_t Fl = 0; Fl < FlCount; Fl++)
+        {
+            SlBitmap[Fl] = 0;
+
+            for(uint32_t Sl = 0; Sl < SlCount; Sl++)
+            {
+                FreeHeads[Fl][Sl] = InvalidBlock;
+            }
+        }
+
+        Blocks.clear();
+        UnusedNodes.clear();
+
+        if(Size == 0) return;
+
+        // the whole heap starts out as a single free block.
+        uint32_t Node = CreateNode();
+        Blocks[Node].Offset = 0;
+        Blocks[Node].Size = Size;
+
+        InsertFree(Node);
+    }
+
+    uint32_t HeapAllocator::CreateNode()
+    {
+        uint32_t Node;
+
+        if(UnusedNodes.size() != 0)
+        {
+            Node = UnusedNodes.back();
+            UnusedNodes.pop_back();
+        }
+        else
+        {
+            Node = (uint32_t)Blocks.size();
+            Blocks.push_back({});
+        }
+
+        Blocks[Node] = {};
+        Blocks[Node].PrevPhys = InvalidBlock;
+        Blocks[Node].NextPhys = InvalidBlock;
+        Blocks[Node].PrevFree = InvalidBlock;
+        Blocks[Node].NextFree = InvalidBlock;
+
+        return Node;
+    }
+
+    void HeapAllocator::ReleaseNode(uint32_t Node)
+    {
+        // released nodes count as free, so freeing a block again after it was merged into a neighbour is caught by Free().
+        Blocks[Node].bFree = true;
+        UnusedNodes.push_back(Node);
+    }
+
+    void HeapAllocator::Mapping(uint64_t Size, uint32_t& Fl, uint32_t& Sl)
+    {
+        if(Size < SlCount)
+        {
+            // small sizes get a linear list each.
+            Fl = 0;
+            Sl = (uint32_t)Size;
+        }
+        else
+        {
+            uint32_t Msb = FindMsb(Size);
+            Fl = Msb - SlLog2 + 1;
+            Sl = (uint32_t)(Size >> (Msb - SlLog2)) & (SlCount - 1);
+        }
+    }
+
+    void HeapAllocator::InsertFree(uint32_t Node)
+    {
+        uint32_t Fl, Sl;
+        Mapping(Blocks[Node].Size, Fl, Sl);
+
+        Block& Blk = Blocks[Node];
+        Blk.bFree = true;
+        Blk.PrevFree = InvalidBlock;
+        Blk.NextFree = FreeHeads[Fl][Sl];
+
+        if(Blk.NextFree != InvalidBlock)
+        {
+            Blocks[Blk.NextFree].PrevFree = Node;
+        }
+
+        FreeHeads[Fl][Sl] = Node;
+
+        FlBitmap |= (1ull << Fl);
+        SlBitmap[Fl] |= (1u << Sl);
+    }
+
+    void HeapAllocator::RemoveFree(uint32_t Node)
+    {
+        uint32_t Fl, Sl;
+        Mapping(Blocks[Node].Size, Fl, Sl);
+
+        Block& Blk = Blocks[Node];
+
+        if(Blk.PrevFree != InvalidBlock) Blocks[Blk.PrevFree].NextFree = Blk.NextFree;
+        if(Blk.NextFree != InvalidBlock) Blocks[Blk.NextFree].PrevFree = Blk.PrevFree;
+
+        if(FreeHeads[Fl][Sl] == Node)
+        {
+            FreeHeads[Fl][Sl] = Blk.NextFree;
+
+            if(FreeHeads[Fl][Sl] == InvalidBlock)
+            {
+                SlBitmap[Fl] &= ~(1u << Sl);
+
+                if(SlBitmap[Fl] == 0)
+                {
+                    FlBitmap &= ~(1ull << Fl);
+                }
+            }
+        }
+
+        Blk.bFree = false;
+        Blk.PrevFree = InvalidBlock;
+        Blk.NextFree = InvalidBlock;
+    }
+
+    uint32_t HeapAllocator::FindFree(uint64_t Size, uint64_t Alignment)
+    {
+        // over-allocate by the alignment and round the request up to the next list boundary, so that any block in the list we land in can be aligned in place.
+        uint64_t Search = Size + Alignment - 1;
+
+        if(Search >= SlCount)
+        {
+            Search += (1ull << (FindMsb(Search) - SlLog2)) - 1;
+        }
+
+        uint32_t Fl, Sl;
+        Mapping(Search, Fl, Sl);
+
+        if(Fl < FlCount)
+        {
+            uint32_t SlMap = SlBitmap[Fl] & (~0u << Sl);
+
+            if(SlMap == 0)
+            {
+                uint64_t FlMap = (Fl+1 < FlCount) ? FlBitmap & (~0ull << (Fl+1)) : 0;
+
+                if(FlMap != 0)
+                {
+                    Fl = FindLsb(FlMap);
+                    SlMap = SlBitmap[Fl];
+                }
+            }
+
+            if(SlMap != 0)
+            {
+                return FreeHeads[Fl][FindLsb(SlMap)];
+            }
+        }
+
+        // Every list the rounded up search could land in is empty, but the lists from the exact size up might still hold a block that fits (i.e. one that already starts aligned).
+        Mapping(Size, Fl, Sl);
+
+        for(; Fl < FlCount; Fl++, Sl = 0)
+        {
+            uint32_t SlMap = SlBitmap[Fl] & (~0u << Sl);
+
+            for(; SlMap != 0; SlMap &= SlMap - 1)
+            {
+                for(uint32_t Node = FreeHeads[Fl][FindLsb(SlMap)]; Node != InvalidBlock; Node = Blocks[Node].NextFree)
+                {
+                    uint64_t Start = AlignUp(Blocks[Node].Offset, Alignment);
+
+                    if(Start + Size <= Blocks[Node].Offset + Blocks[Node].Size)
+                    {
+                        return Node;
+                    }
+                }
+            }
+        }
+
+        return InvalidBlock;
+    }
+
+    uint32_t HeapAllocator::Allocate(uint64_t Size, uint64_t Alignment, uint64_t& Offset)
+    {
+        if(Alignment == 0) Alignment = 1;
+
+        if((Alignment & (Alignment - 1)) != 0)
+        {
+            throw std::runtime_error("HeapAllocator : allocation alignment must be a power of two.");
+        }
+
+        Size = std::max<uint64_t>(Size, 1);
+
+        uint32_t Node = FindFree(Size, Alignment);
+
+        if(Node == InvalidBlock)
+        {
+            return InvalidBlock;
+        }
+
+        RemoveFree(Node);
+
+        // split off the bytes skipped to align the offset as a free block (its physical predecessor is never free, so there is nothing to merge with)
+        uint64_t AlignedOffset = AlignUp(Blocks[Node].Offset, Alignment);
+        uint64_t Gap = AlignedOffset - Blocks[Node].Offset;
+
+        if(Gap != 0)
+        {
+            uint32_t Front = CreateNode();
+            Block& Blk = Blocks[Node];
+
+            Blocks[Front].Offset = Blk.Offset;
+            Blocks[Front].Size = Gap;
+            Blocks[Front].PrevPhys = Blk.PrevPhys;
+            Blocks[Front].NextPhys = Node;
+
+            if(Blk.PrevPhys != InvalidBlock) Blocks[Blk.PrevPhys].NextPhys = Front;
+
+            Blk.PrevPhys = Front;
+            Blk.Offset = AlignedOffset;
+            Blk.Size -= Gap;
+
+            InsertFree(Front);
+        }
+
+        // split the unused tail off as a free block.
+        if(Blocks[Node].Size - Size >= MinBlockSize)
+        {
+            uint32_t Tail = CreateNode();
+            Block& Blk = Blocks[Node];
+
+            Blocks[Tail].Offset = Blk.Offset + Size;
+            Blocks[Tail].Size = Blk.Size - Size;
+            Blocks[Tail].PrevPhys = Node;
+            Blocks[Tail].NextPhys = Blk.NextPhys;
+
+            if(Blk.NextPhys != InvalidBlock) Blocks[Blk.NextPhys].PrevPhys = Tail;
+
+            Blk.NextPhys = Tail;
+            Blk.Size = Size;
+
+            InsertFree(Tail);
+        }
+
+        UsedBytes += Blocks[Node].Size;
+        AllocCount++;
+
+        Offset = Blocks[Node].Offset;
+        return Node;
+    }
+
+    void HeapAllocator::Free(uint32_t Node)
+    {
+        if(Node >= Blocks.size() || Blocks[Node].bFree)
+        {
+            throw std::runtime_error("HeapAllocator : tried to free a block that isn't allocated.");
+        }
+
+        UsedBytes -= Blocks[Node].Size;
+        AllocCount--;
+
+        // merge with the previous block
+        uint32_t Prev = Blocks[Node].PrevPhys;
+
+        if(Prev != InvalidBlock && Blocks[Prev].bFree)
+        {
+            RemoveFree(Prev);
+
+            Blocks[Prev].Size += Blocks[Node].Size;
+            Blocks[Prev].NextPhys = Blocks[Node].NextPhys;
+
+            if(Blocks[Node].NextPhys != InvalidBlock) Blocks[Blocks[Node].NextPhys].PrevPhys = Prev;
+
+            ReleaseNode(Node);
+            Node = Prev;
+        }
+
+        // merge with the next block
+        uint32_t Next = Blocks[Node].NextPhys;
+
+        if(Next != InvalidBlock && Blocks[Next].bFree)
+        {
+            RemoveFree(Next);
+
+            Blocks[Node].Size += Blocks[Next].Size;
+            Blocks[Node].NextPhys = Blocks[Next].NextPhys;
+
+            if(Blocks[Next].NextPhys != InvalidBlock) Blocks[Blocks[Next].NextPhys].PrevPhys = Node;
+
+            ReleaseNode(Next);
+        }
+
+        InsertFree(Node);
+    }
+
+    uint64_t HeapAllocator::GetLargestFreeBlock() const
+    {
+        if(FlBitmap == 0) return 0;
+
+        // every block in the highest non-empty list is larger than any block in a lower list, so only that list has to be searched.
+        uint32_t Fl = FindMsb(FlBitmap);
+        uint32_t Sl = FindMsb(SlBitmap[Fl]);
+
+        uint64_t Largest = 0;
+
+        for(uint32_t Node = FreeHeads[Fl][Sl]; Node != InvalidBlock; Node = Blocks[Node].NextFree)
+        {
+            Largest = std::max(Largest, Blocks[Node].Size);
+        }
+
+        return Largest;
+    }
+
+    float HeapAllocator::GetFragmentation() const
+    {
+        uint64_t FreeBytes = GetFree();
+
+        if(FreeBytes == 0) return 0.f;
+
+        return 1.f - ((float)GetLargestFreeBlock() / (float)FreeBytes);
+    }
+}
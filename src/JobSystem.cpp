@@ -0,0 +1,238 @@
+#include "JobSystem.hpp"
+
+#include <stdexcept>
+
+static thread_local uint32_t tThreadIdx = UINT32_MAX; // the job system thread index of the calling thread
+
+JobSystem::JobSystem(uint32_t ThreadCount) : ThreadCount(ThreadCount)
+{
+    Queues.reset(new WorkerQueue[ThreadCount]);
+
+    tThreadIdx = 0;
+
+    for(uint32_t i = 1; i < ThreadCount; i++)
+    {
+        Workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> Guard(SleepLock);
+        bQuit = true;
+    }
+
+    WakeCond.notify_all();
+
+    for(std::thread& Worker : Workers)
+    {
+        Worker.join();
+    }
+}
+
+void JobSystem::Run(Task Func, JobCounter* pSignal, JobCounter* pAfter)
+{
+    if(pSignal != nullptr)
+    {
+        pSignal->Pending++;
+    }
+
+    JobTask Entry = { std::move(Func), pSignal };
+
+    if(pAfter != nullptr)
+    {
+        std::lock_guard<std::mutex> Guard(pAfter->Lock);
+
+        // Signal() takes the continuations under the same lock after the counter drops to zero, so a non-zero count here means it hasn't taken them yet.
+        if(pAfter->Pending != 0)
+        {
+            pAfter->Continuations.push_back(std::move(Entry));
+            return;
+        }
+    }
+
+    Push(std::move(Entry));
+}
+
+void JobSystem::Wait(JobCounter* pCounter)
+{
+    uint32_t ThreadIdx = tThreadIdx;
+
+    // waiting threads run tasks as the thread they are, a thread the job system doesn't know has no index to run them with.
+    if(ThreadIdx >= ThreadCount)
+    {
+        throw std::runtime_error("JobSystem : Wait() can only be called from the thread that created the job system or from inside a task.");
+    }
+
+    while(pCounter->Pending != 0)
+    {
+        JobTask Entry;
+
+        if(TakeTask(ThreadIdx, Entry))
+        {
+            Execute(Entry, ThreadIdx);
+        }
+        else
+        {
+            // the remaining tasks are running on other threads.
+            std::this_thread::yield();
+        }
+    }
+
+    // the task that signaled the counter may still be releasing its lock, the counter can't be destroyed before it has.
+    std::lock_guard<std::mutex> Guard(pCounter->Lock);
+}
+
+void JobSystem::Dispatch(uint32_t JobCount, const Job& Func)
+{
+    JobCounter Counter;
+
+    for(uint32_t i = 0; i < JobCount; i++)
+    {
+        Run([&Func, i](uint32_t ThreadIdx) { Func(i, ThreadIdx); }, &Counter);
+    }
+
+    Wait(&Counter);
+}
+
+JobStats JobSystem::GetStats() const
+{
+    JobStats Stats{};
+
+    for(uint32_t i = 0; i < ThreadCount; i++)
+    {
+        Stats.Executed += Queues[i].Executed;
+        Stats.Stolen += Queues[i].Stolen;
+    }
+
+    return Stats;
+}
+
+void JobSystem::ResetStats()
+{
+    for(uint32_t i = 0; i < ThreadCount; i++)
+    {
+        Queues[i].Executed = 0;
+        Queues[i].Stolen = 0;
+    }
+}
+
+void JobSystem::WorkerLoop(uint32_t ThreadIdx)
+{
+    tThreadIdx = ThreadIdx;
+
+    while(true)
+    {
+        JobTask Entry;
+
+        if(TakeTask(ThreadIdx, Entry))
+        {
+            Execute(Entry, ThreadIdx);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> Guard(SleepLock);
+        WakeCond.wait(Guard, [this]() { return bQuit || QueuedTasks != 0; });
+
+        if(bQuit)
+        {
+            return;
+        }
+    }
+}
+
+void JobSystem::Push(JobTask&& Entry)
+{
+    // threads the job system doesn't know about share thread 0's deque.
+    uint32_t ThreadIdx = (tThreadIdx < ThreadCount) ? tThreadIdx : 0;
+
+    {
+        std::lock_guard<std::mutex> Guard(Queues[ThreadIdx].Lock);
+        Queues[ThreadIdx].Tasks.push_back(std::move(Entry));
+    }
+
+    QueuedTasks++;
+
+    // taking the lock orders the push with a worker that has just seen no tasks and is about to sleep.
+    {
+        std::lock_guard<std::mutex> Guard(SleepLock);
+    }
+
+    WakeCond.notify_one();
+}
+
+bool JobSystem::TakeTask(uint32_t ThreadIdx, JobTask& Entry)
+{
+    if(QueuedTasks == 0)
+    {
+        return false;
+    }
+
+    {
+        WorkerQueue& Own = Queues[ThreadIdx];
+        std::lock_guard<std::mutex> Guard(Own.Lock);
+
+        if(Own.Tasks.size() != 0)
+        {
+            Entry = std::move(Own.Tasks.back());
+            Own.Tasks.pop_back();
+            QueuedTasks--;
+
+            return true;
+        }
+    }
+
+    // start with the next thread over, so thieves don't all pile onto the same deque.
+    for(uint32_t i = 1; i < ThreadCount; i++)
+    {
+        WorkerQueue& Victim = Queues[(ThreadIdx+i) % ThreadCount];
+        std::lock_guard<std::mutex> Guard(Victim.Lock);
+
+        if(Victim.Tasks.size() != 0)
+        {
+            Entry = std::move(Victim.Tasks.front());
+            Victim.Tasks.pop_front();
+            QueuedTasks--;
+
+            Queues[ThreadIdx].Stolen.fetch_add(1, std::memory_order_relaxed);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::Execute(JobTask& Entry, uint32_t ThreadIdx)
+{
+    Entry.Func(ThreadIdx);
+
+    Queues[ThreadIdx].Executed.fetch_add(1, std::memory_order_relaxed);
+
+    if(Entry.pSignal != nullptr)
+    {
+        Signal(Entry.pSignal);
+    }
+}
+
+void JobSystem::Signal(JobCounter* pCounter)
+{
+    std::vector<JobTask> Ready;
+
+    {
+        std::lock_guard<std::mutex> Guard(pCounter->Lock);
+
+        if(--pCounter->Pending != 0)
+        {
+            return;
+        }
+
+        Ready.swap(pCounter->Continuations);
+    }
+
+    for(JobTask& Entry : Ready)
+    {
+        Push(std::move(Entry));
+    }
+}
@@ -0,0 +1,80 @@
+#include "MemoryHeap.hpp"
+
+#include <algorithm>
+
+bool SubAllocate(const std::vector<MemoryHeap*>& Heaps, VkMemoryRequirements MemReq, MemoryHeap* pSkip, MemoryHeap*& pHeap, uint64_t& Offset, uint32_t& Block)
+{
+    for(MemoryHeap* pCandidate : Heaps)
+    {
+        if(pCandidate->bDedicated || pCandidate == pSkip) continue;
+
+        if((Block = pCandidate->SubAllocator.Allocate(MemReq.size, MemReq.alignment, Offset)) != Allocators::HeapAllocator::InvalidBlock)
+        {
+            pHeap = pCandidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+MemoryHeap* PickDefragSource(const std::vector<MemoryHeap*>* pHeaps, const VkPhysicalDeviceMemoryProperties& MemProps, float MaxUsage)
+{
+    MemoryHeap* pSource = nullptr;
+    float LowestUsage = MaxUsage;
+
+    for(uint32_t MemIdx = 0; MemIdx < MemProps.memoryTypeCount; MemIdx++)
+    {
+        if(MemProps.memoryTypes[MemIdx].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) continue;
+
+        const std::vector<MemoryHeap*>& Heaps = pHeaps[MemIdx];
+
+        uint32_t SharedHeaps = (uint32_t)std::count_if(Heaps.begin(), Heaps.end(), [](MemoryHeap* pHeap) { return !pHeap->bDedicated; });
+
+        if(SharedHeaps < 2) continue;
+
+        for(MemoryHeap* pHeap : Heaps)
+        {
+            if(pHeap->bDedicated || pHeap->Buffers.size() == 0 || pHeap->Buffers.size() != pHeap->SubAllocator.GetAllocationCount()) continue;
+
+            float Usage = (float)pHeap->SubAllocator.GetUsed() / (float)pHeap->Size;
+
+            if(Usage < LowestUsage)
+            {
+                pSource = pHeap;
+                LowestUsage = Usage;
+            }
+        }
+    }
+
+    return pSource;
+}
+
+std::vector<DefragMove> PlanDefragMoves(const std::vector<MemoryHeap*>& Heaps, MemoryHeap* pSource, uint64_t ByteBudget, const std::function<VkMemoryRequirements(Resources::Buffer*)>& GetRequirements)
+{
+    std::vector<DefragMove> Moves;
+    uint64_t Planned = 0;
+
+    while(pSource->Buffers.size() != 0 && Planned < ByteBudget)
+    {
+        Resources::Buffer* pBuffer = pSource->Buffers.back();
+        VkMemoryRequirements MemReq = GetRequirements(pBuffer);
+
+        DefragMove Move;
+        Move.pBuffer = pBuffer;
+        Move.Size = MemReq.size;
+
+        if(!SubAllocate(Heaps, MemReq, pSource, Move.pHeap, Move.Offset, Move.Block))
+        {
+            break;
+        }
+
+        pSource->Buffers.pop_back();
+        Move.pHeap->Buffers.push_back(pBuffer);
+
+        Moves.push_back(Move);
+        Planned += MemReq.size;
+    }
+
+    return Moves;
+}
@@ -0,0 +1,67 @@
+#include "MemoryType.hpp"
+
+uint32_t FindMemoryType(const VkPhysicalDeviceMemoryProperties& MemProps, uint32_t TypeBits, VkMemoryPropertyFlags Required, VkMemoryPropertyFlags Preferred, VkMemoryPropertyFlags Avoided)
+{
+    uint32_t Best = UINT32_MAX;
+    int32_t BestScore = INT32_MIN;
+
+    for(uint32_t i = 0; i < MemProps.memoryTypeCount; i++)
+    {
+        VkMemoryPropertyFlags Flags = MemProps.memoryTypes[i].propertyFlags;
+
+        if(!(TypeBits & (1u << i)) || (Flags & Required) != Required)
+        {
+            continue;
+        }
+
+        // one point for every preferred flag, minus one for every flag we'd rather not have. Ties go to the lower index, since drivers list faster types first.
+        int32_t Score = 0;
+
+        for(uint32_t Bit = 0; Bit < 32; Bit++)
+        {
+            if(Preferred & Flags & (1u << Bit)) Score++;
+            if(Avoided & Flags & (1u << Bit)) Score--;
+        }
+
+        if(Score > BestScore)
+        {
+            Best = i;
+            BestScore = Score;
+        }
+    }
+
+    return Best;
+}
+
+void GetUsageFlags(MemoryUsage Usage, VkMemoryPropertyFlags& Required, VkMemoryPropertyFlags& Preferred, VkMemoryPropertyFlags& Avoided)
+{
+    Required = 0;
+    Preferred = 0;
+    Avoided = 0;
+
+    switch(Usage)
+    {
+        case MemoryUsage::eGpuOnly:
+            Required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            Avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+            break;
+        case MemoryUsage::eCpuToGpu:
+            // device local + host visible is ReBAR on discrete cards and plain memory on UMA, either way the gpu reads it without a copy.
+            Required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            Preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            break;
+        case MemoryUsage::eStaging:
+            // staging memory is only ever read by the copy engine, so keep it out of the (small) device local + host visible heap.
+            Required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            Avoided = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            break;
+        case MemoryUsage::eReadback:
+            Required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            Preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            break;
+        case MemoryUsage::eTransient:
+            Required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            Preferred = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+            break;
+    }
+}
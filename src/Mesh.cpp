@@ -1,112 +1,72 @@
 #include "Mesh.hpp"
+#include "MeshOptimizer.hpp"
 
-Instanced::Instanced() : MeshPassBuffer("Instanced Mesh Buffer")
+#include <algorithm>
+
+void Mesh::GenBounds()
 {
+    VertexPacking::FitBounds(pVertices, VertCount, BoundingSphere, BoundingExtent);
 }
 
-Instanced::~Instanced()
+void Mesh::PackVertices(PackedVertex* pOut)
 {
-    delete pMeshPassSet;
-    pMeshPassSet = nullptr;
+    VertexPacking::Pack(pVertices, VertCount, glm::vec3(BoundingSphere), glm::vec3(BoundingExtent), pOut);
 }
 
-void Instanced::Update()
+void Mesh::Optimize()
 {
-    TransferAgent* pAgent = GetTransferAgent();
-    uint32_t Zero = 0;
-    pAgent->Transfer(&Zero, sizeof(uint32_t), &MeshPassBuffer, offsetof(VkDrawIndexedIndirectCommand, instanceCount));
+    if(IndexCount < 3 || IndexCount % 3 != 0 || VertCount == 0) return;
 
-    if(bInstanceDataDirty)
+    // the optimizers index per-vertex tables with the indices, so an out of range index (i.e. from a malformed file) would write past them.
+    if(std::any_of(pIndices, pIndices+IndexCount, [this](uint32_t Index) { return Index >= VertCount; }))
     {
-        uint32_t InstCount = (uint32_t)Instances.size();
-        size_t Offset = sizeof(VkDrawIndexedIndirectCommand)+sizeof(uint32_t);
-        pAgent->Transfer(&InstCount, sizeof(InstCount), &MeshPassBuffer, Offset); // update the instance count for the mesh draw parameters
-
-        // update the instance list on the GPU side
-        size_t InstanceListOffset =
-        sizeof(VkDrawIndexedIndirectCommand) + // Draw command
-        sizeof(uint32_t)*2;                    // Mesh Bounds and Instance Count
-        pAgent->Transfer(Instances.data(), Instances.size()*sizeof(uint32_t), &MeshPassBuffer, InstanceListOffset);
-
-        bInstanceDataDirty = false;
+        std::cout << "Mesh \"" << Name << "\" has indices past its vertex count, it is uploaded without optimizing.\n";
+        return;
     }
 
     #ifdef DEBUG_MODE
-    /*
-        std::cout << "Indirect DrawCall as (Indirect*):\n";
-            VkDrawIndexedIndirectCommand* pTmp = (VkDrawIndexedIndirectCommand*)MeshPassBuffer.pData;
-
-            std::cout << "  indexCount " << ((uint32_t*)MeshPassBuffer.pData)[0] << '\n';
-            std::cout << "  instanceCount " << ((uint32_t*)MeshPassBuffer.pData)[1] << '\n';
-            std::cout << "  firstIndex " << ((uint32_t*)MeshPassBuffer.pData)[2] << '\n';
-            std::cout << "  vertexOffset " << ((int32_t*)MeshPassBuffer.pData)[3] << '\n';
-            std::cout << "  firstInstance " << ((uint32_t*)MeshPassBuffer.pData)[4] << '\n';
-    */
+        MeshOptimizer::CacheStats Before = MeshOptimizer::AnalyzeVertexCache(pIndices, IndexCount, VertCount);
     #endif
 
-    return;
-}
+    MeshOptimizer::OptimizeVertexCache(pIndices, IndexCount, VertCount);
 
-pbrMesh::pbrMesh() : Mesh()
-{
-}
+    std::vector<glm::vec3> Positions(VertCount);
 
-void pbrMesh::Bake()
-{
-    size_t BuffSize = sizeof(VkDrawIndexedIndirectCommand)+(sizeof(uint32_t)*(MAX_RENDERABLE_INSTANCES+2)*2);
-    CreateBuffer(MeshPassBuffer, BuffSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    for(uint32_t i = 0; i < VertCount; i++)
+    {
+        Positions[i] = pVertices[i].Position;
+    }
 
-    #ifdef DEBUG_MODE
-        Allocate(MeshPassBuffer, true);
-        Map(&MeshPassBuffer);
-    #else
-        Allocate(MeshPassBuffer, false);
-    #endif
+    MeshOptimizer::OptimizeOverdraw(pIndices, IndexCount, Positions.data(), VertCount);
 
-    Resources::DescUpdate MeshPassUpdate{};
-    MeshPassUpdate.Binding = 0;
-    MeshPassUpdate.DescType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    MeshPassUpdate.DescCount = 1;
-    MeshPassUpdate.DescIndex = 0;
+    std::vector<uint32_t> Remap;
+    uint32_t UsedCount = MeshOptimizer::OptimizeVertexFetch(pIndices, IndexCount, VertCount, Remap);
 
-    MeshPassUpdate.pBuff = &MeshPassBuffer;
-    MeshPassUpdate.Range = BuffSize;
-    MeshPassUpdate.Offset = 0;
+    Vertex* pRemapped = new Vertex[UsedCount];
 
-    pMeshPassSet->Update(&MeshPassUpdate, 1);
+    for(uint32_t i = 0; i < VertCount; i++)
+    {
+        if(Remap[i] != MeshOptimizer::InvalidIndex) pRemapped[Remap[i]] = pVertices[i];
+    }
 
-    VkDrawIndexedIndirectCommand tmp{};
-    tmp.indexCount = IndexCount;
-    tmp.instanceCount = 0;
-    tmp.firstIndex = 0;
-    tmp.vertexOffset = 0;
-    tmp.firstInstance = 0;
+    delete[] pVertices;
+    pVertices = pRemapped;
+    VertCount = UsedCount;
 
-    GetTransferAgent()->Transfer(&tmp, sizeof(tmp), &MeshPassBuffer, 0);
-}
+    #ifdef DEBUG_MODE
+        MeshOptimizer::CacheStats After = MeshOptimizer::AnalyzeVertexCache(pIndices, IndexCount, VertCount);
 
-void pbrMesh::AddInstance(uint32_t InstIdx)
-{
-    Instances.push_back(InstIdx);
-    bInstanceDataDirty = true;
+        std::cout << "Optimized mesh \"" << Name << "\" : ACMR " << Before.Acmr << " -> " << After.Acmr << ", ATVR " << Before.Atvr << " -> " << After.Atvr << "\n";
+    #endif
 }
 
-void pbrMesh::GenDraws(VkCommandBuffer* pCmdBuff, VkPipelineLayout Layout)
+pbrMesh::pbrMesh() : Mesh()
 {
-    vkCmdBindDescriptorSets(*pCmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, Layout, 1, 1, &pMeshPassSet->DescSet, 0, nullptr);
-    vkCmdDispatch(*pCmdBuff, 1+(((uint32_t)Instances.size()-1)/64), 1, 1);
 }
 
-void pbrMesh::DrawInstances(VkCommandBuffer* pCmdBuff, VkPipelineLayout Layout)
+void pbrMesh::AddInstance(uint32_t InstIdx)
 {
-    VkDeviceSize Offset = 0;
-    vkCmdBindDescriptorSets(*pCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, Layout, 1, 1, &pMeshPassSet->DescSet, 0, nullptr);
-    vkCmdBindVertexBuffers(*pCmdBuff, 0, 1, MeshBuffer, &Offset);
-    vkCmdBindIndexBuffer(*pCmdBuff, MeshBuffer, IndexOffset, VK_INDEX_TYPE_UINT32);
-
-    vkCmdDrawIndexedIndirect(*pCmdBuff, MeshPassBuffer, 0, (uint32_t)Instances.size(), sizeof(VkDrawIndexedIndirectCommand));
-
-    return;
+    Instances.push_back(InstIdx);
 }
 
 void Drawable::SetTransform(glm::vec3 Position, glm::vec3 Rotation, glm::vec3 Scale)
@@ -148,9 +108,7 @@ void Drawable::UpdateTransform()
     {
         GetTransferAgent()->Transfer(&Transform, sizeof(glm::mat4), pSceneBuffer, ObjIdx*sizeof(glm::mat4));
     }
-    else
-    {
-        memcpy(((glm::mat4*)pSceneBuffer->pData)+ObjIdx, &Transform, sizeof(Transform));
-    }
+
+    // dynamic transforms are written into the frame's slice of the dynamic scene buffer by the renderer every frame.
 }
 
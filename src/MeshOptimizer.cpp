@@ -0,0 +1,338 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+
+namespace MeshOptimizer
+{
+    // FIFO cache with a time stamp per vertex, a vertex is cached while fewer than (CacheSize) vertices were inserted after it.
+    struct CacheSim
+    {
+        CacheSim(uint32_t VertexCount, uint32_t Size) : InsertTime(VertexCount, 0), Time(Size+1), CacheSize(Size) {}
+
+        bool Access(uint32_t Vertex)
+        {
+            if(Time - InsertTime[Vertex] > CacheSize)
+            {
+                InsertTime[Vertex] = Time++;
+                return false;
+            }
+
+            return true;
+        }
+
+        void Reset() { Time += CacheSize+1; }
+
+        std::vector<uint32_t> InsertTime;
+        uint32_t Time;
+        uint32_t CacheSize;
+    };
+
+    CacheStats AnalyzeVertexCache(const uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount, uint32_t CacheSize)
+    {
+        CacheStats Stats{};
+
+        uint32_t TriCount = IndexCount/3;
+
+        if(TriCount == 0) return Stats;
+
+        CacheSim Cache(VertexCount, CacheSize);
+        std::vector<bool> Used(VertexCount, false);
+
+        uint32_t Misses = 0;
+        uint32_t UsedCount = 0;
+
+        for(uint32_t i = 0; i < TriCount*3; i++)
+        {
+            if(!Cache.Access(pIndices[i])) Misses++;
+
+            if(!Used[pIndices[i]])
+            {
+                Used[pIndices[i]] = true;
+                UsedCount++;
+            }
+        }
+
+        Stats.Acmr = (float)Misses / (float)TriCount;
+        Stats.Atvr = (float)Misses / (float)UsedCount;
+
+        return Stats;
+    }
+
+    void OptimizeVertexCache(uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount, uint32_t CacheSize)
+    {
+        uint32_t TriCount = IndexCount/3;
+
+        if(TriCount == 0) return;
+
+        // triangles that use each vertex, and how many of them are still to be emitted.
+        std::vector<uint32_t> Live(VertexCount, 0);
+
+        for(uint32_t i = 0; i < TriCount*3; i++)
+        {
+            Live[pIndices[i]]++;
+        }
+
+        std::vector<uint32_t> AdjOffsets(VertexCount+1, 0);
+
+        for(uint32_t v = 0; v < VertexCount; v++)
+        {
+            AdjOffsets[v+1] = AdjOffsets[v] + Live[v];
+        }
+
+        std::vector<uint32_t> Adjacency(TriCount*3);
+        std::vector<uint32_t> AdjCursor(AdjOffsets.begin(), AdjOffsets.end()-1);
+
+        for(uint32_t i = 0; i < TriCount*3; i++)
+        {
+            Adjacency[AdjCursor[pIndices[i]]++] = i/3;
+        }
+
+        std::vector<uint32_t> InsertTime(VertexCount, 0);
+        uint32_t Time = CacheSize+1;
+
+        std::vector<bool> Emitted(TriCount, false);
+        std::vector<uint32_t> DeadEnds; // recently emitted vertices, to pick up from when a fan leaves no good candidate.
+        std::vector<uint32_t> Candidates;
+        std::vector<uint32_t> Output;
+
+        DeadEnds.reserve(TriCount*3);
+        Output.reserve(TriCount*3);
+
+        uint32_t ScanCursor = 0; // every vertex before this one has no triangles left
+        uint32_t Fan = pIndices[0];
+
+        while(Fan != InvalidIndex)
+        {
+            Candidates.clear();
+
+            // emit every remaining triangle around the fanning vertex
+            for(uint32_t a = AdjOffsets[Fan]; a < AdjOffsets[Fan+1]; a++)
+            {
+                uint32_t Tri = Adjacency[a];
+
+                if(Emitted[Tri]) continue;
+
+                for(uint32_t k = 0; k < 3; k++)
+                {
+                    uint32_t v = pIndices[Tri*3+k];
+
+                    Output.push_back(v);
+                    DeadEnds.push_back(v);
+                    Candidates.push_back(v);
+                    Live[v]--;
+
+                    if(Time - InsertTime[v] > CacheSize)
+                    {
+                        InsertTime[v] = Time++;
+                    }
+                }
+
+                Emitted[Tri] = true;
+            }
+
+            // fan around the candidate that has been cached the longest, as long as emitting its triangles (up to 2 new vertices each) won't push it out.
+            uint32_t Next = InvalidIndex;
+            int64_t BestPriority = -1;
+
+            for(uint32_t v : Candidates)
+            {
+                if(Live[v] == 0) continue;
+
+                int64_t Priority = 0;
+
+                if(Time - InsertTime[v] + 2*Live[v] <= CacheSize)
+                {
+                    Priority = Time - InsertTime[v];
+                }
+
+                if(Priority > BestPriority)
+                {
+                    BestPriority = Priority;
+                    Next = v;
+                }
+            }
+
+            if(Next == InvalidIndex)
+            {
+                while(!DeadEnds.empty())
+                {
+                    uint32_t v = DeadEnds.back();
+                    DeadEnds.pop_back();
+
+                    if(Live[v] != 0)
+                    {
+                        Next = v;
+                        break;
+                    }
+                }
+            }
+
+            if(Next == InvalidIndex)
+            {
+                while(ScanCursor < VertexCount && Live[ScanCursor] == 0)
+                {
+                    ScanCursor++;
+                }
+
+                Next = (ScanCursor < VertexCount) ? ScanCursor : InvalidIndex;
+            }
+
+            Fan = Next;
+        }
+
+        std::copy(Output.begin(), Output.end(), pIndices);
+    }
+
+    void OptimizeOverdraw(uint32_t* pIndices, uint32_t IndexCount, const glm::vec3* pPositions, uint32_t VertexCount, uint32_t CacheSize, float Threshold)
+    {
+        uint32_t TriCount = IndexCount/3;
+
+        if(TriCount == 0) return;
+
+        // hard boundaries, where the cache order restarts (a triangle that misses on all of its vertices)
+        std::vector<uint32_t> HardClusters;
+        CacheSim Cache(VertexCount, CacheSize);
+
+        for(uint32_t t = 0; t < TriCount; t++)
+        {
+            uint32_t Misses = 0;
+
+            for(uint32_t k = 0; k < 3; k++)
+            {
+                if(!Cache.Access(pIndices[t*3+k])) Misses++;
+            }
+
+            if(t == 0 || Misses == 3) HardClusters.push_back(t);
+        }
+
+        HardClusters.push_back(TriCount);
+
+        // soft boundaries, split a cluster wherever its miss ratio so far is already close to the whole cluster's. Each split restarts the cache, which is what costs the (Threshold).
+        std::vector<uint32_t> Clusters;
+
+        for(uint32_t c = 0; c+1 < HardClusters.size(); c++)
+        {
+            uint32_t Start = HardClusters[c];
+            uint32_t End = HardClusters[c+1];
+
+            Cache.Reset();
+            uint32_t ClusterMisses = 0;
+
+            for(uint32_t i = Start*3; i < End*3; i++)
+            {
+                if(!Cache.Access(pIndices[i])) ClusterMisses++;
+            }
+
+            float ClusterAcmr = (float)ClusterMisses / (float)(End-Start);
+
+            Cache.Reset();
+            Clusters.push_back(Start);
+
+            uint32_t RunStart = Start;
+            uint32_t RunMisses = 0;
+
+            for(uint32_t t = Start; t < End; t++)
+            {
+                for(uint32_t k = 0; k < 3; k++)
+                {
+                    if(!Cache.Access(pIndices[t*3+k])) RunMisses++;
+                }
+
+                if(t+1 < End && (float)RunMisses / (float)(t+1-RunStart) <= ClusterAcmr*Threshold)
+                {
+                    Clusters.push_back(t+1);
+
+                    Cache.Reset();
+                    RunStart = t+1;
+                    RunMisses = 0;
+                }
+            }
+        }
+
+        Clusters.push_back(TriCount);
+
+        uint32_t ClusterCount = (uint32_t)Clusters.size()-1;
+
+        // area weighted centroid and normal of every cluster, and of the whole mesh.
+        std::vector<glm::vec3> Centroids(ClusterCount, glm::vec3(0.f));
+        std::vector<glm::vec3> Normals(ClusterCount, glm::vec3(0.f));
+        std::vector<float> Areas(ClusterCount, 0.f);
+
+        glm::vec3 MeshCentroid(0.f);
+        float MeshArea = 0.f;
+
+        for(uint32_t c = 0; c < ClusterCount; c++)
+        {
+            for(uint32_t t = Clusters[c]; t < Clusters[c+1]; t++)
+            {
+                const glm::vec3& A = pPositions[pIndices[t*3]];
+                const glm::vec3& B = pPositions[pIndices[t*3+1]];
+                const glm::vec3& C = pPositions[pIndices[t*3+2]];
+
+                glm::vec3 Normal = glm::cross(B-A, C-A); // length is twice the area
+                float Area = glm::length(Normal);
+
+                Centroids[c] += (A+B+C) * (Area/3.f);
+                Normals[c] += Normal;
+                Areas[c] += Area;
+            }
+
+            MeshCentroid += Centroids[c];
+            MeshArea += Areas[c];
+
+            if(Areas[c] > 0.f) Centroids[c] = Centroids[c] * (1.f/Areas[c]);
+        }
+
+        if(MeshArea > 0.f) MeshCentroid = MeshCentroid * (1.f/MeshArea);
+
+        // clusters that face away from the mesh's center are on its outside, and likely to hide the rest, so they're drawn first.
+        std::vector<float> SortKeys(ClusterCount, 0.f);
+
+        for(uint32_t c = 0; c < ClusterCount; c++)
+        {
+            float NormalLength = glm::length(Normals[c]);
+
+            if(NormalLength > 0.f)
+            {
+                SortKeys[c] = glm::dot(Centroids[c] - MeshCentroid, Normals[c] * (1.f/NormalLength));
+            }
+        }
+
+        std::vector<uint32_t> Order(ClusterCount);
+
+        for(uint32_t c = 0; c < ClusterCount; c++) Order[c] = c;
+
+        std::stable_sort(Order.begin(), Order.end(), [&](uint32_t A, uint32_t B) { return SortKeys[A] > SortKeys[B]; });
+
+        std::vector<uint32_t> Output;
+        Output.reserve(TriCount*3);
+
+        for(uint32_t c : Order)
+        {
+            Output.insert(Output.end(), pIndices + Clusters[c]*3, pIndices + Clusters[c+1]*3);
+        }
+
+        std::copy(Output.begin(), Output.end(), pIndices);
+    }
+
+    uint32_t OptimizeVertexFetch(uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount, std::vector<uint32_t>& Remap)
+    {
+        Remap.assign(VertexCount, InvalidIndex);
+
+        uint32_t Next = 0;
+
+        for(uint32_t i = 0; i < IndexCount; i++)
+        {
+            uint32_t& Index = pIndices[i];
+
+            if(Remap[Index] == InvalidIndex)
+            {
+                Remap[Index] = Next++;
+            }
+
+            Index = Remap[Index];
+        }
+
+        return Next;
+    }
+}
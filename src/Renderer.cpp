@@ -17,8 +17,6 @@
 
 tinygltf::TinyGLTF MeshLoader;
 
-Resources::DescriptorLayout* Instanced::pMeshPassLayout = {};
-
 bool ExtractVtxComp(tinygltf::Model& Model, tinygltf::Primitive& Prim, std::string CompName, int CompCount, std::vector<float>& OutArr)
 {
     auto Iter = Prim.attributes.find(CompName);
@@ -102,7 +100,10 @@ bool ExtractIdx(tinygltf::Model& Model, tinygltf::Primitive& Prim, std::vector<u
 
 Camera::Camera() : WvpBuffer("Camera WVP Buffer")
 {
-    CreateBuffer(WvpBuffer, (sizeof(glm::mat4)*4)+(sizeof(glm::vec4)*6), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    VkDeviceSize Alignment = GetContext()->MinUniformAlignment;
+    SliceSize = (((sizeof(glm::mat4)*4)+(sizeof(glm::vec4)*6) + Alignment - 1) / Alignment) * Alignment;
+
+    CreateBuffer(WvpBuffer, SliceSize*FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
     Allocate(WvpBuffer, true);
 
@@ -115,20 +116,39 @@ Camera::Camera() : WvpBuffer("Camera WVP Buffer")
     Position = glm::vec3(0.f, 0.f, 5.f);
     Rotation = glm::vec3(0.f);
 
-    pWvp = (glm::mat4*)WvpBuffer.pData;
-    pWvp[0] = glm::mat4(1.f);
-    pWvp[2] = glm::perspective(45.f, 16.f/9.f, 0.0001f, 9999.f);
-    pWvp[2][1][1] *= -1.f;
+    Proj = glm::perspective(45.f, 16.f/9.f, 0.0001f, 9999.f);
+    Proj[1][1] *= -1.f;
+
+    for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++)
+    {
+        glm::mat4* pWvp = WvpBuffer.As<glm::mat4>(SliceSize*i);
+        pWvp[0] = glm::mat4(1.f);
+        pWvp[2] = Proj;
+    }
 }
 
-void Camera::Update()
+void Camera::Update(uint32_t FrameSlot)
 {
     CamMat = glm::translate(glm::mat4(1.f), Position);
 
     CamMat = glm::rotate(CamMat, glm::radians(Rotation.x*-1.f), glm::vec3(0.f, 1.f, 0.f)); // rotate along the y-axis (up)
     CamMat = glm::rotate(CamMat, glm::radians(Rotation.y), glm::vec3(1.f, 0.f, 0.f)); // rotate along the x-axis (right)
 
-    pWvp[1] = glm::inverse(CamMat);
+    glm::mat4 View = glm::inverse(CamMat);
+    glm::mat4 ProjView = Proj*View;
+
+    GenPlanes(ProjView);
+
+    glm::mat4* pWvp = WvpBuffer.As<glm::mat4>(SliceSize*FrameSlot);
+    pWvp[1] = View;
+    pWvp[3] = ProjView;
+
+    glm::vec4* pPlanes = (glm::vec4*)(pWvp+4);
+
+    for(uint32_t i = 0; i < 6; i++)
+    {
+        pPlanes[i] = Planes[i];
+    }
 }
 
 void Camera::Move()
@@ -190,64 +210,35 @@ void Camera::Rotate()
     return;
 }
 
-void Camera::GenPlanes()
+void Camera::GenPlanes(const glm::mat4& ProjView)
 {
-    for(uint32_t i = 0; i < 3; i++)
-    {
-        for(uint32_t x = 0; x < 2; x++)
-        {
-            float sign = x ? 1.f : -1.f;
+    // a clip space point is inside when -w <= x,y <= w and 0 <= z <= w, each bound is a plane made of the matrix's rows (glm is column major, so row k is ProjView[..][k])
+    glm::vec4 Rows[4];
 
-            for(uint32_t k = 0; k < 4; k++)
-            {
-                glm::mat4 View = glm::inverse(CamMat);
-                Planes[2*i+x][k] = View[k][3] + sign * View[k][i];
-            }
-        }
-    }
-
-    for(glm::vec4& pl : Planes)
+    for(uint32_t k = 0; k < 4; k++)
     {
-        pl /= static_cast<float>(glm::length(glm::vec3(pl)));
+        Rows[k] = glm::vec4(ProjView[0][k], ProjView[1][k], ProjView[2][k], ProjView[3][k]);
     }
-}
 
-void PipeStage::Update()
-{
-    // Perform per-tick operations.
+    Planes[0] = Rows[3] + Rows[0]; // left
+    Planes[1] = Rows[3] - Rows[0]; // right
+    Planes[2] = Rows[3] + Rows[1]; // bottom
+    Planes[3] = Rows[3] - Rows[1]; // top
+    Planes[4] = Rows[2];           // near (vulkan depth starts at 0, not -w)
+    Planes[5] = Rows[3] - Rows[2]; // far
 
-    for(uint32_t i = 0; i < Meshes.size(); i++)
-    {
-        Meshes[i]->Update();
-    }
-}
-
-void PipeStage::UpdateDraws(Resources::CommandBuffer* pCmdBuffer, VkPipelineLayout ComputeLayout)
-{
-    for(uint32_t i = 0; i < Meshes.size(); i++)
+    for(glm::vec4& pl : Planes)
     {
-        Meshes[i]->GenDraws(*pCmdBuffer, ComputeLayout);
+        pl /= glm::length(glm::vec3(pl));
     }
 }
 
-void PipeStage::Draw(Resources::CommandBuffer* pCmdBuffer)
+void PipeStage::Draw(Resources::CommandBuffer* pCmdBuffer, VkBuffer DrawBuffer, VkDeviceSize CompactOffset, VkDeviceSize CountOffset)
 {
     vkCmdBindPipeline(*pCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, *Pipe);
 
-    for(uint32_t i = 0; i < Meshes.size(); i++)
-    {
-        Meshes[i]->DrawInstances(*pCmdBuffer, Pipe->PipeLayout);
-    }
-}
-
-void PassStage::Update()
-{
-    // perform per-tick operations.
-
-    for(uint32_t i = 0; i < PipeStages.size(); i++)
-    {
-        PipeStages[i]->Update();        
-    }
+    // only meshes with visible instances have a draw command in the stage's range, the gpu reads how many there are from the count.
+    vkCmdDrawIndexedIndirectCount(*pCmdBuffer, DrawBuffer, CompactOffset + FirstDraw*sizeof(VkDrawIndexedIndirectCommand), DrawBuffer, CountOffset + BatchIdx*sizeof(uint32_t), (uint32_t)Meshes.size(), sizeof(VkDrawIndexedIndirectCommand));
 }
 
 void FrameBufferChain::Bake(RenderPass* pPass, VkCommandBuffer* pCmdBuffer)
@@ -276,12 +267,14 @@ void FrameBufferChain::Bake(RenderPass* pPass, VkCommandBuffer* pCmdBuffer)
     return;
 }
 
-SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), DynamicSceneBuffer("Dynamic Scene Buffer"), SceneLightBuffer("Scene Light Buffer")
+SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), DynamicSceneBuffer("Dynamic Scene Buffer"), SceneLightBuffer("Scene Light Buffer"), VertexArena("Vertex Arena"), PositionArena("Position Arena"), IndexArena("Index Arena"), MeshBoundsBuffer("Mesh Bounds Buffer"), DrawBuffer("Draw Buffer")
 {
     VkResult Err;
 
     InitWrapperFW();
 
+    Context* pCtx = GetContext();
+
     SceneCam = new Camera();
 
     SceneProfile.Topo = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
@@ -296,10 +289,18 @@ SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), Dynam
     SceneProfile.DepthRange = {0.f, 1.f};
     SceneProfile.DepthCompareOp = VK_COMPARE_OP_LESS;
 
-    SceneProfile.AddBinding(0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX);
-    SceneProfile.AddAttribute(0, VK_FORMAT_R32G32B32_SFLOAT, 0, offsetof(Vertex, Position));   // Position
-    SceneProfile.AddAttribute(0, VK_FORMAT_R32G32B32_SFLOAT, 1, offsetof(Vertex, Normal));   // Normal
-    SceneProfile.AddAttribute(0, VK_FORMAT_R32G32_SFLOAT, 2, offsetof(Vertex, UV));    // UV
+    // the vertex arena holds packed vertices, the attribute formats do most of the decoding (Vert.glsl rescales the position and unfolds the normal).
+    SceneProfile.AddBinding(0, sizeof(PackedVertex), VK_VERTEX_INPUT_RATE_VERTEX);
+    SceneProfile.AddAttribute(0, VK_FORMAT_R16G16B16A16_SNORM, 0, offsetof(PackedVertex, PositionXY));   // Position
+    SceneProfile.AddAttribute(0, VK_FORMAT_R16G16_SNORM, 1, offsetof(PackedVertex, Normal));   // Normal
+    SceneProfile.AddAttribute(0, VK_FORMAT_R16G16_SFLOAT, 2, offsetof(PackedVertex, UV));    // UV
+
+    // passes that only need positions fetch 8 bytes per vertex instead of 16, and nothing else goes through the vertex cache.
+    PositionProfile = SceneProfile;
+    PositionProfile.bPositionStream = true;
+    PositionProfile.ClearVertexInput();
+    PositionProfile.AddBinding(0, sizeof(PackedPosition), VK_VERTEX_INPUT_RATE_VERTEX);
+    PositionProfile.AddAttribute(0, VK_FORMAT_R16G16B16A16_SNORM, 0, offsetof(PackedPosition, XY));   // Position
 
     // SceneProfile.AddBinding(1, sizeof(uint32_t), VK_VERTEX_INPUT_RATE_INSTANCE);
     // SceneProfile.AddAttribute(1, VK_FORMAT_R32_UINT, 3, 0); // Artificial Inst Idx
@@ -308,38 +309,33 @@ SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), Dynam
     ComputeHeap.Bake(CommandType::eCmdCompute);
     TransferHeap.Bake(CommandType::eCmdTransfer);
 
-    VkDescriptorSetLayoutBinding MeshPassLayoutBinding{};
-    MeshPassLayoutBinding.binding = 0;
-    MeshPassLayoutBinding.descriptorCount = 1;
-    MeshPassLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    MeshPassLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
-
-    /*
-    VkDescriptorSetLayoutBinding InstanceArrBinding{};
-    MeshPassLayoutBinding.binding = 1;
-    MeshPassLayoutBinding.descriptorCount = 1;
-    MeshPassLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    MeshPassLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    */
-
-    Instanced::pMeshPassLayout = new Resources::DescriptorLayout();
-    Instanced::pMeshPassLayout->AddBinding(MeshPassLayoutBinding);
-    // Instanced::pMeshPassLayout->AddBinding(InstanceArrBinding);
-    DescriptorHeaps[*Instanced::pMeshPassLayout].Bake(Instanced::pMeshPassLayout, 1000);
-
     if((Err = CreateBuffer(StaticSceneBuffer, sizeof(glm::mat4)*MAX_STATIC_SCENE_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create static scene buffer.");
     Allocate(StaticSceneBuffer, false);
 
-    if((Err = CreateBuffer(DynamicSceneBuffer, sizeof(glm::mat4)*MAX_DYNAMIC_SCENE_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create dynamic scene buffer.");
+    DynamicSliceSize = (((sizeof(glm::mat4)*MAX_DYNAMIC_SCENE_SIZE) + pCtx->MinStorageAlignment - 1) / pCtx->MinStorageAlignment) * pCtx->MinStorageAlignment;
+
+    if((Err = CreateBuffer(DynamicSceneBuffer, DynamicSliceSize*FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create dynamic scene buffer.");
     Allocate(DynamicSceneBuffer, true);
     Map(&DynamicSceneBuffer);
     
     if((Err = CreateBuffer(SceneLightBuffer, ((sizeof(glm::vec4)+sizeof(glm::vec4)+sizeof(float))*10000)+sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create scene light buffer");
     Allocate(SceneLightBuffer, false);
 
+    if((Err = CreateBuffer(MeshBoundsBuffer, sizeof(glm::vec4)*2*MAX_SCENE_MESHES, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create mesh bounds buffer.");
+    Allocate(MeshBoundsBuffer, false);
+
+    if((Err = CreateBuffer(VertexArena, sizeof(PackedVertex)*MAX_SCENE_VERTICES, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create vertex arena.");
+    Allocate(VertexArena, false);
+
+    if((Err = CreateBuffer(PositionArena, sizeof(PackedPosition)*MAX_SCENE_VERTICES, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create position arena.");
+    Allocate(PositionArena, false);
+
+    if((Err = CreateBuffer(IndexArena, sizeof(uint32_t)*MAX_SCENE_INDICES, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create index arena.");
+    Allocate(IndexArena, false);
+
     pSceneDescriptorLayout = new Resources::DescriptorLayout();
 
-    VkDescriptorSetLayoutBinding SceneBindings[4] = {};
+    VkDescriptorSetLayoutBinding SceneBindings[5] = {};
     
     SceneBindings[0].binding = 0;
     SceneBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -361,6 +357,11 @@ SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), Dynam
     SceneBindings[3].descriptorCount = 1;
     SceneBindings[3].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+    SceneBindings[4].binding = 4;
+    SceneBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    SceneBindings[4].descriptorCount = 1;
+    SceneBindings[4].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT; // the vertex shader unpacks positions with the bounds
+
     /*
     SceneBindings[3].binding = 3;
     SceneBindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -372,11 +373,11 @@ SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), Dynam
     pSceneDescriptorLayout->AddBinding(SceneBindings[1]);
     pSceneDescriptorLayout->AddBinding(SceneBindings[2]);
     pSceneDescriptorLayout->AddBinding(SceneBindings[3]);
+    pSceneDescriptorLayout->AddBinding(SceneBindings[4]);
 
-    DescriptorHeaps[*pSceneDescriptorLayout].Bake(pSceneDescriptorLayout, 2);
-    pSceneDescriptorSet = DescriptorHeaps[*pSceneDescriptorLayout].CreateSet();
+    DescriptorHeaps[*pSceneDescriptorLayout].Bake(pSceneDescriptorLayout, FRAMES_IN_FLIGHT);
 
-    Resources::DescUpdate SceneUpdates[4] = {};
+    Resources::DescUpdate SceneUpdates[5] = {};
 
     SceneUpdates[0].DescType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     SceneUpdates[0].DescCount = 1;
@@ -384,8 +385,7 @@ SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), Dynam
     SceneUpdates[0].DescIndex = 0;
 
     SceneUpdates[0].pBuff = &SceneCam->WvpBuffer;
-    SceneUpdates[0].Range = (sizeof(glm::mat4)*3) + (sizeof(glm::vec4)*6);
-    SceneUpdates[0].Offset = 0;
+    SceneUpdates[0].Range = (sizeof(glm::mat4)*4) + (sizeof(glm::vec4)*6);
 
     SceneUpdates[1].DescType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     SceneUpdates[1].Binding = 1;
@@ -402,8 +402,7 @@ SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), Dynam
     SceneUpdates[2].DescIndex = 0;
 
     SceneUpdates[2].pBuff = &DynamicSceneBuffer;
-    SceneUpdates[2].Range = DynamicSceneBuffer.Alloc.Size;
-    SceneUpdates[2].Offset = 0;
+    SceneUpdates[2].Range = DynamicSliceSize;
 
     SceneUpdates[3].DescType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     SceneUpdates[3].Binding = 3;
@@ -414,13 +413,133 @@ SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), Dynam
     SceneUpdates[3].Range = ((sizeof(glm::vec4)+sizeof(glm::vec4))*10000) + sizeof(uint32_t);
     SceneUpdates[3].Offset = 0;
 
-    pSceneDescriptorSet->Update(SceneUpdates, 4);
+    SceneUpdates[4].DescType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    SceneUpdates[4].Binding = 4;
+    SceneUpdates[4].DescCount = 1;
+    SceneUpdates[4].DescIndex = 0;
+
+    SceneUpdates[4].pBuff = &MeshBoundsBuffer;
+    SceneUpdates[4].Range = sizeof(glm::vec4)*2*MAX_SCENE_MESHES;
+    SceneUpdates[4].Offset = 0;
+
+    // every frame in flight gets a scene set pointing at its own slices of the camera and dynamic scene buffers
+    for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++)
+    {
+        SceneUpdates[0].Offset = SceneCam->SliceSize*i;
+        SceneUpdates[2].Offset = DynamicSliceSize*i;
+
+        Frames[i].pSceneDescriptorSet = DescriptorHeaps[*pSceneDescriptorLayout].CreateSet();
+        Frames[i].pSceneDescriptorSet->Update(SceneUpdates, 5);
+    }
+
+    /* Draw generation set, culls the whole scene's instance list in one dispatch and writes a draw command per mesh */
+        VkDeviceSize StorageAlignment = pCtx->MinStorageAlignment;
+
+        VkDeviceSize DrawCmdsSize = sizeof(VkDrawIndexedIndirectCommand)*MAX_SCENE_MESHES;
+        VkDeviceSize InstanceListSize = sizeof(uint32_t)*2 + sizeof(uint32_t)*2*MAX_SCENE_INSTANCES; // instance count (padded to the alignment of a pair), then the pairs
+        VkDeviceSize VisibleListSize = sizeof(uint32_t)*2*MAX_SCENE_INSTANCES; // a (scene index, mesh index) pair per visible instance
+        VkDeviceSize BatchTableSize = sizeof(uint32_t)*2 + sizeof(uint32_t)*2*MAX_SCENE_MESHES; // mesh count (padded like the instance count), then the pairs
+        VkDeviceSize DrawCountSize = sizeof(uint32_t)*MAX_SCENE_MESHES;
+
+        DrawTemplateOffset = ((DrawCmdsSize + StorageAlignment - 1) / StorageAlignment) * StorageAlignment;
+        InstanceListOffset = ((DrawTemplateOffset + DrawCmdsSize + StorageAlignment - 1) / StorageAlignment) * StorageAlignment;
+        VisibleListOffset = ((InstanceListOffset + InstanceListSize + StorageAlignment - 1) / StorageAlignment) * StorageAlignment;
+        BatchTableOffset = ((VisibleListOffset + VisibleListSize + StorageAlignment - 1) / StorageAlignment) * StorageAlignment;
+        DrawCountOffset = ((BatchTableOffset + BatchTableSize + StorageAlignment - 1) / StorageAlignment) * StorageAlignment;
+        CompactDrawOffset = ((DrawCountOffset + DrawCountSize + StorageAlignment - 1) / StorageAlignment) * StorageAlignment;
+        DrawSliceSize = ((CompactDrawOffset + DrawCmdsSize + StorageAlignment - 1) / StorageAlignment) * StorageAlignment;
+
+        if((Err = CreateBuffer(DrawBuffer, DrawSliceSize*FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)) != VK_SUCCESS) throw std::runtime_error("Failed to create draw buffer.");
+
+        #ifdef DEBUG_MODE
+            Allocate(DrawBuffer, MemoryUsage::eReadback); // host cached, the draw commands can be read back for debugging
+            Map(&DrawBuffer);
+        #else
+            Allocate(DrawBuffer, false);
+        #endif
+
+        VkDescriptorSetLayoutBinding DrawBindings[6] = {};
+
+        DrawBindings[0].binding = 0; // draw commands
+        DrawBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        DrawBindings[0].descriptorCount = 1;
+        DrawBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        DrawBindings[1].binding = 1; // instance list
+        DrawBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        DrawBindings[1].descriptorCount = 1;
+        DrawBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        DrawBindings[2].binding = 2; // visible instances
+        DrawBindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        DrawBindings[2].descriptorCount = 1;
+        DrawBindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+
+        DrawBindings[3].binding = 3; // batch table
+        DrawBindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        DrawBindings[3].descriptorCount = 1;
+        DrawBindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        DrawBindings[4].binding = 4; // batch draw counts
+        DrawBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        DrawBindings[4].descriptorCount = 1;
+        DrawBindings[4].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        DrawBindings[5].binding = 5; // compacted draw commands
+        DrawBindings[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        DrawBindings[5].descriptorCount = 1;
+        DrawBindings[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        pDrawDescriptorLayout = new Resources::DescriptorLayout();
+
+        for(uint32_t i = 0; i < 6; i++)
+        {
+            pDrawDescriptorLayout->AddBinding(DrawBindings[i]);
+        }
+
+        DescriptorHeaps[*pDrawDescriptorLayout].Bake(pDrawDescriptorLayout, FRAMES_IN_FLIGHT);
+
+        Resources::DescUpdate DrawUpdates[6] = {};
+
+        for(uint32_t i = 0; i < 6; i++)
+        {
+            DrawUpdates[i].DescType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            DrawUpdates[i].Binding = i;
+            DrawUpdates[i].DescCount = 1;
+            DrawUpdates[i].DescIndex = 0;
+            DrawUpdates[i].pBuff = &DrawBuffer;
+        }
+
+        DrawUpdates[0].Range = DrawCmdsSize;
+        DrawUpdates[1].Range = InstanceListSize;
+        DrawUpdates[2].Range = VisibleListSize;
+        DrawUpdates[3].Range = BatchTableSize;
+        DrawUpdates[4].Range = DrawCountSize;
+        DrawUpdates[5].Range = DrawCmdsSize;
+
+        for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++)
+        {
+            DrawUpdates[0].Offset = DrawSliceSize*i;
+            DrawUpdates[1].Offset = DrawSliceSize*i + InstanceListOffset;
+            DrawUpdates[2].Offset = DrawSliceSize*i + VisibleListOffset;
+            DrawUpdates[3].Offset = DrawSliceSize*i + BatchTableOffset;
+            DrawUpdates[4].Offset = DrawSliceSize*i + DrawCountOffset;
+            DrawUpdates[5].Offset = DrawSliceSize*i + CompactDrawOffset;
+
+            Frames[i].pDrawDescriptorSet = DescriptorHeaps[*pDrawDescriptorLayout].CreateSet();
+            Frames[i].pDrawDescriptorSet->Update(DrawUpdates, 6);
+        }
 
     DrawPipeline.AddDescriptor(pSceneDescriptorLayout);
-    DrawPipeline.AddDescriptor(Instanced::pMeshPassLayout);
+    DrawPipeline.AddDescriptor(pDrawDescriptorLayout);
 
     DrawPipeline.Bake("Draw.spv");
 
+    CompactPipeline.AddDescriptor(pSceneDescriptorLayout);
+    CompactPipeline.AddDescriptor(pDrawDescriptorLayout);
+
+    CompactPipeline.Bake("Compact.spv");
+
     VkClearValue ColorClear; ColorClear.color.float32[0] = 0.f; ColorClear.color.float32[1] = 0.f; ColorClear.color.float32[2] = 0.f; ColorClear.color.float32[3] = 0.f;
 
     AddRenderAttachment(GetWindow()->SurfFormat.format, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ATTACHMENT_STORE_OP_STORE, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE, VK_ATTACHMENT_LOAD_OP_DONT_CARE, &ColorClear, VK_SAMPLE_COUNT_1_BIT);
@@ -428,14 +547,30 @@ SceneRenderer::SceneRenderer() : StaticSceneBuffer("Static Scene Buffer"), Dynam
 
 SceneRenderer::~SceneRenderer()
 {
+    // frames may still be in flight (or not even submitted)
+    FlushSubmits();
+    vkDeviceWaitIdle(GetContext()->Device);
+
     DescriptorHeaps.clear();
 
     delete SceneCam;
 
     delete pSceneDescriptorLayout;
-    delete pSceneDescriptorSet;
 
-    delete Instanced::pMeshPassLayout;
+    for(FrameSlot& Frame : Frames)
+    {
+        delete Frame.pSceneDescriptorSet;
+        delete Frame.pDrawDescriptorSet;
+    }
+
+    for(ThreadRecorder* pRecorder : Recorders)
+    {
+        delete pRecorder;
+    }
+
+    delete pComputeRecycler;
+
+    delete pDrawDescriptorLayout;
 
     CloseWrapperFW();
 }
@@ -447,9 +582,9 @@ Pipeline* SceneRenderer::CreatePipeline(std::string PipeName, uint32_t SubpassId
         PipeStages[PipeName] = new PipeStage(); // push the new pipe stage into the pipestages vector
         Pipeline* Pipe = new Pipeline(); // create a temporary pipeline
 
-        // Add the scene descriptor set.
+        // Add the scene and draw descriptor sets.
         Pipe->AddDescriptor(pSceneDescriptorLayout);
-        Pipe->AddDescriptor(Instanced::pMeshPassLayout);
+        Pipe->AddDescriptor(pDrawDescriptorLayout);
 
         // Add the passed descriptors
         for(uint32_t i = 0; i < DescriptorCount; i++)
@@ -463,8 +598,10 @@ Pipeline* SceneRenderer::CreatePipeline(std::string PipeName, uint32_t SubpassId
             Pipe->AddAttachmentBlending(BlendAttachments[i]);
         }
 
-        // Set the pipeline profile to scene default
-        Pipe->SetProfile(SceneProfile);
+        // Use the passed profile, or the scene default
+        PipelineProfile& Profile = (pProfile != nullptr) ? *pProfile : SceneProfile;
+        Pipe->SetProfile(Profile);
+        PipeStages[PipeName]->bPositionStream = Profile.bPositionStream;
 
         // bake the pipeline in the renderpass/subpass with the specified shaders.
         Pipe->Bake(&ScenePass, SubpassIdx, VtxPath, FragPath);
@@ -502,12 +639,63 @@ Pipeline* SceneRenderer::CreatePipeline(std::string PipeName, uint32_t SubpassId
 
 void SceneRenderer::AddMesh(pbrMesh* pMesh, std::string PipeName)
 {
-    pMesh->pMeshPassSet = DescriptorHeaps[*Instanced::pMeshPassLayout].CreateSet();
+    if(SceneMeshes.size() == MAX_SCENE_MESHES)
+    {
+        throw std::runtime_error("Failed to add mesh, the scene already holds MAX_SCENE_MESHES meshes.");
+    }
+
+    if(VertexIter + pMesh->VertCount > MAX_SCENE_VERTICES || IndexIter + pMesh->IndexCount > MAX_SCENE_INDICES)
+    {
+        throw std::runtime_error("Failed to add mesh, the scene's geometry arenas are full.");
+    }
+
+    // draw generation culls the mesh's instances against its bounding sphere, and the vertex shader unpacks its positions with the bounding box.
+    pMesh->GenBounds();
+    pMesh->MeshIdx = (uint32_t)SceneMeshes.size();
+
+    glm::vec4 Bounds[2] = { pMesh->BoundingSphere, pMesh->BoundingExtent };
+    GetTransferAgent()->Transfer(Bounds, sizeof(Bounds), &MeshBoundsBuffer, pMesh->MeshIdx*sizeof(Bounds));
+
+    // the indices stay relative to the mesh, its draw command's vertexOffset moves them to the mesh's range of the vertex arena.
+    pMesh->VertexOffset = VertexIter;
+    pMesh->FirstIndex = IndexIter;
+
+    std::vector<PackedVertex> Packed(pMesh->VertCount);
+    pMesh->PackVertices(Packed.data());
+
+    std::vector<PackedPosition> Positions(pMesh->VertCount);
+
+    for(uint32_t i = 0; i < pMesh->VertCount; i++)
+    {
+        Positions[i] = VertexPacking::GetPosition(Packed[i]);
+    }
+
+    GetTransferAgent()->Transfer(Packed.data(), Packed.size()*sizeof(PackedVertex), &VertexArena, VertexIter*sizeof(PackedVertex));
+    GetTransferAgent()->Transfer(Positions.data(), Positions.size()*sizeof(PackedPosition), &PositionArena, VertexIter*sizeof(PackedPosition));
+    GetTransferAgent()->Transfer(pMesh->pIndices, pMesh->IndexCount*sizeof(uint32_t), &IndexArena, IndexIter*sizeof(uint32_t));
+
+    VertexIter += pMesh->VertCount;
+    IndexIter += pMesh->IndexCount;
+
+    SceneMeshes.push_back(pMesh);
+    bInstancesChanged = true;
+
     PipeStages[PipeName]->Meshes.push_back(pMesh);
 }
 
 Drawable* SceneRenderer::CreateDrawable(pbrMesh* Mesh, bool bDynamic)
 {
+    // dynamic transforms are written straight into the frame's slice of the dynamic scene buffer, an index past the slice would write into a slice another frame is reading.
+    if(bDynamic && DynamicIter == MAX_DYNAMIC_SCENE_SIZE)
+    {
+        throw std::runtime_error("Failed to create drawable, the scene already holds MAX_DYNAMIC_SCENE_SIZE dynamic drawables.");
+    }
+
+    if(!bDynamic && StaticIter == MAX_STATIC_SCENE_SIZE)
+    {
+        throw std::runtime_error("Failed to create drawable, the scene already holds MAX_STATIC_SCENE_SIZE static drawables.");
+    }
+
     Drawable* pRet;
 
     if(bDynamic)
@@ -517,6 +705,8 @@ Drawable* SceneRenderer::CreateDrawable(pbrMesh* Mesh, bool bDynamic)
         pRet->ObjIdx = DynamicIter;
         DynamicIter++;
         pRet->bStatic = false;
+
+        DynamicDrawables.push_back(pRet);
     }
     else
     {
@@ -527,7 +717,9 @@ Drawable* SceneRenderer::CreateDrawable(pbrMesh* Mesh, bool bDynamic)
         pRet->bStatic = true;
     }
 
-    Mesh->AddInstance(pRet->ObjIdx);
+    // instances of both scene buffers share the mesh's instance list, the shaders pick the buffer by the flag.
+    Mesh->AddInstance(bDynamic ? (pRet->ObjIdx | DYNAMIC_INSTANCE_BIT) : pRet->ObjIdx);
+    bInstancesChanged = true;
 
     return pRet;
 }
@@ -559,10 +751,23 @@ void SceneRenderer::Bake()
 {
     ScenePass.Bake();
 
-    SceneSync.DrawGenSem = CreateVulkanSemaphore();
-    SceneSync.pFrameFence = CreateFence();
+    for(FrameSlot& Frame : Frames)
+    {
+        Frame.ImageAvailableSem = CreateVulkanSemaphore();
+    }
+
+    // command pools are externally synchronized, so every thread that records gets its own.
+    for(uint32_t i = 0; i < GetJobSystem()->GetThreadCount(); i++)
+    {
+        ThreadRecorder* pRecorder = new ThreadRecorder();
+        pRecorder->Graphics.Bake(CommandType::eCmdGraphics, FRAMES_IN_FLIGHT);
+
+        Recorders.push_back(pRecorder);
+    }
 
-    pCmdComputeBuffer = ComputeHeap.CreateBuffer();
+    // draw generation is a single dispatch recorded by the calling thread.
+    pComputeRecycler = new Allocators::CommandRecycler();
+    pComputeRecycler->Bake(CommandType::eCmdCompute, FRAMES_IN_FLIGHT);
 
     pCmdOpsBuffer = GraphicsHeap.CreateBuffer();
     pCmdOpsBuffer->Start();
@@ -605,96 +810,310 @@ void SceneRenderer::Bake()
 
 void SceneRenderer::Update()
 {
-    for(uint32_t i = 0; i < PassStages.size(); i++)
+    // updates the slot the next call to Render() records into.
+    UpdateDrawLists((uint32_t)(FrameCount % FRAMES_IN_FLIGHT));
+}
+
+void SceneRenderer::UpdateDrawLists(uint32_t FrameSlot)
+{
+    if(bInstancesChanged)
+    {
+        // the instances are grouped by mesh, so every mesh's visible instances land in a range of their own that its draw command's firstInstance points at.
+        DrawTemplates.assign(SceneMeshes.size(), {});
+        InstanceList.clear();
+
+        for(pbrMesh* pMesh : SceneMeshes)
+        {
+            VkDrawIndexedIndirectCommand& Template = DrawTemplates[pMesh->MeshIdx];
+            Template.indexCount = pMesh->IndexCount;
+            Template.firstIndex = pMesh->FirstIndex;
+            Template.vertexOffset = (int32_t)pMesh->VertexOffset;
+            Template.firstInstance = (uint32_t)(InstanceList.size()/2);
+
+            for(uint32_t SceneIdx : pMesh->GetInstances())
+            {
+                InstanceList.push_back(SceneIdx);
+                InstanceList.push_back(pMesh->MeshIdx);
+            }
+        }
+
+        // every pipe stage is drawn by one indirect count draw (its batch), with room for a draw per mesh.
+        BatchTable.assign(SceneMeshes.size()*2, 0);
+        BatchCount = 0;
+        uint32_t DrawCount = 0;
+
+        for(PassStage& Pass : PassStages)
+        {
+            for(PipeStage* pStage : Pass.PipeStages)
+            {
+                if(pStage->Meshes.size() == 0) continue;
+
+                pStage->BatchIdx = BatchCount++;
+                pStage->FirstDraw = DrawCount;
+                DrawCount += (uint32_t)pStage->Meshes.size();
+
+                for(pbrMesh* pMesh : pStage->Meshes)
+                {
+                    BatchTable[pMesh->MeshIdx*2] = pStage->BatchIdx;
+                    BatchTable[pMesh->MeshIdx*2+1] = pStage->FirstDraw;
+                }
+            }
+        }
+
+        bInstancesChanged = false;
+        DrawDirtySlots = (1u << FRAMES_IN_FLIGHT) - 1;
+    }
+
+    // the other slots may still be read by frames in flight, so each slot is brought up to date when it's next recorded.
+    if((DrawDirtySlots & (1u << FrameSlot)) == 0 || SceneMeshes.size() == 0)
+    {
+        return;
+    }
+
+    TransferAgent* pTransfer = GetTransferAgent();
+    VkDeviceSize SliceOffset = DrawSliceSize*FrameSlot;
+    uint32_t InstanceCount = (uint32_t)(InstanceList.size()/2);
+
+    uint32_t MeshCount = (uint32_t)SceneMeshes.size();
+
+    pTransfer->Transfer(DrawTemplates.data(), DrawTemplates.size()*sizeof(VkDrawIndexedIndirectCommand), &DrawBuffer, SliceOffset+DrawTemplateOffset);
+    pTransfer->Transfer(&MeshCount, sizeof(uint32_t), &DrawBuffer, SliceOffset+BatchTableOffset);
+    pTransfer->Transfer(BatchTable.data(), BatchTable.size()*sizeof(uint32_t), &DrawBuffer, SliceOffset+BatchTableOffset+(sizeof(uint32_t)*2));
+    pTransfer->Transfer(&InstanceCount, sizeof(uint32_t), &DrawBuffer, SliceOffset+InstanceListOffset);
+
+    if(InstanceCount != 0)
     {
-        PassStages[i].Update();
+        pTransfer->Transfer(InstanceList.data(), InstanceList.size()*sizeof(uint32_t), &DrawBuffer, SliceOffset+InstanceListOffset+(sizeof(uint32_t)*2)); // the pairs start after the (padded) count
     }
+
+    DrawDirtySlots &= ~(1u << FrameSlot);
 }
 
 void SceneRenderer::Render()
 {
-    if(pCmdRenderBuffer == nullptr)
+    TransferAgent* pTransfer = GetTransferAgent();
+    Context* pCtx = GetContext();
+
+    uint32_t Slot = (uint32_t)(FrameCount % FRAMES_IN_FLIGHT);
+    FrameSlot& Frame = Frames[Slot];
+
+    // wait for the frame that last used this slot (FRAMES_IN_FLIGHT frames ago), the frames after it keep rendering. Its primaries executed every secondary buffer of the slot, so all of the slot's pools are reset at once.
+    pComputeRecycler->BeginFrame(Slot);
+
+    for(ThreadRecorder* pRecorder : Recorders)
     {
-        pCmdRenderBuffer = GraphicsHeap.CreateBuffer();
+        pRecorder->Graphics.BeginFrame(Slot);
     }
 
-    TransferAgent* pTransfer = GetTransferAgent();
-    Context* pCtx = GetContext();
+    Frame.pCmdComputeBuffer = pComputeRecycler->Acquire();
+    Frame.pCmdRenderBuffer = Recorders[0]->Graphics.Acquire();
 
-    pCmdComputeBuffer->cmdFence->Wait(); // wait for previous frame to render
+    uint32_t FrameIdx = GetWindow()->GetNextFrame(nullptr, &Frame.ImageAvailableSem);
 
-    uint32_t FrameIdx = GetWindow()->GetNextFrame(SceneSync.pFrameFence);
+    #ifdef DEBUG_MODE
+        if(FrameCount % MEMORY_STATS_INTERVAL == 0)
+        {
+            DumpMemoryStats(working_directory"MemoryStats.json");
+        }
+    #endif
+
+    FrameCount++;
 
     SceneCam->Rotate();
     SceneCam->Move();
-    SceneCam->Update();
+    SceneCam->Update(Slot);
+
+    // the slot's slice of the dynamic scene buffer is only read by this frame, so every dynamic transform is rewritten.
+    glm::mat4* pDynamicTransforms = DynamicSceneBuffer.As<glm::mat4>(DynamicSliceSize*Slot);
 
-    /* Update descriptor Information (i.e. instance lists and transforms) */
-    for(PassStage& pStage : PassStages)
+    for(Drawable* pDrawable : DynamicDrawables)
     {
-        for(PipeStage* pPipeStage : pStage.PipeStages)
-        {
-            for(pbrMesh* pMesh : pPipeStage->Meshes)
-            {
-                pMesh->Update();
-            }
-        }
+        pDynamicTransforms[pDrawable->ObjIdx] = pDrawable->Transform;
     }
 
-    pTransfer->Flush();
+    UpdateDrawLists(Slot);
 
-    /**** TEMP : move sync to front of function ****/
-    // pCmdRenderBuffer->cmdFence->Wait(); // wait for previous frame to render
+    VkSemaphore GraphicsTimeline = GetQueueTimeline(CommandType::eCmdGraphics);
 
-    pCmdComputeBuffer->Reset();
-    pCmdComputeBuffer->Start();
+    /* moving buffers re-writes the descriptor sets that point at them (every slot's), which is only allowed while no frame using them is in flight.
+       With frames in flight the gpu is practically never idle here, so every DEFRAG_FRAME_INTERVAL frames the frames in flight are waited for, if there's anything to move. */
+    if(FrameCount % DEFRAG_FRAME_INTERVAL == 0 && NeedsDefragment())
+    {
+        WaitSync(LastRender);
+
+        VkDeviceSize Moved = Defragment();
 
-        vkCmdBindDescriptorSets(*pCmdComputeBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, DrawPipeline.PipeLayout, 0, 1, &pSceneDescriptorSet->DescSet, 0, nullptr);
-        vkCmdBindPipeline(*pCmdComputeBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, DrawPipeline);
+        #ifdef DEBUG_MODE
+            if(Moved != 0)
+            {
+                std::cout << "Defragment() moved " << Moved << " bytes\n";
+            }
+        #else
+            (void)Moved;
+        #endif
+    }
+
+    /* the static scene and light buffers (and images and buffers Defragment() moves) are shared between frames, so uploads to them wait for the previous frame to finish rendering.
+       The slot's slice of the draw buffer was last read FRAMES_IN_FLIGHT frames ago (BeginFrame() waited for it), so a flush that only writes draw data doesn't wait and culling still overlaps the previous frame's rendering. */
+    pTransfer->SetFlushDependency(pTransfer->WritesOutside(&DrawBuffer) ? GraphicsTimeline : VK_NULL_HANDLE, LastRender.Value);
+
+    pTransfer->Flush();
 
-       // pTransfer->AwaitFlush();
+    /* record every pipe stage's draw in parallel. Each job records into a secondary buffer from its thread's pool. */
+        RecordJobs.clear();
+        PassJobOffsets.clear();
 
         for(uint32_t i = 0; i < PassStages.size(); i++)
         {
-            for(uint32_t x = 0; x < PassStages[i].PipeStages.size(); x++)
+            PassJobOffsets.push_back((uint32_t)RecordJobs.size());
+
+            for(PipeStage* pStage : PassStages[i].PipeStages)
             {
-                PassStages[i].PipeStages[x]->UpdateDraws(pCmdComputeBuffer, DrawPipeline.PipeLayout);
+                if(pStage->Meshes.size() != 0)
+                {
+                    RecordJobs.push_back({pStage, i, nullptr});
+                }
             }
         }
- 
-    pCmdComputeBuffer->Stop();
 
-    ComputeHeap.Submit(pCmdComputeBuffer, 1, &SceneSync.DrawGenSem);
+        PassJobOffsets.push_back((uint32_t)RecordJobs.size());
+
+        VkCommandBufferInheritanceInfo DrawInheritance{};
+        DrawInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        DrawInheritance.renderPass = ScenePass.rPass;
+        DrawInheritance.framebuffer = *(VkFramebuffer*)FrameChain.FrameBuffers[FrameIdx];
+
+        VkDescriptorSet FrameSets[] = { Frame.pSceneDescriptorSet->DescSet, Frame.pDrawDescriptorSet->DescSet };
+
+        GetJobSystem()->Dispatch((uint32_t)RecordJobs.size(), [&](uint32_t JobIdx, uint32_t ThreadIdx)
+        {
+            RecordJob& Job = RecordJobs[JobIdx];
+            ThreadRecorder* pRecorder = Recorders[ThreadIdx];
+
+            VkCommandBufferInheritanceInfo Inheritance = DrawInheritance;
+            Inheritance.subpass = Job.PassIdx;
+
+            Job.pGraphicsBuffer = pRecorder->Graphics.Acquire(VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+            Job.pGraphicsBuffer->Start(&Inheritance);
+
+                // secondary buffers inherit no state from the primary, so the scene and draw sets and the geometry arenas are bound by every one of them.
+                vkCmdBindDescriptorSets(*Job.pGraphicsBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, Job.pStage->Pipe->PipeLayout, 0, 2, FrameSets, 0, nullptr);
+
+                VkDeviceSize VertexBase = 0;
+                vkCmdBindVertexBuffers(*Job.pGraphicsBuffer, 0, 1, Job.pStage->bPositionStream ? PositionArena : VertexArena, &VertexBase);
+                vkCmdBindIndexBuffer(*Job.pGraphicsBuffer, IndexArena, 0, VK_INDEX_TYPE_UINT32);
+
+                Job.pStage->Draw(Job.pGraphicsBuffer, DrawBuffer, DrawSliceSize*Slot + CompactDrawOffset, DrawSliceSize*Slot + DrawCountOffset);
+
+            Job.pGraphicsBuffer->Stop();
+        });
+
+        std::vector<VkCommandBuffer> Secondaries(RecordJobs.size());
+
+    Frame.pCmdComputeBuffer->Start();
+
+        // reset the slot's draw commands to their templates (no instances) and its batch draw counts to 0, then let draw generation count them back up.
+        if(SceneMeshes.size() != 0)
+        {
+            VkBufferCopy ResetCopy{};
+            ResetCopy.srcOffset = DrawSliceSize*Slot + DrawTemplateOffset;
+            ResetCopy.dstOffset = DrawSliceSize*Slot;
+            ResetCopy.size = SceneMeshes.size()*sizeof(VkDrawIndexedIndirectCommand);
+
+            vkCmdCopyBuffer(*Frame.pCmdComputeBuffer, DrawBuffer, DrawBuffer, 1, &ResetCopy);
+            vkCmdFillBuffer(*Frame.pCmdComputeBuffer, DrawBuffer, DrawSliceSize*Slot + DrawCountOffset, BatchCount*sizeof(uint32_t), 0);
+        }
+
+        VkMemoryBarrier ResetBarrier{};
+        ResetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        ResetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        ResetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(*Frame.pCmdComputeBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &ResetBarrier, 0, nullptr, 0, nullptr);
+
+        // every instance of every mesh is culled by one dispatch, one invocation per instance.
+        uint32_t InstanceCount = (uint32_t)(InstanceList.size()/2);
+
+        if(InstanceCount != 0)
+        {
+            vkCmdBindPipeline(*Frame.pCmdComputeBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, DrawPipeline);
+            vkCmdBindDescriptorSets(*Frame.pCmdComputeBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, DrawPipeline.PipeLayout, 0, 2, FrameSets, 0, nullptr);
+
+            vkCmdDispatch(*Frame.pCmdComputeBuffer, (InstanceCount+DRAW_GROUP_SIZE-1)/DRAW_GROUP_SIZE, 1, 1);
+
+            // the instance counts are final once culling is done, so only then can the meshes that have visible instances be packed into their batches.
+            VkMemoryBarrier CullBarrier{};
+            CullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            CullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            CullBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            vkCmdPipelineBarrier(*Frame.pCmdComputeBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &CullBarrier, 0, nullptr, 0, nullptr);
+
+            vkCmdBindPipeline(*Frame.pCmdComputeBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, CompactPipeline);
+            vkCmdBindDescriptorSets(*Frame.pCmdComputeBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, CompactPipeline.PipeLayout, 0, 2, FrameSets, 0, nullptr);
+
+            vkCmdDispatch(*Frame.pCmdComputeBuffer, ((uint32_t)SceneMeshes.size()+DRAW_GROUP_SIZE-1)/DRAW_GROUP_SIZE, 1, 1);
+        }
+
+    Frame.pCmdComputeBuffer->Stop();
+
+    // draw generation reads the instance lists uploaded by this frame's flush. It only writes the slot's slice of the draw buffer, which the frame that last used the slot is done with (waited for above), so it runs on the compute queue while the previous frame is still rendering.
+    VkSemaphore TransferTimeline = pTransfer->GetTimeline();
+    uint64_t TransferValue = pTransfer->GetSubmitValue();
+
+    VkPipelineStageFlags ComputeWaitStage = VK_PIPELINE_STAGE_TRANSFER_BIT; // the draw reset is the first command that touches the slice
 
-    pCmdRenderBuffer->Reset();
-    pCmdRenderBuffer->Start();
+    SyncPoint ComputePoint = ComputeHeap.Submit(Frame.pCmdComputeBuffer, 0, nullptr, 1, &TransferTimeline, &ComputeWaitStage, nullptr, &TransferValue);
 
-        ScenePass.Begin(*pCmdRenderBuffer, FrameChain.FrameBuffers[FrameIdx]);
+    Frame.pCmdRenderBuffer->Start();
+
+        pTransfer->RecordAcquires(Frame.pCmdRenderBuffer, pCtx->GraphicsFamily); // take ownership of the images this frame's flush released
+
+        for(uint32_t i = 0; i < RecordJobs.size(); i++)
+        {
+            Secondaries[i] = *RecordJobs[i].pGraphicsBuffer;
+        }
+
+        ScenePass.Begin(*Frame.pCmdRenderBuffer, FrameChain.FrameBuffers[FrameIdx], VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
             for(uint32_t i = 0; i < PassStages.size(); i++)
             {
-                vkCmdBindDescriptorSets(*pCmdRenderBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, PassStages[i].PipeStages[0]->Pipe->PipeLayout, 0, 1, &pSceneDescriptorSet->DescSet, 0, nullptr);
+                uint32_t JobCount = PassJobOffsets[i+1]-PassJobOffsets[i];
 
-                for(uint32_t x = 0; x < PassStages[i].PipeStages.size(); x++)
+                if(JobCount != 0)
                 {
-                    PassStages[i].PipeStages[x]->Draw(pCmdRenderBuffer);
+                    vkCmdExecuteCommands(*Frame.pCmdRenderBuffer, JobCount, Secondaries.data()+PassJobOffsets[i]);
                 }
 
                 if(i+1 != PassStages.size())
                 {
-                    vkCmdNextSubpass(*pCmdRenderBuffer, VK_SUBPASS_CONTENTS_INLINE);
+                    vkCmdNextSubpass(*Frame.pCmdRenderBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
                 }
             }
-        ScenePass.End(*pCmdRenderBuffer);
+        ScenePass.End(*Frame.pCmdRenderBuffer);
 
-    pCmdRenderBuffer->Stop();
+    Frame.pCmdRenderBuffer->Stop();
 
-    SceneSync.pFrameFence->Wait(); // wait for image acquisition
-    GraphicsHeap.Submit(pCmdRenderBuffer, 1, &RenderSemaphores[FrameIdx], 1, &SceneSync.DrawGenSem, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    // rendering waits on draw generation, the flush for the vertex/transform/light data it reads (draw indirect is the first stage, so waiting there covers the shaders too), and the swapchain image.
+    // draw generation is waited on through the compute timeline, so both submissions can sit in the same batch in any order.
+    VkSemaphore RenderWaits[] = { GetQueueTimeline(CommandType::eCmdCompute), TransferTimeline, Frame.ImageAvailableSem };
+    VkPipelineStageFlags RenderWaitStages[] = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    uint64_t RenderWaitValues[] = { ComputePoint.Value, TransferValue, 0 };
 
-    GetWindow()->PresentFrame(FrameIdx, &RenderSemaphores[FrameIdx]);
+    LastRender = GraphicsHeap.Submit(Frame.pCmdRenderBuffer, 1, &RenderSemaphores[FrameIdx], 3, RenderWaits, RenderWaitStages, nullptr, RenderWaitValues);
+
+    // uploads queued before the next frame may write anything (and are flushed early when the staging ring fills up), so they wait for this frame's rendering.
+    pTransfer->SetFlushDependency(GraphicsTimeline, LastRender.Value);
+
+    // the scene buffers are read by both submissions.
+    Resources::Buffer* SceneBuffers[] = { &SceneCam->WvpBuffer, &StaticSceneBuffer, &DynamicSceneBuffer, &SceneLightBuffer, &MeshBoundsBuffer, &DrawBuffer, &VertexArena, &PositionArena, &IndexArena };
+
+    for(Resources::Buffer* pBuffer : SceneBuffers)
+    {
+        MarkUsed(pBuffer->Alloc, ComputePoint);
+        MarkUsed(pBuffer->Alloc, LastRender);
+    }
 
-    pCmdComputeBuffer->cmdFence->Wait();
-    pCmdRenderBuffer->cmdFence->Wait(); // TEMP.
+    GetWindow()->PresentFrame(FrameIdx, &RenderSemaphores[FrameIdx]);
 }
 
 pbrMesh** AssetManager::CreateMesh(std::string Path, std::string PipeName, uint32_t& MeshCount)
@@ -737,6 +1156,8 @@ pbrMesh** AssetManager::CreateMesh(std::string Path, std::string PipeName, uint3
         Ret.push_back(pTmp);
         pTmp->Name = Mesh.name;
 
+        bool bTriangleList = true;
+
         // process the mesh primitives' vertices.
         for(tinygltf::Primitive& Prim : Mesh.primitives)
         {
@@ -789,6 +1210,8 @@ pbrMesh** AssetManager::CreateMesh(std::string Path, std::string PipeName, uint3
             pTmp->pIndices = new uint32_t[tmpIdx.size()];
             pTmp->IndexCount = (uint32_t)tmpIdx.size();
 
+            bTriangleList = Prim.mode == TINYGLTF_MODE_TRIANGLES;
+
             for(uint32_t i = 0; i < tmpIdx.size(); i++)
             {
                 pTmp->pIndices[i] = tmpIdx[i];
@@ -800,35 +1223,14 @@ pbrMesh** AssetManager::CreateMesh(std::string Path, std::string PipeName, uint3
              // TODO : Implement material loading from gltf files.
         }
 
-        // create the mesh buffer (for vertices and indices)
-        CreateBuffer(pTmp->MeshBuffer, (pTmp->VertCount * sizeof(Vertex)) + (pTmp->IndexCount * sizeof(uint32_t)), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-
-        // Store the byte offset of the indices (needed during render.)
-        pTmp->IndexOffset = pTmp->VertCount*sizeof(Vertex);
-
-        #ifdef DEBUG_MODE
-            Allocate(pTmp->MeshBuffer, true);
-            Map(&pTmp->MeshBuffer);
-
-            // GetTransferAgent()->Transfer(pTmp->Vertices.data(), pTmp->Vertices.size()*sizeof(Vertex), &pTmp->MeshBuffer, 0);
-            // GetTransferAgent()->Transfer(pTmp->Indices.data(), pTmp->Indices.size()*sizeof(uint32_t), &pTmp->MeshBuffer, pTmp->Vertices.size()*sizeof(Vertex));
-
-            // works
-            // GetTransferAgent()->Transfer((uint8_t*)pTmp->pVertices, pTmp->VertCount*sizeof(Vertex), &pTmp->MeshBuffer, 0);
-            // GetTransferAgent()->Transfer((uint8_t*)pTmp->pIndices, pTmp->IndexCount*sizeof(uint32_t), &pTmp->MeshBuffer, pTmp->VertCount*sizeof(Vertex));
-        
-             GetTransferAgent()->Transfer(pTmp->pVertices, pTmp->VertCount*sizeof(Vertex), &pTmp->MeshBuffer, 0);
-             GetTransferAgent()->Transfer(pTmp->pIndices, pTmp->IndexCount*sizeof(uint32_t), &pTmp->MeshBuffer, pTmp->IndexOffset);
-        #else
-            Allocate(pTmp->MeshBuffer, false);
-
-            GetTransferAgent()->Transfer(pTmp->pVertices, pTmp->VertCount*sizeof(Vertex), &pTmp->MeshBuffer, 0);
-            GetTransferAgent()->Transfer(pTmp->pIndices, pTmp->IndexCount*sizeof(uint32_t), &pTmp->MeshBuffer, pTmp->VertCount*sizeof(Vertex));
-        #endif
+        // reorder the triangles and vertices for the gpu before they're uploaded. Strips and fans can't be reordered triangle by triangle.
+        if(bTriangleList)
+        {
+            pTmp->Optimize();
+        }
 
+        // AddMesh() uploads the vertices and indices into the renderer's geometry arenas.
         pRenderer->AddMesh(pTmp, PipeName);
-
-        pTmp->Bake();
     }
 
     pbrMesh** pRet = new pbrMesh*[Ret.size()]; // dynamically allocate return pointers.
@@ -859,9 +1261,11 @@ Resources::Image* AssetManager::LoadImage(std::string ImageFile, VkSampleCountFl
 
     int ChannelCount = ImgSpec.nchannels;
 
-    uint8_t* pImageData = new uint8_t[Width * Height * ChannelCount];
+    // read the pixels in the file's own channel type, so the data matches the format picked for it below.
+    size_t ImageSize = (size_t)Width * Height * ChannelCount * ImgSpec.format.size();
+    uint8_t* pImageData = new uint8_t[ImageSize];
 
-    ImgPtr->read_image(0, 0, 0, ChannelCount, OIIO::TypeDesc::UINT8, &pImageData[0]);
+    ImgPtr->read_image(0, 0, 0, ChannelCount, ImgSpec.format, &pImageData[0]);
 
     VkFormat Frmt;
     bool bFrmtGood = false;
@@ -971,7 +1375,7 @@ Resources::Image* AssetManager::LoadImage(std::string ImageFile, VkSampleCountFl
     Layers.baseArrayLayer = 0;
     Layers.mipLevel = 0;
 
-    GetTransferAgent()->Transfer(pImageData, sizeof(uint8_t)*Height*Width*ChannelCount, Ret, {Width, Height, 0}, {0, 0, 0}, Layers, VK_IMAGE_LAYOUT_UNDEFINED);
+    GetTransferAgent()->Transfer(pImageData, ImageSize, Ret, {Width, Height, 0}, {0, 0, 0}, Layers, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
     delete[] pImageData;
 
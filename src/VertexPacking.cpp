@@ -0,0 +1,103 @@
+#include "VertexPacking.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace VertexPacking
+{
+    void FitBounds(const Vertex* pVertices, uint32_t Count, glm::vec4& Sphere, glm::vec4& Extent)
+    {
+        if(Count == 0)
+        {
+            Sphere = glm::vec4(0.f);
+            Extent = glm::vec4(0.f);
+            return;
+        }
+
+        // center the sphere on the bounding box, it's not the tightest fit but it's cheap and never misses a vertex.
+        glm::vec3 Min = pVertices[0].Position;
+        glm::vec3 Max = pVertices[0].Position;
+
+        for(uint32_t i = 1; i < Count; i++)
+        {
+            Min = glm::min(Min, pVertices[i].Position);
+            Max = glm::max(Max, pVertices[i].Position);
+        }
+
+        glm::vec3 Center = (Min+Max)*0.5f;
+        float Radius = 0.f;
+
+        for(uint32_t i = 0; i < Count; i++)
+        {
+            Radius = std::max(Radius, glm::length(pVertices[i].Position-Center));
+        }
+
+        Sphere = glm::vec4(Center, Radius);
+        Extent = glm::vec4((Max-Min)*0.5f, 0.f);
+    }
+
+    glm::vec2 OctEncode(glm::vec3 Normal)
+    {
+        float Sum = std::abs(Normal.x) + std::abs(Normal.y) + std::abs(Normal.z);
+
+        if(Sum == 0.f)
+        {
+            return glm::vec2(0.f, 0.f);
+        }
+
+        glm::vec2 Oct(Normal.x/Sum, Normal.y/Sum);
+
+        if(Normal.z < 0.f)
+        {
+            Oct = glm::vec2((1.f - std::abs(Oct.y)) * (Oct.x >= 0.f ? 1.f : -1.f), (1.f - std::abs(Oct.x)) * (Oct.y >= 0.f ? 1.f : -1.f));
+        }
+
+        return Oct;
+    }
+
+    glm::vec3 OctDecode(glm::vec2 Oct)
+    {
+        glm::vec3 N(Oct.x, Oct.y, 1.f - std::abs(Oct.x) - std::abs(Oct.y));
+
+        // fold the lower half of the octahedron back down
+        float Fold = std::max(-N.z, 0.f);
+        N.x += (N.x >= 0.f) ? -Fold : Fold;
+        N.y += (N.y >= 0.f) ? -Fold : Fold;
+
+        return glm::normalize(N);
+    }
+
+    void Pack(const Vertex* pVertices, uint32_t Count, glm::vec3 Center, glm::vec3 Extent, PackedVertex* pOut)
+    {
+        // flat meshes have no extent along an axis, every position maps to 0 there.
+        glm::vec3 InvExtent(0.f);
+
+        for(uint32_t i = 0; i < 3; i++)
+        {
+            if(Extent[i] > 0.f) InvExtent[i] = 1.f / Extent[i];
+        }
+
+        for(uint32_t i = 0; i < Count; i++)
+        {
+            glm::vec3 Pos = (pVertices[i].Position - Center) * InvExtent;
+
+            pOut[i].PositionXY = glm::packSnorm2x16(glm::vec2(Pos.x, Pos.y));
+            pOut[i].PositionZ = glm::packSnorm2x16(glm::vec2(Pos.z, 0.f));
+            pOut[i].Normal = glm::packSnorm2x16(OctEncode(pVertices[i].Normal));
+            pOut[i].UV = glm::packHalf2x16(pVertices[i].UV);
+        }
+    }
+
+    Vertex Unpack(const PackedVertex& Packed, glm::vec3 Center, glm::vec3 Extent)
+    {
+        glm::vec2 XY = glm::unpackSnorm2x16(Packed.PositionXY);
+        glm::vec2 Z = glm::unpackSnorm2x16(Packed.PositionZ);
+
+        Vertex Out;
+        Out.Position = Center + glm::vec3(XY.x, XY.y, Z.x) * Extent;
+        Out.Normal = OctDecode(glm::unpackSnorm2x16(Packed.Normal));
+        Out.UV = glm::unpackHalf2x16(Packed.UV);
+
+        return Out;
+    }
+}
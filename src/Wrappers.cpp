@@ -1,6 +1,7 @@
 #include "Wrappers.hpp"
 #include "Framework.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <vulkan/vulkan_core.h>
@@ -41,8 +42,11 @@ namespace Resources
 
     Image::~Image()
     {
+        WaitIdle(Alloc);
+
         vkDestroyImageView(GetContext()->Device, View, nullptr);
         vkDestroyImage(GetContext()->Device, Img, nullptr);
+        Free(Alloc);
     }
 
     Buffer::Buffer(std::string Name) : Name(Name)
@@ -53,7 +57,9 @@ namespace Resources
     Buffer::~Buffer()
     {
         std::cout << "Destroying Buffer " << Name << '\n';
+        WaitIdle(Alloc);
         vkDestroyBuffer(GetContext()->Device, Buff, nullptr);
+        Free(Alloc);
     }
     
     CommandBuffer::CommandBuffer()
@@ -66,7 +72,7 @@ namespace Resources
         vkFreeCommandBuffers(GetContext()->Device, *pPool, 1, &cmdBuffer);
     }
 
-    void CommandBuffer::Bake(VkCommandPool* pCmdPool)
+    void CommandBuffer::Bake(VkCommandPool* pCmdPool, VkCommandBufferLevel Level)
     {
         VkResult Err;
 
@@ -74,7 +80,7 @@ namespace Resources
         AllocInf.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
         AllocInf.commandBufferCount = 1;
         AllocInf.commandPool = *pCmdPool;
-        AllocInf.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        AllocInf.level = Level;
 
         Context* pCtx = GetContext();
 
@@ -83,8 +89,6 @@ namespace Resources
             throw std::runtime_error("Failed to allocate command buffer");
         }
 
-        cmdFence = CreateFence("Commandbuffer Fence");
-
         pPool = pCmdPool;
     }
 
@@ -93,12 +97,23 @@ namespace Resources
         vkResetCommandBuffer(cmdBuffer, 0);
     }
 
-    void CommandBuffer::Start()
+    void CommandBuffer::Wait()
+    {
+        WaitSync(LastSubmit);
+    }
+
+    void CommandBuffer::Start(const VkCommandBufferInheritanceInfo* pInheritance)
     {
         VkResult Err;
 
         VkCommandBufferBeginInfo BegInf{};
         BegInf.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        BegInf.pInheritanceInfo = pInheritance;
+
+        if(pInheritance != nullptr && pInheritance->renderPass != VK_NULL_HANDLE)
+        {
+            BegInf.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        }
 
         if((Err = vkBeginCommandBuffer(cmdBuffer, &BegInf)) != VK_SUCCESS)
         {
@@ -135,9 +150,39 @@ namespace Resources
         vkCreateDescriptorSetLayout(pCtx->Device, &LayCI, nullptr, &Layout);
     }
 
+    static std::vector<DescriptorSet*> LiveDescriptorSets; // every descriptor set that hasn't been destroyed, searched by DescriptorSet::Refresh()
+
+    DescriptorSet::DescriptorSet()
+    {
+        LiveDescriptorSets.push_back(this);
+    }
+
     DescriptorSet::~DescriptorSet()
     {
         vkFreeDescriptorSets(GetContext()->Device, *pPool, 1, &DescSet);
+
+        LiveDescriptorSets.erase(std::find(LiveDescriptorSets.begin(), LiveDescriptorSets.end(), this));
+    }
+
+    void DescriptorSet::Refresh(Buffer* pBuffer)
+    {
+        for(DescriptorSet* pSet : LiveDescriptorSets)
+        {
+            std::vector<DescUpdate> Stale = {};
+
+            for(DescUpdate& Write : pSet->Writes)
+            {
+                if(Write.pBuff == pBuffer)
+                {
+                    Stale.push_back(Write);
+                }
+            }
+
+            if(Stale.size() != 0)
+            {
+                pSet->Update(Stale.data(), Stale.size());
+            }
+        }
     }
 
     void DescriptorSet::Update(DescUpdate* pUpdateInfos, size_t Count)
@@ -152,6 +197,14 @@ namespace Resources
 
         for(uint32_t i = 0; i < Count; i++)
         {
+            // remember the write so it can be replayed if the buffer moves.
+            auto Prev = std::find_if(Writes.begin(), Writes.end(), [&](DescUpdate& Write) { return Write.Binding == pUpdateInfos[i].Binding && Write.DescIndex == pUpdateInfos[i].DescIndex; });
+
+            if(Prev != Writes.end())
+                *Prev = pUpdateInfos[i];
+            else
+                Writes.push_back(pUpdateInfos[i]);
+
             VkWriteDescriptorSet WriteInfo{};
             WriteInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             WriteInfo.descriptorType = pUpdateInfos[i].DescType;
@@ -180,6 +233,12 @@ namespace Resources
     FrameBuffer::~FrameBuffer()
     {
         vkDestroyFramebuffer(GetContext()->Device, Framebuff, nullptr);
+
+        for(uint32_t i = 0; i < Attachments.size(); i++)
+        {
+            vkDestroyImage(GetContext()->Device, Attachments[i], nullptr);
+            Free(AttachmentAllocations[i]);
+        }
     }
 
     void FrameBuffer::AddBuffer(VkImageCreateInfo ImgInf, VkImageLayout InitLayout)
@@ -200,35 +259,22 @@ namespace Resources
 
         Context* pCtx = GetContext();
 
+        AttachmentAllocations.resize(AttachmentInfos.size());
+
         for(uint32_t i = 0; i < AttachmentInfos.size(); i++)
         {
             VkImage Tmp;
-            VkDeviceMemory TmpMem;
 
             if((Err = vkCreateImage(pCtx->Device, &AttachmentInfos[i], nullptr, &Tmp)) != VK_SUCCESS)
             {
                 throw std::runtime_error("Failed to create Attachment for framebuffer.");
             }
 
-            VkMemoryRequirements MemReq;
-            vkGetImageMemoryRequirements(GetContext()->Device, Tmp, &MemReq);
-
-            VkMemoryAllocateInfo Allocinfo{};
-            Allocinfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            Allocinfo.memoryTypeIndex = GetContext()->Local;
-            Allocinfo.allocationSize = MemReq.size;
-
-            if((Err = vkAllocateMemory(GetContext()->Device, &Allocinfo, nullptr, &TmpMem)) != VK_SUCCESS)
-            {
-                throw std::runtime_error("Failed to allocate framebuffer allocation");
-            }
+            // attachments that are never stored can live in lazily allocated (tile) memory. Large attachments end up in dedicated allocations.
+            MemoryUsage Usage = (AttachmentInfos[i].usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ? MemoryUsage::eTransient : MemoryUsage::eGpuOnly;
 
-            if((Err = vkBindImageMemory(GetContext()->Device, Tmp, TmpMem, 0)) != VK_SUCCESS)
-            {
-                throw std::runtime_error("Failed to bind framebuffer memory");
-            }
+            Allocate(Tmp, AttachmentAllocations[i], Usage, AttachmentInfos[i].tiling);
 
-            AttachmentAllocations.push_back(TmpMem);
             Attachments.push_back(Tmp);
         }
 
@@ -368,7 +414,7 @@ namespace Allocators
         vkDestroyCommandPool(GetContext()->Device, cmdPool, nullptr);
     }
 
-    void CommandPool::Bake(CommandType cmdType)
+    void CommandPool::Bake(CommandType cmdType, VkCommandPoolCreateFlags Flags)
     {
         VkResult Err;
 
@@ -376,7 +422,7 @@ namespace Allocators
 
         VkCommandPoolCreateInfo PoolCI{};
         PoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        PoolCI.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        PoolCI.flags = Flags;
 
         if(cmdType == CommandType::eCmdGraphics)
         {
@@ -399,56 +445,132 @@ namespace Allocators
         PoolType = cmdType;
     }
 
-    void CommandPool::Submit(Resources::CommandBuffer* pCmdBuffer, uint32_t SignalSemCount, VkSemaphore* SignalSemaphores, uint32_t WaitSemCount, VkSemaphore* WaitSemaphores, VkPipelineStageFlagBits WaitStages)
+    SyncPoint CommandPool::Submit(Resources::CommandBuffer* pCmdBuffer, uint32_t SignalSemCount, VkSemaphore* SignalSemaphores, uint32_t WaitSemCount, VkSemaphore* WaitSemaphores, const VkPipelineStageFlags* WaitStages, const uint64_t* SignalValues, const uint64_t* WaitValues)
     {
-        VkResult Err;
+        Context* pCtx = GetContext();
 
-        VkPipelineStageFlags Wait = WaitStages;
+        if(PoolType != CommandType::eCmdGraphics && PoolType != CommandType::eCmdCompute && PoolType != CommandType::eCmdTransfer)
+        {
+            throw std::runtime_error("Failed to submit command buffer to pool due to uknown command type.\n");
+        }
 
-        VkSubmitInfo SubInf{};
-        SubInf.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        SubInf.commandBufferCount = 1;
-        SubInf.pCommandBuffers = *pCmdBuffer;
-        SubInf.pWaitDstStageMask = &Wait;
-        SubInf.signalSemaphoreCount = SignalSemCount;
-        SubInf.pSignalSemaphores = SignalSemaphores;
-        SubInf.waitSemaphoreCount = WaitSemCount;
-        SubInf.pWaitSemaphores = WaitSemaphores;
+        uint32_t QueueIdx = (uint32_t)PoolType;
+        uint64_t Value = ++pCtx->SubmittedValues[QueueIdx];
 
-        VkQueue* pQueue;
+        std::vector<PendingSubmit>& Pending = pCtx->PendingSubmits[QueueIdx];
 
-        if(PoolType == CommandType::eCmdGraphics)
+        if(Pending.size() == 0)
         {
-            pQueue = &(GetContext()->GraphicsQueue);
+            pCtx->PendingQueues.push_back(PoolType);
         }
-        else if(PoolType == CommandType::eCmdCompute)
-        {
-            pQueue = &(GetContext()->ComputeQueue);
-        }
-        else if(PoolType == CommandType::eCmdTransfer)
+
+        /* Every submission keeps a VkSubmitInfo of its own, they are only batched into one vkQueueSubmit call.
+           Merging command buffers into one submit info would make them wait on each other's semaphores and signal the timeline with only the newest value. */
+        PendingSubmit Sub;
+        Sub.CmdBuffer = *pCmdBuffer;
+
+        // every wait semaphore needs a stage of its own.
+        Sub.WaitSemaphores.assign(WaitSemaphores, WaitSemaphores+WaitSemCount);
+        Sub.WaitStages.assign(WaitSemCount, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        Sub.WaitValues.assign(WaitSemCount, 0);
+
+        if(WaitStages != nullptr) Sub.WaitStages.assign(WaitStages, WaitStages+WaitSemCount);
+        if(WaitValues != nullptr) Sub.WaitValues.assign(WaitValues, WaitValues+WaitSemCount);
+
+        // the queue's timeline is signaled after the caller's semaphores.
+        Sub.SignalSemaphores.assign(SignalSemaphores, SignalSemaphores+SignalSemCount);
+        Sub.SignalValues.assign(SignalSemCount, 0);
+
+        if(SignalValues != nullptr) Sub.SignalValues.assign(SignalValues, SignalValues+SignalSemCount);
+
+        Sub.SignalSemaphores.push_back(pCtx->Timelines[QueueIdx]);
+        Sub.SignalValues.push_back(Value);
+
+        Pending.push_back(std::move(Sub));
+
+        pCmdBuffer->LastSubmit = { PoolType, Value };
+
+        return pCmdBuffer->LastSubmit;
+    }
+
+    Resources::CommandBuffer* CommandPool::CreateBuffer(VkCommandBufferLevel Level)
+    {
+        Resources::CommandBuffer* Ret = new Resources::CommandBuffer();
+        Ret->Bake(&cmdPool, Level);
+
+        return Ret;
+    }
+
+    void CommandPool::Reset()
+    {
+        vkResetCommandPool(GetContext()->Device, cmdPool, 0);
+    }
+
+    CommandRecycler::~CommandRecycler()
+    {
+        for(FramePool* pFrame : Frames)
         {
-            pQueue = &(GetContext()->TransferQueue);
+            for(std::vector<Resources::CommandBuffer*>& Buffers : pFrame->Buffers)
+            {
+                for(Resources::CommandBuffer* pCmdBuffer : Buffers)
+                {
+                    pCmdBuffer->Wait();
+                    delete pCmdBuffer;
+                }
+            }
+
+            delete pFrame;
         }
-        else
+    }
+
+    void CommandRecycler::Bake(CommandType cmdType, uint32_t FrameCount)
+    {
+        for(uint32_t i = 0; i < FrameCount; i++)
         {
-            throw std::runtime_error("Failed to submit command buffer to pool due to uknown command type.\n");
+            FramePool* pFrame = new FramePool();
+
+            // buffers only live until the slot comes around again and are reset with the whole pool.
+            pFrame->Pool.Bake(cmdType, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+            Frames.push_back(pFrame);
         }
 
-        if((Err = vkQueueSubmit(*pQueue, 1, &SubInf, *(pCmdBuffer->cmdFence->GetFence()))) != VK_SUCCESS)
+        PoolType = cmdType;
+        CurrentFrame = 0;
+    }
+
+    void CommandRecycler::BeginFrame(uint32_t FrameIdx)
+    {
+        FramePool* pFrame = Frames[FrameIdx];
+
+        // only primary buffers are submitted, a secondary buffer's work is covered by the primary that executed it.
+        for(uint32_t i = 0; i < pFrame->Used[VK_COMMAND_BUFFER_LEVEL_PRIMARY]; i++)
         {
-            printf("Error : %i", Err);
-            throw std::runtime_error("Failed to submit a command buffer with error ");
+            pFrame->Buffers[VK_COMMAND_BUFFER_LEVEL_PRIMARY][i]->Wait();
         }
+
+        // one call resets every buffer allocated from the pool, the buffers keep their memory for the next recording.
+        pFrame->Pool.Reset();
+
+        pFrame->Used[VK_COMMAND_BUFFER_LEVEL_PRIMARY] = 0;
+        pFrame->Used[VK_COMMAND_BUFFER_LEVEL_SECONDARY] = 0;
+
+        CurrentFrame = FrameIdx;
     }
 
-    Resources::CommandBuffer* CommandPool::CreateBuffer()
+    Resources::CommandBuffer* CommandRecycler::Acquire(VkCommandBufferLevel Level)
     {
-        Resources::CommandBuffer* Ret = new Resources::CommandBuffer();
-        Ret->Bake(&cmdPool);
+        FramePool* pFrame = Frames[CurrentFrame];
 
-        Ret->cmdFence = CreateFence();
+        std::vector<Resources::CommandBuffer*>& Buffers = pFrame->Buffers[Level];
+        uint32_t& Used = pFrame->Used[Level];
 
-        return Ret;
+        if(Used == Buffers.size())
+        {
+            Buffers.push_back(pFrame->Pool.CreateBuffer(Level));
+        }
+
+        return Buffers[Used++];
     }
 }
 
@@ -518,7 +640,7 @@ void RenderPass::Bake()
     }
 }
 
-void RenderPass::Begin(Resources::CommandBuffer& cmdBuffer, Resources::FrameBuffer& FrameBuffer)
+void RenderPass::Begin(Resources::CommandBuffer& cmdBuffer, Resources::FrameBuffer& FrameBuffer, VkSubpassContents Contents)
 {
     VkRenderPassBeginInfo BeginInf{};
     BeginInf.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -529,7 +651,7 @@ void RenderPass::Begin(Resources::CommandBuffer& cmdBuffer, Resources::FrameBuff
     BeginInf.renderArea.offset = {0, 0};
     BeginInf.framebuffer = *(VkFramebuffer*)FrameBuffer;
 
-    vkCmdBeginRenderPass(cmdBuffer, &BeginInf, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(cmdBuffer, &BeginInf, Contents);
 }
 
 void RenderPass::End(Resources::CommandBuffer& cmdBuffer)
@@ -842,6 +964,9 @@ uint32_t Window::GetNextFrame(Resources::Fence* pFence, VkSemaphore* pSemaphore)
 
 void Window::PresentFrame(uint32_t FrameIdx, VkSemaphore* pWaitSem)
 {
+    // the semaphore is binary, so the submission signaling it has to reach the driver before the present waits on it.
+    FlushSubmits();
+
     VkPresentInfoKHR PresInf{};
     PresInf.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     PresInf.swapchainCount = 1;